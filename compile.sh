@@ -1,13 +1,46 @@
 #!/bin/bash
 
-# Compile memory manager
+# Compile memory manager and its backends
 gcc -c memory_manager.c -o memory_manager.o
+gcc -c memory_slab.c -o memory_slab.o
+gcc -c memory_arena.c -o memory_arena.o
+gcc -c memory_persistent.c -o memory_persistent.o
+gcc -c memory_snapshot.c -o memory_snapshot.o
+gcc -c memory_diagnostics.c -o memory_diagnostics.o
+gcc -c memory_trace.c -o memory_trace.o
+gcc -c memory_guard.c -o memory_guard.o
 
 # Compile main program
 gcc -c main.c -o main.o
 
 # Link and create executable
-gcc main.o memory_manager.o -o memory_demo
+gcc -pthread main.o memory_manager.o memory_slab.o memory_arena.o memory_persistent.o memory_snapshot.o memory_diagnostics.o memory_trace.o memory_guard.o -o memory_demo
+
+# Header mode: blocks past the soft cap are marked in their headers, and
+# the demo fails if a mark outlives its block
+gcc -pthread -DMEMORY_HEADER_METADATA=1 main.c memory_manager.c memory_slab.c memory_arena.c memory_persistent.c memory_snapshot.c memory_diagnostics.c memory_trace.c memory_guard.c -o memory_demo_header
+if ! ./memory_demo_header > /dev/null 2>&1; then
+    echo "ERROR: header mode demo left blocks live"
+    exit 1
+fi
+rm -f memory_demo_header
+
+# Build optimized benchmarks (run with ./memory_benchmark [name])
+gcc -O2 -pthread memory_benchmark.c memory_manager.c memory_slab.c memory_arena.c memory_persistent.c memory_snapshot.c memory_diagnostics.c memory_trace.c memory_guard.c -o memory_benchmark
+
+# Release mode: the macros must compile down to malloc/free with no
+# tracker calls left in the object code
+gcc -c -O2 -DMEMORY_TRACKING_ENABLED=0 main.c -o main_release.o
+if nm -u main_release.o | grep -q safe_memory_; then
+    echo "ERROR: release build still calls the tracker"
+    exit 1
+fi
+rm -f main_release.o
+gcc -O2 -pthread -DMEMORY_TRACKING_ENABLED=0 memory_benchmark.c memory_manager.c memory_slab.c memory_arena.c memory_persistent.c memory_snapshot.c memory_diagnostics.c memory_trace.c memory_guard.c -o memory_benchmark_release
+
+# LD_PRELOAD shim that routes every malloc/free in a process through the
+# tracker (LD_PRELOAD=./libmemory_preload.so MEMORY_PRELOAD_REPORT=20 program)
+gcc -O2 -fPIC -shared -pthread -fvisibility=hidden -ftls-model=initial-exec -DMEMORY_PRELOAD=1 memory_preload.c memory_manager.c memory_slab.c memory_arena.c memory_persistent.c memory_diagnostics.c memory_trace.c memory_guard.c -o libmemory_preload.so
 
 # Run the program
 ./memory_demo
\ No newline at end of file
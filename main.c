@@ -5,6 +5,8 @@
 
  #include <stdio.h>
  #include "memory_manager.h"
+ #include "memory_arena.h"
+ #include "memory_snapshot.h"
  
  /**
   * @brief Example structure to demonstrate memory tracking
@@ -59,14 +61,43 @@
      }
  }
  
+ /**
+  * @brief Run past the soft cap on tracked blocks and back under it
+  * @note Blocks past the cap are served untracked; once under it again,
+  *       new blocks reusing their memory must be tracked as usual
+  */
+ void demo_block_limit(void) {
+     // The cap counts published records only
+     memory_manager_flush_thread_cache();
+     memory_manager_set_block_limit(get_current_block_count() + 1);
+ 
+     void* tracked = ALLOCATE(128, MEMORY_TYPE_STATIC);
+     memory_manager_flush_thread_cache();
+     void* untracked = ALLOCATE(128, MEMORY_TYPE_STATIC);
+     DEALLOCATE(untracked);
+     DEALLOCATE(tracked);
+     memory_manager_set_block_limit(0);
+ 
+     void* first = ALLOCATE(128, MEMORY_TYPE_STATIC);
+     void* second = ALLOCATE(128, MEMORY_TYPE_STATIC);
+     DEALLOCATE(second);
+     DEALLOCATE(first);
+ }
+ 
  /**
   * @brief Main program demonstrating memory management
-  * @return Exit status
+  * @return Exit status, nonzero if blocks are still live at exit
   */
  int main(void) {
      // Initialize memory manager
      memory_manager_init();
  
+     // Site reports show who called create_example_struct
+     memory_manager_set_trace_depth(8);
+ 
+     // Temporary names live in the arena until this scope is popped
+     MemoryArenaMark scope = memory_arena_push();
+ 
      // Create multiple structures
      ExampleStruct* struct1 = create_example_struct(1);
      ExampleStruct* struct2 = create_example_struct(2);
@@ -79,13 +110,21 @@
  
      // Generate memory report
      generate_memory_report();
+     generate_site_report(0);
+ 
+     // Machine-readable snapshot of the same state
+     fflush(stdout);
+     memory_snapshot_write_fd(MEMORY_SNAPSHOT_JSON, 1);
  
      // Free structures
      free_example_struct(struct1);
      free_example_struct(struct2);
+     memory_arena_pop(scope);
+ 
+     demo_block_limit();
  
      // Final memory report
      generate_memory_report();
  
-     return 0;
+     return get_current_block_count() == 0 ? 0 : 1;
  }
\ No newline at end of file
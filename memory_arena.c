@@ -0,0 +1,278 @@
+/**
+ * @file memory_arena.c
+ * @brief Region Allocator Implementation
+ */
+ 
+ #define _DEFAULT_SOURCE
+ 
+ #include <sys/mman.h>
+ #include "memory_manager.h"
+ #include "memory_arena.h"
+ 
+ #if MEMORY_THREAD_SAFE
+ #define ARENA_LOCK(mutex) pthread_mutex_lock(mutex)
+ #define ARENA_UNLOCK(mutex) pthread_mutex_unlock(mutex)
+ #else
+ #define ARENA_LOCK(mutex) ((void)0)
+ #define ARENA_UNLOCK(mutex) ((void)0)
+ #endif
+ 
+ // Chunk header, padded so the first block is aligned
+ typedef struct MemoryArenaChunk {
+     struct MemoryArenaChunk* next;  // Next chunk in arena order
+ } __attribute__((aligned(MEMORY_ARENA_ALIGNMENT))) MemoryArenaChunk;
+ 
+ // Per-thread arena; chunks past current are kept for reuse after a pop
+ typedef struct MemoryArena {
+     MemoryArenaChunk* first;
+     MemoryArenaChunk* current;
+     uintptr_t top;              // Next free byte in current
+     uintptr_t limit;            // End of current
+     uintptr_t last;             // Newest block, resizable while it ends at top
+     size_t last_size;
+     size_t blocks;              // Read by other threads for statistics
+     size_t bytes;
+     size_t chunk_count;
+     size_t scopes;              // Marks pushed and not yet popped
+     bool registered;
+     struct MemoryArena* previous;
+     struct MemoryArena* next;
+ } MemoryArena;
+ 
+ uintptr_t g_arena_region_begin = 0;
+ uintptr_t g_arena_region_end = 0;
+ 
+ static __thread MemoryArena t_arena;
+ 
+ // Region state: carving pointer, recycled chunks and thread registry
+ static uintptr_t g_region_next = 0;
+ static MemoryArenaChunk* g_free_chunks = NULL;
+ static MemoryArena* g_arena_registry = NULL;
+ #if MEMORY_THREAD_SAFE
+ static pthread_mutex_t g_arena_lock = PTHREAD_MUTEX_INITIALIZER;
+ static pthread_key_t g_arena_key;
+ static pthread_once_t g_arena_key_once = PTHREAD_ONCE_INIT;
+ #endif
+ 
+ // Reserve the whole region up front; pages are committed on first touch
+ static bool region_reserve(void) {
+     void* base = mmap(
+         NULL, MEMORY_ARENA_REGION_SIZE, PROT_READ | PROT_WRITE,
+         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0
+     );
+     if (base == MAP_FAILED) {
+         return false;
+     }
+ 
+     g_region_next = (uintptr_t)base;
+     __atomic_store_n(&g_arena_region_end,
+                      (uintptr_t)base + MEMORY_ARENA_REGION_SIZE, __ATOMIC_RELEASE);
+     __atomic_store_n(&g_arena_region_begin, (uintptr_t)base, __ATOMIC_RELEASE);
+     return true;
+ }
+ 
+ static MemoryArenaChunk* chunk_create(void) {
+     ARENA_LOCK(&g_arena_lock);
+     MemoryArenaChunk* chunk = g_free_chunks;
+     if (chunk) {
+         g_free_chunks = chunk->next;
+     } else if ((g_region_next != 0 || region_reserve()) &&
+                g_region_next < g_arena_region_end) {
+         chunk = (MemoryArenaChunk*)g_region_next;
+         g_region_next += MEMORY_ARENA_CHUNK_SIZE;
+     }
+     ARENA_UNLOCK(&g_arena_lock);
+ 
+     if (chunk) {
+         chunk->next = NULL;
+     }
+     return chunk;
+ }
+ 
+ #if MEMORY_THREAD_SAFE
+ // Thread exit: hand every chunk back to the shared pool
+ static void arena_destroy(void* argument) {
+     MemoryArena* arena = argument;
+ 
+     ARENA_LOCK(&g_arena_lock);
+     MemoryArenaChunk* chunk = arena->first;
+     while (chunk) {
+         MemoryArenaChunk* next = chunk->next;
+         madvise((char*)chunk + 4096, MEMORY_ARENA_CHUNK_SIZE - 4096,
+                 MADV_DONTNEED);
+         chunk->next = g_free_chunks;
+         g_free_chunks = chunk;
+         chunk = next;
+     }
+ 
+     if (arena->previous) {
+         arena->previous->next = arena->next;
+     } else {
+         g_arena_registry = arena->next;
+     }
+     if (arena->next) {
+         arena->next->previous = arena->previous;
+     }
+     ARENA_UNLOCK(&g_arena_lock);
+ 
+     memset(arena, 0, sizeof(MemoryArena));
+ }
+ 
+ static void arena_key_create(void) {
+     pthread_key_create(&g_arena_key, arena_destroy);
+ }
+ #endif
+ 
+ static void arena_register(MemoryArena* arena) {
+ #if MEMORY_THREAD_SAFE
+     pthread_once(&g_arena_key_once, arena_key_create);
+     pthread_setspecific(g_arena_key, arena);
+ #endif
+     ARENA_LOCK(&g_arena_lock);
+     arena->next = g_arena_registry;
+     if (g_arena_registry) {
+         g_arena_registry->previous = arena;
+     }
+     g_arena_registry = arena;
+     arena->registered = true;
+     ARENA_UNLOCK(&g_arena_lock);
+ }
+ 
+ static void arena_enter(MemoryArena* arena, MemoryArenaChunk* chunk) {
+     arena->current = chunk;
+     arena->top = (uintptr_t)(chunk + 1);
+     arena->limit = (uintptr_t)chunk + MEMORY_ARENA_CHUNK_SIZE;
+ }
+ 
+ // Slow path: move to the next retained chunk or carve a new one
+ static bool arena_advance(MemoryArena* arena) {
+     if (arena->current && arena->current->next) {
+         arena_enter(arena, arena->current->next);
+         return true;
+     }
+ 
+     if (!arena->registered) {
+         arena_register(arena);
+     }
+     MemoryArenaChunk* chunk = chunk_create();
+     if (!chunk) {
+         return false;
+     }
+ 
+     if (arena->current) {
+         arena->current->next = chunk;
+     } else {
+         arena->first = chunk;
+     }
+     __atomic_store_n(&arena->chunk_count, arena->chunk_count + 1, __ATOMIC_RELAXED);
+     arena_enter(arena, chunk);
+     return true;
+ }
+ 
+ void* memory_arena_allocate(size_t size) {
+     MemoryArena* arena = &t_arena;
+     uintptr_t start = (arena->top + MEMORY_ARENA_ALIGNMENT - 1) &
+                       ~(uintptr_t)(MEMORY_ARENA_ALIGNMENT - 1);
+ 
+     if (start + size > arena->limit) {
+         if (!arena_advance(arena)) {
+             return NULL;
+         }
+         start = arena->top;
+     }
+ 
+     arena->top = start + size;
+     arena->last = start;
+     arena->last_size = size;
+     __atomic_store_n(&arena->blocks, arena->blocks + 1, __ATOMIC_RELAXED);
+     __atomic_store_n(&arena->bytes, arena->bytes + size, __ATOMIC_RELAXED);
+     return (void*)start;
+ }
+ 
+ bool memory_arena_resize(void* memory, size_t size) {
+     MemoryArena* arena = &t_arena;
+     uintptr_t start = (uintptr_t)memory;
+     if (start != arena->last || start + arena->last_size != arena->top ||
+         size > arena->limit - start) {
+         return false;
+     }
+ 
+     arena->top = start + size;
+     __atomic_store_n(&arena->bytes, arena->bytes + size - arena->last_size,
+                      __ATOMIC_RELAXED);
+     arena->last_size = size;
+     return true;
+ }
+ 
+ // Blocks carry no size; the end of their chunk (or the bump pointer of
+ // the calling thread's chunk) bounds it
+ size_t memory_arena_extent(const void* memory) {
+     MemoryArena* arena = &t_arena;
+     uintptr_t start = (uintptr_t)memory;
+     uintptr_t begin = __atomic_load_n(&g_arena_region_begin, __ATOMIC_ACQUIRE);
+     uintptr_t end = start - (start - begin) % MEMORY_ARENA_CHUNK_SIZE +
+                     MEMORY_ARENA_CHUNK_SIZE;
+     if (start >= (uintptr_t)arena->current && start < arena->limit) {
+         end = arena->top;
+     }
+     return end > start ? end - start : 0;
+ }
+ 
+ MemoryArenaMark memory_arena_push(void) {
+     MemoryArena* arena = &t_arena;
+     MemoryArenaMark mark = {
+         .chunk = arena->current,
+         .top = arena->top,
+         .blocks = arena->blocks,
+         .bytes = arena->bytes,
+         .timestamp = memory_manager_timestamp(),
+         .scopes = arena->scopes
+     };
+     arena->scopes++;
+     return mark;
+ }
+ 
+ void memory_arena_pop(MemoryArenaMark mark) {
+     MemoryArena* arena = &t_arena;
+     if (arena->blocks > mark.blocks) {
+         memory_manager_record_lifetimes(
+             MEMORY_TYPE_TEMPORARY, mark.timestamp, arena->blocks - mark.blocks
+         );
+     }
+     arena->scopes = mark.scopes;
+     if (!mark.chunk) {
+         memory_arena_reset();
+         return;
+     }
+ 
+     arena_enter(arena, mark.chunk);
+     arena->top = mark.top;
+     __atomic_store_n(&arena->blocks, mark.blocks, __ATOMIC_RELAXED);
+     __atomic_store_n(&arena->bytes, mark.bytes, __ATOMIC_RELAXED);
+ }
+ 
+ void memory_arena_reset(void) {
+     MemoryArena* arena = &t_arena;
+     if (arena->first) {
+         arena_enter(arena, arena->first);
+     }
+     __atomic_store_n(&arena->blocks, 0, __ATOMIC_RELAXED);
+     __atomic_store_n(&arena->bytes, 0, __ATOMIC_RELAXED);
+ }
+ 
+ bool memory_arena_in_scope(void) {
+     return t_arena.scopes > 0;
+ }
+ 
+ void memory_arena_get_stats(MemoryArenaStats* stats) {
+     memset(stats, 0, sizeof(MemoryArenaStats));
+ 
+     ARENA_LOCK(&g_arena_lock);
+     for (MemoryArena* arena = g_arena_registry; arena; arena = arena->next) {
+         stats->blocks += __atomic_load_n(&arena->blocks, __ATOMIC_RELAXED);
+         stats->bytes += __atomic_load_n(&arena->bytes, __ATOMIC_RELAXED);
+         stats->reserved_bytes +=
+             __atomic_load_n(&arena->chunk_count, __ATOMIC_RELAXED) * MEMORY_ARENA_CHUNK_SIZE;
+     }
+     ARENA_UNLOCK(&g_arena_lock);
+ }
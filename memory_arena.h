@@ -0,0 +1,116 @@
+/**
+ * @file memory_arena.h
+ * @brief Region Allocator for MEMORY_TYPE_TEMPORARY Blocks
+ *
+ * Each thread owns a bump-pointer arena made of chunks carved from one
+ * reserved address range. Allocation is a pointer increment; memory is
+ * released in bulk by popping to a saved mark or resetting the arena.
+ * MEMORY_TYPE_TEMPORARY blocks come from the arena only while the thread
+ * has a scope open with memory_arena_push; DEALLOCATE on arena memory is
+ * accepted and does nothing.
+ */
+ 
+ #ifndef MEMORY_ARENA_H
+ #define MEMORY_ARENA_H
+ 
+ #include <stdbool.h>
+ #include <stddef.h>
+ #include <stdint.h>
+ 
+ // Arena Configuration
+ #define MEMORY_ARENA_CHUNK_SIZE (1024 * 1024)
+ #define MEMORY_ARENA_REGION_SIZE (16ULL << 30)
+ #define MEMORY_ARENA_ALIGNMENT 16
+ 
+ // Largest request served by the arena; bigger ones use the tracked heap
+ #define MEMORY_ARENA_MAX_BLOCK (MEMORY_ARENA_CHUNK_SIZE / 4)
+ 
+ // Saved arena position, returned by memory_arena_push
+ typedef struct {
+     void* chunk;                // Chunk in use when the mark was taken
+     uintptr_t top;              // Bump pointer within that chunk
+     size_t blocks;              // Arena block count at the mark
+     size_t bytes;               // Arena byte count at the mark
+     uint64_t timestamp;         // Clock reading when the mark was taken
+     size_t scopes;              // Scopes open before the mark
+ } MemoryArenaMark;
+ 
+ // Arena usage summed over all threads
+ typedef struct {
+     size_t blocks;              // Blocks allocated since the last pop/reset
+     size_t bytes;               // Bytes requested by those blocks
+     size_t reserved_bytes;      // Chunk memory held by thread arenas
+ } MemoryArenaStats;
+ 
+ // Reserved arena address range (empty until the first chunk is carved)
+ extern uintptr_t g_arena_region_begin;
+ extern uintptr_t g_arena_region_end;
+ 
+ /**
+  * @brief Check whether a pointer lies inside the arena region
+  * @param memory Pointer to test
+  * @return true for arena memory
+  */
+ static inline bool memory_arena_owns(const void* memory) {
+     uintptr_t begin = __atomic_load_n(&g_arena_region_begin, __ATOMIC_ACQUIRE);
+     uintptr_t end = __atomic_load_n(&g_arena_region_end, __ATOMIC_RELAXED);
+     return (uintptr_t)memory - begin < end - begin;
+ }
+ 
+ /**
+  * @brief Allocate from the calling thread's arena
+  * @param size Requested size, at most MEMORY_ARENA_MAX_BLOCK
+  * @return Pointer to memory, or NULL when no chunk can be obtained
+  */
+ void* memory_arena_allocate(size_t size);
+ 
+ /**
+  * @brief Resize the calling thread's newest arena block in place
+  * @param memory Block from memory_arena_allocate
+  * @param size New size
+  * @return true if the block now holds size bytes, false if it must move
+  */
+ bool memory_arena_resize(void* memory, size_t size);
+ 
+ /**
+  * @brief Get the bytes readable from an arena block
+  * @param memory Block from memory_arena_allocate
+  * @return Bytes from memory to the end of the space used in its chunk
+  * @note Blocks carry no size, so this is not the size of the block: it
+  *       runs over every block allocated after it in the same chunk
+  */
+ size_t memory_arena_extent(const void* memory);
+ 
+ /**
+  * @brief Save the current arena position and open a scope
+  * @return Mark to pass to memory_arena_pop
+  */
+ MemoryArenaMark memory_arena_push(void);
+ 
+ /**
+  * @brief Release every arena block allocated since a mark
+  * @param mark Position saved by memory_arena_push on this thread
+  * @note Closes the mark's scope and every scope opened after it.
+  *       Released blocks enter the MEMORY_TYPE_TEMPORARY lifetime
+  *       histogram with the age of the mark, an upper bound per block
+  */
+ void memory_arena_pop(MemoryArenaMark mark);
+ 
+ /**
+  * @brief Check whether the calling thread has an arena scope open
+  * @return true between memory_arena_push and the matching pop
+  */
+ bool memory_arena_in_scope(void);
+ 
+ /**
+  * @brief Release every block in the calling thread's arena
+  */
+ void memory_arena_reset(void);
+ 
+ /**
+  * @brief Sum arena usage over all threads
+  * @param stats Output statistics
+  */
+ void memory_arena_get_stats(MemoryArenaStats* stats);
+ 
+ #endif // MEMORY_ARENA_H
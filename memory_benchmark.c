@@ -0,0 +1,923 @@
+/**
+ * @file memory_benchmark.c
+ * @brief Microbenchmarks for the Memory Management Utility
+ *
+ * Usage: ./memory_benchmark [benchmark-name]
+ * Runs every benchmark when no name is given.
+ */
+ 
+ #define _POSIX_C_SOURCE 200809L
+ 
+ #include <stdio.h>
+ #include <string.h>
+ #include <time.h>
+ #include <pthread.h>
+ #include "memory_manager.h"
+ #include "memory_arena.h"
+ #include "memory_snapshot.h"
+ #include "memory_diagnostics.h"
+ 
+ #define BENCH_ROUND_SIZE 256
+ #define BENCH_ROUNDS 64
+ 
+ // Filename buffer of the original tracker's block records
+ #define BENCH_OLD_FILENAME_LENGTH 256
+ 
+ static uint64_t bench_now_ns(void) {
+     struct timespec ts;
+     clock_gettime(CLOCK_MONOTONIC, &ts);
+     return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+ }
+ 
+ /**
+  * @brief Measure DEALLOCATE latency with a growing number of live blocks
+  */
+ static void bench_free_latency(void) {
+     static const size_t live_counts[] = {
+         10, 100, 1000, 10000, 100000, 1000000
+     };
+     static void* extra[BENCH_ROUND_SIZE];
+ 
+     printf("\n--- free latency vs live blocks ---\n");
+     printf("%12s %14s\n", "live blocks", "ns/free");
+ 
+     for (size_t c = 0; c < sizeof(live_counts) / sizeof(live_counts[0]); c++) {
+         size_t live = live_counts[c];
+         if (live + BENCH_ROUND_SIZE > MAX_TRACKED_BLOCKS) {
+             printf("%12zu %14s\n", live, "skipped (tracker capacity)");
+             continue;
+         }
+ 
+         memory_manager_init();
+         void** blocks = malloc(live * sizeof(void*));
+         for (size_t i = 0; i < live; i++) {
+             blocks[i] = ALLOCATE(32, MEMORY_TYPE_DYNAMIC);
+         }
+ 
+         uint64_t elapsed = 0;
+         for (int round = 0; round < BENCH_ROUNDS; round++) {
+             for (size_t i = 0; i < BENCH_ROUND_SIZE; i++) {
+                 extra[i] = ALLOCATE(32, MEMORY_TYPE_DYNAMIC);
+             }
+             uint64_t start = bench_now_ns();
+             for (size_t i = 0; i < BENCH_ROUND_SIZE; i++) {
+                 DEALLOCATE(extra[i]);
+             }
+             elapsed += bench_now_ns() - start;
+         }
+ 
+         printf("%12zu %14.1f\n", live,
+                (double)elapsed / (BENCH_ROUNDS * BENCH_ROUND_SIZE));
+ 
+         for (size_t i = 0; i < live; i++) {
+             DEALLOCATE(blocks[i]);
+         }
+         free(blocks);
+     }
+ }
+ 
+ // Block record of the original tracker, which scanned for a NULL pointer
+ typedef struct {
+     void* pointer;
+     size_t size;
+     char filename[BENCH_OLD_FILENAME_LENGTH];
+     int line_number;
+     MemoryAllocationType type;
+     MemoryStatus status;
+     uint64_t timestamp;
+ } BenchOldBlock;
+ 
+ // Reference copy of the original allocation path, kept for comparison:
+ // malloc, linear slot search, then the record with its filename copy
+ static void* bench_old_allocate(
+     BenchOldBlock* blocks,
+     size_t count,
+     size_t size,
+     const char* filename,
+     int line_number,
+     MemoryAllocationType type
+ ) {
+     static uint64_t timestamp = 0;
+     void* memory = malloc(size);
+     if (!memory) {
+         return NULL;
+     }
+ 
+     size_t slot = 0;
+     while (slot < count && blocks[slot].pointer != NULL) {
+         slot++;
+     }
+     if (slot == count) {
+         free(memory);
+         return NULL;
+     }
+ 
+     BenchOldBlock* block = &blocks[slot];
+     block->pointer = memory;
+     block->size = size;
+     block->type = type;
+     block->status = MEMORY_STATUS_ALLOCATED;
+     block->line_number = line_number;
+     block->timestamp = ++timestamp;
+     strncpy(block->filename, filename, BENCH_OLD_FILENAME_LENGTH - 1);
+     block->filename[BENCH_OLD_FILENAME_LENGTH - 1] = '\0';
+     return memory;
+ }
+ 
+ /**
+  * @brief Compare slot acquisition cost: free-slot list vs linear scan
+  */
+ static void bench_slot_acquire(void) {
+     static const size_t live_counts[] = {
+         10, 100, 1000, 10000, 100000, 1000000
+     };
+     static void* extra[BENCH_ROUND_SIZE];
+ 
+     printf("\n--- slot acquire vs live blocks ---\n");
+     printf("%12s %14s %14s\n", "live blocks", "ns/alloc", "ns/alloc (old)");
+ 
+     for (size_t c = 0; c < sizeof(live_counts) / sizeof(live_counts[0]); c++) {
+         size_t live = live_counts[c];
+         if (live + BENCH_ROUND_SIZE > MAX_TRACKED_BLOCKS) {
+             printf("%12zu %14s\n", live, "skipped (tracker capacity)");
+             continue;
+         }
+ 
+         memory_manager_init();
+         void** blocks = malloc(live * sizeof(void*));
+         for (size_t i = 0; i < live; i++) {
+             blocks[i] = ALLOCATE(32, MEMORY_TYPE_DYNAMIC);
+         }
+ 
+         uint64_t elapsed = 0;
+         for (int round = 0; round < BENCH_ROUNDS; round++) {
+             uint64_t start = bench_now_ns();
+             for (size_t i = 0; i < BENCH_ROUND_SIZE; i++) {
+                 extra[i] = ALLOCATE(32, MEMORY_TYPE_DYNAMIC);
+             }
+             elapsed += bench_now_ns() - start;
+             for (size_t i = 0; i < BENCH_ROUND_SIZE; i++) {
+                 DEALLOCATE(extra[i]);
+             }
+         }
+ 
+         // Old behaviour: every allocation scans past the live blocks
+         size_t table_size = live + BENCH_ROUND_SIZE;
+         BenchOldBlock* table = calloc(table_size, sizeof(BenchOldBlock));
+         for (size_t i = 0; i < live; i++) {
+             table[i].pointer = blocks[i];
+         }
+         // Large tables take a noticeable fraction of a second per scan
+         size_t old_allocs = live > 10000 ? 4 : BENCH_ROUND_SIZE;
+         uint64_t start = bench_now_ns();
+         for (size_t i = 0; i < old_allocs; i++) {
+             extra[i] = bench_old_allocate(
+                 table, table_size, 32, __FILE__, __LINE__, MEMORY_TYPE_DYNAMIC
+             );
+         }
+         uint64_t old_elapsed = bench_now_ns() - start;
+         for (size_t i = 0; i < old_allocs; i++) {
+             free(extra[i]);
+         }
+         free(table);
+ 
+         printf("%12zu %14.1f %14.1f\n", live,
+                (double)elapsed / (BENCH_ROUNDS * BENCH_ROUND_SIZE),
+                (double)old_elapsed / old_allocs);
+ 
+         for (size_t i = 0; i < live; i++) {
+             DEALLOCATE(blocks[i]);
+         }
+         free(blocks);
+     }
+ }
+ 
+ /**
+  * @brief Report tracking metadata bytes per live block
+  */
+ static void bench_metadata_overhead(void) {
+     // Record size before call sites were interned (inline filename[256])
+     const size_t legacy_block_size = 304;
+     const size_t live = 1000000;
+ 
+     printf("\n--- metadata overhead per block ---\n");
+     printf("MemoryBlock before interning: %zu bytes\n", legacy_block_size);
+     printf("MemoryBlock now:              %zu bytes\n", sizeof(MemoryBlock));
+ 
+     memory_manager_init();
+     void** blocks = malloc(live * sizeof(void*));
+     uint64_t start = bench_now_ns();
+     for (size_t i = 0; i < live; i++) {
+         blocks[i] = ALLOCATE(32, MEMORY_TYPE_DYNAMIC);
+     }
+     uint64_t elapsed = bench_now_ns() - start;
+     printf("ALLOCATE filling %zu blocks: %.1f ns\n", live, 
+            (double)elapsed / live);
+ 
+     for (size_t i = 0; i < live; i++) {
+         DEALLOCATE(blocks[i]);
+     }
+     free(blocks);
+ }
+ 
+ #define BENCH_THREAD_OPS 200000
+ #define BENCH_THREAD_WINDOW 64
+ 
+ static void* bench_thread_worker(void* arg) {
+     void* window[BENCH_THREAD_WINDOW] = {0};
+     (void)arg;
+ 
+     for (size_t i = 0; i < BENCH_THREAD_OPS; i++) {
+         size_t slot = i % BENCH_THREAD_WINDOW;
+         if (window[slot]) {
+             DEALLOCATE(window[slot]);
+         }
+         window[slot] = ALLOCATE(16 + (i & 255), MEMORY_TYPE_DYNAMIC);
+     }
+     for (size_t i = 0; i < BENCH_THREAD_WINDOW; i++) {
+         DEALLOCATE(window[i]);
+     }
+     return NULL;
+ }
+ 
+ /**
+  * @brief Measure alloc/free pair throughput as threads are added
+  */
+ static void bench_threaded_throughput(void) {
+     static const int thread_counts[] = { 1, 2, 4, 8, 16, 32 };
+     pthread_t threads[32];
+     double single_rate = 0.0;
+ 
+     printf("\n--- multi-threaded alloc/free throughput ---\n");
+     printf("%8s %14s %10s\n", "threads", "Mpairs/s", "speedup");
+ 
+     for (size_t c = 0; c < sizeof(thread_counts) / sizeof(thread_counts[0]); c++) {
+         int count = thread_counts[c];
+         memory_manager_init();
+ 
+         uint64_t start = bench_now_ns();
+         for (int t = 0; t < count; t++) {
+             pthread_create(&threads[t], NULL, bench_thread_worker, NULL);
+         }
+         for (int t = 0; t < count; t++) {
+             pthread_join(threads[t], NULL);
+         }
+         uint64_t elapsed = bench_now_ns() - start;
+ 
+         double rate = (double)count * BENCH_THREAD_OPS * 1000.0 / elapsed;
+         if (c == 0) {
+             single_rate = rate;
+         }
+         printf("%8d %14.2f %9.2fx\n", count, rate, rate / single_rate);
+     }
+ }
+ 
+ /**
+  * @brief Single-thread ALLOCATE/DEALLOCATE pair cost by block size
+  */
+ static void bench_alloc_free_pair(void) {
+     static const size_t sizes[] = { 24, 50, 512, 1024, 4096 };
+     const size_t pairs = 1000000;
+ 
+     printf("\n--- alloc/free pair latency ---\n");
+     printf("%8s %12s\n", "size", "ns/pair");
+     memory_manager_init();
+ 
+     for (size_t c = 0; c < sizeof(sizes) / sizeof(sizes[0]); c++) {
+         uint64_t start = bench_now_ns();
+         for (size_t i = 0; i < pairs; i++) {
+             void* block = ALLOCATE(sizes[c], MEMORY_TYPE_DYNAMIC);
+             DEALLOCATE(block);
+         }
+         uint64_t elapsed = bench_now_ns() - start;
+         printf("%8zu %12.1f\n", sizes[c], (double)elapsed / pairs);
+     }
+ }
+ 
+ /**
+  * @brief Compare slab-backed and malloc-backed MEMORY_TYPE_DYNAMIC blocks
+  */
+ static void bench_slab_backend(void) {
+     static const size_t sizes[] = { 24, 50, 200, 1000 };
+     const size_t live = 100000;
+     const int rounds = 10;
+     void** blocks = malloc(live * sizeof(void*));
+ 
+     printf("\n--- slab vs malloc backend (bulk alloc then free) ---\n");
+     printf("%8s %10s %14s %14s\n", "size", "backend", "ns/alloc", "ns/free");
+ 
+     for (size_t c = 0; c < sizeof(sizes) / sizeof(sizes[0]); c++) {
+         for (int slab = 1; slab >= 0; slab--) {
+             memory_manager_init();
+             memory_manager_set_slab_backend(slab);
+ 
+             uint64_t alloc_elapsed = 0;
+             uint64_t free_elapsed = 0;
+             for (int round = 0; round < rounds; round++) {
+                 uint64_t start = bench_now_ns();
+                 for (size_t i = 0; i < live; i++) {
+                     blocks[i] = ALLOCATE(sizes[c], MEMORY_TYPE_DYNAMIC);
+                 }
+                 alloc_elapsed += bench_now_ns() - start;
+ 
+                 start = bench_now_ns();
+                 for (size_t i = 0; i < live; i++) {
+                     DEALLOCATE(blocks[i]);
+                 }
+                 free_elapsed += bench_now_ns() - start;
+             }
+ 
+             printf("%8zu %10s %14.1f %14.1f\n", sizes[c],
+                    slab ? "slab" : "malloc",
+                    (double)alloc_elapsed / (rounds * live),
+                    (double)free_elapsed / (rounds * live));
+         }
+     }
+ 
+     memory_manager_set_slab_backend(true);
+     free(blocks);
+ }
+ 
+ /**
+  * @brief Temporary arena allocation and scope release against the heap path
+  */
+ static void bench_temporary_arena(void) {
+     static const size_t sizes[] = { 24, 50, 512, 4096 };
+     const size_t live = 100000;
+     const int rounds = 10;
+     void** blocks = malloc(live * sizeof(void*));
+ 
+     printf("\n--- temporary arena vs tracked heap (bulk alloc then release) ---\n");
+     printf("%8s %10s %14s %14s\n", "size", "type", "ns/alloc", "ns/release");
+ 
+     for (size_t c = 0; c < sizeof(sizes) / sizeof(sizes[0]); c++) {
+         memory_manager_init();
+ 
+         // Arena: one pop releases the whole round
+         uint64_t alloc_elapsed = 0;
+         uint64_t release_elapsed = 0;
+         for (int round = 0; round < rounds; round++) {
+             MemoryArenaMark mark = memory_arena_push();
+             uint64_t start = bench_now_ns();
+             for (size_t i = 0; i < live; i++) {
+                 blocks[i] = ALLOCATE(sizes[c], MEMORY_TYPE_TEMPORARY);
+             }
+             alloc_elapsed += bench_now_ns() - start;
+ 
+             start = bench_now_ns();
+             memory_arena_pop(mark);
+             release_elapsed += bench_now_ns() - start;
+         }
+         printf("%8zu %10s %14.1f %14.1f\n", sizes[c], "temporary",
+                (double)alloc_elapsed / (rounds * live),
+                (double)release_elapsed / (rounds * live));
+ 
+         alloc_elapsed = 0;
+         release_elapsed = 0;
+         for (int round = 0; round < rounds; round++) {
+             uint64_t start = bench_now_ns();
+             for (size_t i = 0; i < live; i++) {
+                 blocks[i] = ALLOCATE(sizes[c], MEMORY_TYPE_DYNAMIC);
+             }
+             alloc_elapsed += bench_now_ns() - start;
+ 
+             start = bench_now_ns();
+             for (size_t i = 0; i < live; i++) {
+                 DEALLOCATE(blocks[i]);
+             }
+             release_elapsed += bench_now_ns() - start;
+         }
+         printf("%8zu %10s %14.1f %14.1f\n", sizes[c], "dynamic",
+                (double)alloc_elapsed / (rounds * live),
+                (double)release_elapsed / (rounds * live));
+     }
+ 
+     free(blocks);
+ }
+ 
+ /**
+  * @brief Walk long-lived tables allocated between short-lived churn
+  */
+ static void bench_persistent_heap(void) {
+     const size_t tables = 20000;
+     const size_t table_size = 256;
+     const size_t lookups = 20000000;
+     void** table = malloc(tables * sizeof(void*));
+     void** churn = malloc(tables * sizeof(void*));
+     static const MemoryAllocationType types[] = {
+         MEMORY_TYPE_DYNAMIC, MEMORY_TYPE_PERSISTENT
+     };
+ 
+     printf("\n--- long-lived tables interleaved with churn ---\n");
+     printf("%12s %14s %14s\n", "type", "ns/alloc", "ns/lookup");
+ 
+     for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+         memory_manager_init();
+ 
+         // Short-lived blocks of mixed sizes sit between the tables
+         uint64_t alloc_elapsed = 0;
+         for (size_t i = 0; i < tables; i++) {
+             churn[i] = ALLOCATE(2048 + (i % 7) * 512, MEMORY_TYPE_DYNAMIC);
+             uint64_t start = bench_now_ns();
+             table[i] = ALLOCATE(table_size, types[t]);
+             alloc_elapsed += bench_now_ns() - start;
+             memset(table[i], (int)i, table_size);
+         }
+         for (size_t i = 0; i < tables; i++) {
+             DEALLOCATE(churn[i]);
+         }
+ 
+         uint64_t state = 88172645463325252ULL;
+         uint64_t sum = 0;
+         uint64_t start = bench_now_ns();
+         for (size_t i = 0; i < lookups; i++) {
+             state ^= state << 13;
+             state ^= state >> 7;
+             state ^= state << 17;
+             const unsigned char* bytes = table[state % tables];
+             sum += bytes[(state >> 32) % table_size];
+         }
+         uint64_t lookup_elapsed = bench_now_ns() - start;
+ 
+         printf("%12s %14.1f %14.2f\n",
+                types[t] == MEMORY_TYPE_PERSISTENT ? "persistent" : "dynamic",
+                (double)alloc_elapsed / tables, (double)lookup_elapsed / lookups);
+         if (sum == 0) {
+             printf("(checksum %llu)\n", (unsigned long long)sum);
+         }
+ 
+         for (size_t i = 0; i < tables; i++) {
+             DEALLOCATE(table[i]);
+         }
+     }
+ 
+     free(table);
+     free(churn);
+ }
+ 
+ /**
+  * @brief ALLOCATE/DEALLOCATE against raw malloc/free in bulk rounds
+  *
+  * Built with -DMEMORY_TRACKING_ENABLED=0 (memory_benchmark_release) the
+  * two columns should match; the tracked build shows the tracking cost.
+  */
+ static void bench_release_mode(void) {
+     static const size_t sizes[] = { 24, 256, 4096 };
+     const size_t live = 1000;
+     const int rounds = 2000;
+     void** blocks = malloc(live * sizeof(void*));
+ 
+     printf("\n--- ALLOCATE/DEALLOCATE vs malloc/free (tracking %s) ---\n",
+            MEMORY_TRACKING_ENABLED ? "enabled" : "compiled out");
+     printf("%8s %16s %16s\n", "size", "macro ns/pair", "malloc ns/pair");
+     memory_manager_init();
+ 
+     for (size_t c = 0; c < sizeof(sizes) / sizeof(sizes[0]); c++) {
+         uint64_t start = bench_now_ns();
+         for (int round = 0; round < rounds; round++) {
+             for (size_t i = 0; i < live; i++) {
+                 blocks[i] = ALLOCATE(sizes[c], MEMORY_TYPE_DYNAMIC);
+             }
+             for (size_t i = 0; i < live; i++) {
+                 DEALLOCATE(blocks[i]);
+             }
+         }
+         uint64_t macro_elapsed = bench_now_ns() - start;
+ 
+         start = bench_now_ns();
+         for (int round = 0; round < rounds; round++) {
+             for (size_t i = 0; i < live; i++) {
+                 blocks[i] = malloc(sizes[c]);
+             }
+             for (size_t i = 0; i < live; i++) {
+                 free(blocks[i]);
+             }
+         }
+         uint64_t malloc_elapsed = bench_now_ns() - start;
+ 
+         printf("%8zu %16.1f %16.1f\n", sizes[c],
+                (double)macro_elapsed / (rounds * live),
+                (double)malloc_elapsed / (rounds * live));
+     }
+ 
+     free(blocks);
+ }
+ 
+ /**
+  * @brief Per-site profile and type stats query cost as live blocks grow
+  */
+ static void bench_site_profile(void) {
+     static const size_t live_counts[] = { 1000, 100000, 1000000 };
+     MemorySiteProfile profiles[16];
+     MemoryTypeStats stats;
+ 
+     printf("\n--- site profile and stats query vs live blocks ---\n");
+     printf("%12s %8s %14s %14s\n", "live blocks", "sites", "us/profile",
+            "us/stats");
+ 
+     for (size_t c = 0; c < sizeof(live_counts) / sizeof(live_counts[0]); c++) {
+         size_t live = live_counts[c];
+         memory_manager_init();
+         void** blocks = malloc(live * sizeof(void*));
+         for (size_t i = 0; i < live; i += 4) {
+             blocks[i] = ALLOCATE(24, MEMORY_TYPE_DYNAMIC);
+             blocks[i + 1] = ALLOCATE(200, MEMORY_TYPE_DYNAMIC);
+             blocks[i + 2] = ALLOCATE(2048, MEMORY_TYPE_DYNAMIC);
+             blocks[i + 3] = ALLOCATE(64, MEMORY_TYPE_PERSISTENT);
+         }
+ 
+         const int queries = 100;
+         size_t sites = 0;
+         uint64_t start = bench_now_ns();
+         for (int q = 0; q < queries; q++) {
+             sites = memory_manager_get_site_profiles(profiles, 16);
+         }
+         uint64_t elapsed = bench_now_ns() - start;
+ 
+         start = bench_now_ns();
+         for (int q = 0; q < queries; q++) {
+             memory_manager_get_stats(&stats);
+         }
+         uint64_t stats_elapsed = bench_now_ns() - start;
+         printf("%12zu %8zu %14.1f %14.1f\n", live, sites,
+                (double)elapsed / queries / 1000.0,
+                (double)stats_elapsed / queries / 1000.0);
+ 
+         for (size_t i = 0; i < live; i++) {
+             DEALLOCATE(blocks[i]);
+         }
+         free(blocks);
+     }
+ }
+ 
+ /**
+  * @brief Snapshot export cost per live block in both encodings
+  */
+ static void bench_snapshot_export(void) {
+     static const size_t live_counts[] = { 1000, 100000, 1000000 };
+ 
+     printf("\n--- snapshot export into a buffer ---\n");
+     printf("%12s %8s %14s %14s\n", "live blocks", "format", "bytes", "ns/block");
+ 
+     for (size_t c = 0; c < sizeof(live_counts) / sizeof(live_counts[0]); c++) {
+         size_t live = live_counts[c];
+         memory_manager_init();
+         void** blocks = malloc(live * sizeof(void*));
+         for (size_t i = 0; i < live; i++) {
+             blocks[i] = ALLOCATE(24 + (i & 1) * 2048, MEMORY_TYPE_DYNAMIC);
+         }
+ 
+         for (int format = MEMORY_SNAPSHOT_BINARY; format <= MEMORY_SNAPSHOT_JSON;
+              format++) {
+             size_t needed = memory_snapshot_write(format, NULL, 0);
+             void* buffer = malloc(needed);
+             uint64_t start = bench_now_ns();
+             size_t written = memory_snapshot_write(format, buffer, needed);
+             uint64_t elapsed = bench_now_ns() - start;
+             printf("%12zu %8s %14zu %14.1f\n", live,
+                    format == MEMORY_SNAPSHOT_BINARY ? "binary" : "json",
+                    written, (double)elapsed / live);
+             free(buffer);
+         }
+ 
+         for (size_t i = 0; i < live; i++) {
+             DEALLOCATE(blocks[i]);
+         }
+         free(blocks);
+     }
+ }
+ 
+ #define BENCH_VECTOR_ELEMENTS 1000000
+
+ typedef enum {
+     GROW_REALLOCATE,            // REALLOCATE
+     GROW_COPY,                  // ALLOCATE + memcpy + DEALLOCATE
+     GROW_SYSTEM                 // realloc, untracked
+ } BenchGrowMethod;
+
+ // Append BENCH_VECTOR_ELEMENTS ints, growing capacity by factor/2 (or by
+ // a fixed step when factor is 0); returns ns per append
+ static double bench_vector_fill(BenchGrowMethod method, int factor, size_t step) {
+     int* data = NULL;
+     size_t capacity = 0;
+
+     uint64_t start = bench_now_ns();
+     for (size_t i = 0; i < BENCH_VECTOR_ELEMENTS; i++) {
+         if (i == capacity) {
+             size_t grown = factor ? capacity * factor / 2 : capacity + step;
+             if (grown <= capacity) {
+                 grown = capacity + 16;
+             }
+             size_t bytes = grown * sizeof(int);
+             if (method == GROW_REALLOCATE) {
+                 data = REALLOCATE(data, bytes);
+             } else if (method == GROW_SYSTEM) {
+                 data = realloc(data, bytes);
+             } else {
+                 int* moved = ALLOCATE(bytes, MEMORY_TYPE_DYNAMIC);
+                 if (data) {
+                     memcpy(moved, data, capacity * sizeof(int));
+                     DEALLOCATE(data);
+                 }
+                 data = moved;
+             }
+             capacity = grown;
+         }
+         data[i] = (int)i;
+     }
+     uint64_t elapsed = bench_now_ns() - start;
+
+     if (method == GROW_SYSTEM) {
+         free(data);
+     } else {
+         DEALLOCATE(data);
+     }
+     return (double)elapsed / BENCH_VECTOR_ELEMENTS;
+ }
+
+ /**
+  * @brief Vector-style growth: REALLOCATE vs allocate-copy-free vs realloc
+  */
+ static void bench_vector_growth(void) {
+     static const struct {
+         const char* name;
+         int factor;
+         size_t step;
+     } patterns[] = {
+         { "x2", 4, 0 },
+         { "x1.5", 3, 0 },
+         { "+256", 0, 256 },
+     };
+
+     printf("\n--- vector growth, %d int appends ---\n", BENCH_VECTOR_ELEMENTS);
+     printf("%8s %14s %14s %14s\n", "growth", "REALLOCATE ns", "copy ns",
+            "realloc ns");
+     memory_manager_init();
+
+     for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+         double tracked = bench_vector_fill(GROW_REALLOCATE, patterns[p].factor,
+                                            patterns[p].step);
+         double copied = bench_vector_fill(GROW_COPY, patterns[p].factor,
+                                           patterns[p].step);
+         double system = bench_vector_fill(GROW_SYSTEM, patterns[p].factor,
+                                           patterns[p].step);
+         printf("%8s %14.2f %14.2f %14.2f\n", patterns[p].name, tracked, copied,
+                system);
+     }
+ }
+
+ #define BENCH_DIAG_EVENTS 1000000
+ 
+ static void* diagnostics_worker(void* arg) {
+     (void)arg;
+     for (int i = 0; i < BENCH_DIAG_EVENTS; i++) {
+         DEALLOCATE(NULL);
+     }
+     return NULL;
+ }
+ 
+ /**
+  * @brief Cost of a misbehaving caller: DEALLOCATE(NULL) in a tight loop
+  */
+ static void bench_diagnostics(void) {
+     static const int thread_counts[] = { 1, 4 };
+     MemoryDiagnosticStats before;
+     MemoryDiagnosticStats after;
+ 
+     printf("\n--- NULL-free diagnostics ---\n");
+     printf("%8s %14s %10s\n", "threads", "ns/call", "lines");
+     memory_manager_init();
+ 
+     for (size_t c = 0; c < sizeof(thread_counts) / sizeof(thread_counts[0]); c++) {
+         pthread_t threads[4];
+         int count = thread_counts[c];
+         memory_diagnostics_get_stats(&before);
+ 
+         uint64_t start = bench_now_ns();
+         for (int t = 0; t < count; t++) {
+             pthread_create(&threads[t], NULL, diagnostics_worker, NULL);
+         }
+         for (int t = 0; t < count; t++) {
+             pthread_join(threads[t], NULL);
+         }
+         uint64_t elapsed = bench_now_ns() - start;
+ 
+         memory_diagnostics_flush();
+         memory_diagnostics_get_stats(&after);
+         printf("%8d %14.1f %10llu\n", count,
+                (double)elapsed / BENCH_DIAG_EVENTS,
+                (unsigned long long)(after.printed - before.printed));
+     }
+ 
+     // Baseline: the synchronous unbuffered write each event used to cost
+     FILE* sink = fopen("/dev/null", "w");
+     if (sink) {
+         setvbuf(sink, NULL, _IONBF, 0);
+         uint64_t start = bench_now_ns();
+         for (int i = 0; i < BENCH_DIAG_EVENTS / 10; i++) {
+             fprintf(sink, "WARNING: Freeing NULL pointer at %s:%d\n",
+                     __FILE__, __LINE__);
+         }
+         uint64_t elapsed = bench_now_ns() - start;
+         printf("%8s %14.1f\n", "fprintf", (double)elapsed / (BENCH_DIAG_EVENTS / 10));
+         fclose(sink);
+     }
+ }
+ 
+ #define BENCH_BATCH_OBJECTS (1 << 18)
+ #define BENCH_BATCH_MAX 1024
+ 
+ /**
+  * @brief Per-object alloc+free cost: ALLOCATE/DEALLOCATE loops vs batches
+  */
+ static void bench_batch(void) {
+     static const size_t batch_sizes[] = { 1, 4, 16, 64, 256, 1024 };
+     static const struct {
+         size_t size;
+         MemoryAllocationType type;
+         const char* label;
+     } kinds[] = {
+         { 32, MEMORY_TYPE_DYNAMIC, "32 B dynamic (slab)" },
+         { 32, MEMORY_TYPE_STATIC, "32 B static (thread cache)" },
+         { 4096, MEMORY_TYPE_DYNAMIC, "4 KiB dynamic (heap)" },
+     };
+     static void* objects[BENCH_BATCH_MAX];
+ 
+     printf("\n--- batch alloc+free, ns per object ---\n");
+     for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+         size_t size = kinds[k].size;
+         MemoryAllocationType type = kinds[k].type;
+         printf("%s\n", kinds[k].label);
+         printf("%8s %10s %10s %10s\n", "batch", "loop", "batch", "speedup");
+ 
+         for (size_t b = 0; b < sizeof(batch_sizes) / sizeof(batch_sizes[0]); b++) {
+             size_t batch = batch_sizes[b];
+             size_t rounds = BENCH_BATCH_OBJECTS / batch;
+             memory_manager_init();
+ 
+             uint64_t start = bench_now_ns();
+             for (size_t r = 0; r < rounds; r++) {
+                 for (size_t i = 0; i < batch; i++) {
+                     objects[i] = ALLOCATE(size, type);
+                 }
+                 for (size_t i = 0; i < batch; i++) {
+                     DEALLOCATE(objects[i]);
+                 }
+             }
+             double loop = (double)(bench_now_ns() - start) / BENCH_BATCH_OBJECTS;
+ 
+             start = bench_now_ns();
+             for (size_t r = 0; r < rounds; r++) {
+                 ALLOCATE_BATCH(batch, size, type, objects);
+                 DEALLOCATE_BATCH(objects, batch);
+             }
+             double batched = (double)(bench_now_ns() - start) / BENCH_BATCH_OBJECTS;
+ 
+             printf("%8zu %10.1f %10.1f %9.2fx\n", batch, loop, batched,
+                    loop / batched);
+         }
+     }
+ }
+ 
+ #define BENCH_SYSTEM_OPS 2000000
+ #define BENCH_SYSTEM_WINDOW 256
+ 
+ static void* system_malloc_worker(void* arg) {
+     void* window[BENCH_SYSTEM_WINDOW] = { 0 };
+     unsigned seed = (unsigned)(uintptr_t)arg;
+ 
+     for (size_t i = 0; i < BENCH_SYSTEM_OPS; i++) {
+         size_t slot = i % BENCH_SYSTEM_WINDOW;
+         seed = seed * 1103515245 + 12345;
+         free(window[slot]);
+         window[slot] = malloc(16 + (seed >> 16) % 1008);
+     }
+     for (size_t i = 0; i < BENCH_SYSTEM_WINDOW; i++) {
+         free(window[i]);
+     }
+     return NULL;
+ }
+ 
+ /**
+  * @brief malloc/free pairs through the C library entry points; run again
+  *        under LD_PRELOAD=./libmemory_preload.so to price interposition
+  */
+ static void bench_system_malloc(void) {
+     static const int thread_counts[] = { 1, 4 };
+     pthread_t threads[4];
+ 
+     printf("\n--- malloc/free pairs (%s) ---\n",
+            getenv("LD_PRELOAD") ? getenv("LD_PRELOAD") : "C library");
+     printf("%8s %14s\n", "threads", "ns/pair");
+     for (size_t c = 0; c < sizeof(thread_counts) / sizeof(thread_counts[0]); c++) {
+         int count = thread_counts[c];
+         uint64_t start = bench_now_ns();
+         for (int t = 0; t < count; t++) {
+             pthread_create(&threads[t], NULL, system_malloc_worker,
+                            (void*)(uintptr_t)(t + 1));
+         }
+         for (int t = 0; t < count; t++) {
+             pthread_join(threads[t], NULL);
+         }
+         uint64_t elapsed = bench_now_ns() - start;
+         printf("%8d %14.1f\n", count, (double)elapsed / BENCH_SYSTEM_OPS);
+     }
+ }
+ 
+ #define BENCH_SAMPLE_OPS 2000000
+ #define BENCH_SAMPLE_LIVE 65536
+ 
+ /**
+  * @brief ALLOCATE/DEALLOCATE pairs over a live window at several sampling
+  *        intervals, and the estimated live bytes against the true count
+  */
+ static void bench_sampling(void) {
+     static const size_t intervals[] = { 0, 65536, 524288 };
+     static void* window[BENCH_SAMPLE_LIVE];
+     static size_t sizes[BENCH_SAMPLE_LIVE];
+ 
+     printf("\n--- sampling, ns per alloc+free pair ---\n");
+     printf("%10s %10s %14s %14s %8s\n", "interval", "ns/pair", "live bytes",
+            "estimated", "error");
+     for (size_t k = 0; k < sizeof(intervals) / sizeof(intervals[0]); k++) {
+         memory_manager_init();
+         memory_manager_set_sample_interval(intervals[k]);
+         memset(window, 0, sizeof(window));
+         memset(sizes, 0, sizeof(sizes));
+         unsigned seed = 1;
+         size_t live = 0;
+ 
+         // The first pass fills the window; the timed one replaces it
+         uint64_t start = 0;
+         for (size_t i = 0; i < BENCH_SAMPLE_LIVE + BENCH_SAMPLE_OPS; i++) {
+             size_t slot = i % BENCH_SAMPLE_LIVE;
+             if (i == BENCH_SAMPLE_LIVE) {
+                 start = bench_now_ns();
+             }
+             seed = seed * 1103515245 + 12345;
+             if (window[slot]) {
+                 DEALLOCATE(window[slot]);
+             }
+             sizes[slot] = 16 + (seed >> 16) % 2032;
+             window[slot] = ALLOCATE(sizes[slot], MEMORY_TYPE_DYNAMIC);
+         }
+         double pair = (double)(bench_now_ns() - start) / BENCH_SAMPLE_OPS;
+ 
+         for (size_t i = 0; i < BENCH_SAMPLE_LIVE; i++) {
+             live += sizes[i];
+         }
+         MemoryTypeStats stats;
+         memory_manager_get_type_stats(MEMORY_TYPE_DYNAMIC, &stats);
+         printf("%10zu %10.1f %14zu %14llu %7.2f%%\n", intervals[k], pair, live,
+                (unsigned long long)stats.live_bytes,
+                100.0 * ((double)stats.live_bytes - (double)live) / (double)live);
+ 
+         for (size_t i = 0; i < BENCH_SAMPLE_LIVE; i++) {
+             DEALLOCATE(window[i]);
+         }
+     }
+     memory_manager_set_sample_interval(0);
+ }
+ 
+ typedef struct {
+     const char* name;
+     void (*run)(void);
+ } Benchmark;
+ 
+ static const Benchmark g_benchmarks[] = {
+     { "free_latency", bench_free_latency },
+     { "slot_acquire", bench_slot_acquire },
+     { "metadata_overhead", bench_metadata_overhead },
+     { "threaded_throughput", bench_threaded_throughput },
+     { "alloc_free_pair", bench_alloc_free_pair },
+     { "slab_backend", bench_slab_backend },
+     { "temporary_arena", bench_temporary_arena },
+     { "persistent_heap", bench_persistent_heap },
+     { "release_mode", bench_release_mode },
+     { "site_profile", bench_site_profile },
+     { "snapshot_export", bench_snapshot_export },
+     { "vector_growth", bench_vector_growth },
+     { "diagnostics", bench_diagnostics },
+     { "batch", bench_batch },
+     { "system_malloc", bench_system_malloc },
+     { "sampling", bench_sampling },
+ };
+ 
+ int main(int argc, char** argv) {
+     const char* selected = argc > 1 ? argv[1] : NULL;
+     size_t count = sizeof(g_benchmarks) / sizeof(g_benchmarks[0]);
+     bool matched = false;
+ 
+     for (size_t i = 0; i < count; i++) {
+         if (!selected || strcmp(selected, g_benchmarks[i].name) == 0) {
+             g_benchmarks[i].run();
+             matched = true;
+         }
+     }
+ 
+     if (!matched) {
+         fprintf(stderr, "Unknown benchmark: %s\n", selected);
+         return EXIT_FAILURE;
+     }
+     return EXIT_SUCCESS;
+ }
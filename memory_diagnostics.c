@@ -0,0 +1,294 @@
+/**
+ * @file memory_diagnostics.c
+ * @brief Deferred Diagnostics Implementation
+ */
+ 
+ #define _DEFAULT_SOURCE
+ 
+ #include <pthread.h>
+ #include <stdio.h>
+ #include <stdlib.h>
+ #include <time.h>
+ #include "memory_diagnostics.h"
+ 
+ #define DIAG_RING_MASK ((uint64_t)MEMORY_DIAG_RING_SIZE - 1)
+ #define DIAG_SITE_MASK ((uint32_t)MEMORY_DIAG_SITES - 1)
+ 
+ // Site slot states
+ #define DIAG_SITE_EMPTY 0
+ #define DIAG_SITE_CLAIMED 1
+ #define DIAG_SITE_READY 2
+ 
+ // One (kind, file, line) triple; pending counts events not yet printed
+ typedef struct {
+     uint32_t state;
+     MemoryDiagnosticKind kind;
+     const char* filename;
+     int line_number;
+     uint64_t pending;
+ } DiagnosticSite;
+ 
+ // Ring cell: sequence encodes whose turn it is (zero-initialised ready)
+ typedef struct {
+     uint64_t sequence;
+     uint32_t site;
+ } DiagnosticCell;
+ 
+ static DiagnosticSite g_diag_sites[MEMORY_DIAG_SITES];
+ static DiagnosticCell g_diag_ring[MEMORY_DIAG_RING_SIZE];
+ static uint64_t g_diag_ring_tail;
+ static uint64_t g_diag_ring_head;       // Guarded by g_diag_drain_lock
+ static bool g_diag_overflow;            // A site could not be queued
+ static MemoryDiagnosticStats g_diag_stats;
+ 
+ static pthread_mutex_t g_diag_drain_lock = PTHREAD_MUTEX_INITIALIZER;
+ static pthread_once_t g_diag_exit_once = PTHREAD_ONCE_INIT;
+ 
+ // Background drain thread
+ static pthread_mutex_t g_diag_thread_lock = PTHREAD_MUTEX_INITIALIZER;
+ static pthread_cond_t g_diag_thread_wake = PTHREAD_COND_INITIALIZER;
+ static pthread_t g_diag_thread;
+ static bool g_diag_thread_running;
+ static bool g_diag_thread_stop;
+ static unsigned g_diag_interval_ms;
+ 
+ static const struct {
+     const char* severity;
+     const char* message;
+ } g_diag_text[MEMORY_DIAG_KIND_COUNT] = {
+     [MEMORY_DIAG_ZERO_BYTE] = { "WARNING", "Zero-byte allocation" },
+     [MEMORY_DIAG_NULL_FREE] = { "WARNING", "Freeing NULL pointer" },
+     [MEMORY_DIAG_UNTRACKED_FREE] = { "WARNING", "Untracked memory free" },
+     [MEMORY_DIAG_TRACKER_FULL] = { "WARNING", "Memory tracker full, block left untracked" },
+     [MEMORY_DIAG_SITE_TABLE_FULL] = { "ERROR", "Call-site table full" },
+     [MEMORY_DIAG_ALLOCATION_FAILED] = { "CRITICAL", "Allocation failed" },
+     [MEMORY_DIAG_TRACKER_GROWTH] = { "ERROR", "Tracker growth failed" },
+     [MEMORY_DIAG_UNTRACKED_REALLOC] = { "WARNING", "Untracked memory reallocation" },
+     [MEMORY_DIAG_BAD_ALIGNMENT] = { "ERROR", "Alignment is not a power of two" },
+     [MEMORY_DIAG_SIZE_OVERFLOW] = { "ERROR", "Array size overflows size_t" },
+     [MEMORY_DIAG_CORRUPTED] = { "ERROR", "Canary overwritten on a block allocated" },
+ };
+ 
+ static void flush_at_exit(void) {
+     memory_diagnostics_flush();
+ }
+ 
+ static void register_exit_flush(void) {
+     atexit(flush_at_exit);
+ }
+ 
+ static uint32_t hash_site(
+     MemoryDiagnosticKind kind,
+     const char* filename,
+     int line_number
+ ) {
+     uint64_t key = (uint64_t)(uintptr_t)filename ^
+                    ((uint64_t)(uint32_t)line_number << 8) ^ (uint64_t)kind;
+     key *= 0x9E3779B97F4A7C15ULL;
+     return (uint32_t)(key >> 32);
+ }
+ 
+ // Find or claim the slot for a site; MEMORY_DIAG_SITES when full
+ static uint32_t find_site(
+     MemoryDiagnosticKind kind,
+     const char* filename,
+     int line_number
+ ) {
+     uint32_t start = hash_site(kind, filename, line_number);
+     for (uint32_t probe = 0; probe < MEMORY_DIAG_SITES; probe++) {
+         uint32_t index = (start + probe) & DIAG_SITE_MASK;
+         DiagnosticSite* site = &g_diag_sites[index];
+         uint32_t state = __atomic_load_n(&site->state, __ATOMIC_ACQUIRE);
+ 
+         if (state == DIAG_SITE_EMPTY) {
+             if (__atomic_compare_exchange_n(&site->state, &state,
+                                             DIAG_SITE_CLAIMED, false,
+                                             __ATOMIC_ACQUIRE,
+                                             __ATOMIC_ACQUIRE)) {
+                 site->kind = kind;
+                 site->filename = filename;
+                 site->line_number = line_number;
+                 __atomic_store_n(&site->state, DIAG_SITE_READY, __ATOMIC_RELEASE);
+                 pthread_once(&g_diag_exit_once, register_exit_flush);
+                 return index;
+             }
+         }
+         // Another thread is filling this slot in; it takes a few stores
+         while (state == DIAG_SITE_CLAIMED) {
+             state = __atomic_load_n(&site->state, __ATOMIC_ACQUIRE);
+         }
+         if (site->kind == kind && site->filename == filename &&
+             site->line_number == line_number) {
+             return index;
+         }
+     }
+     return MEMORY_DIAG_SITES;
+ }
+ 
+ // Multi-producer ring push; false when the ring is full
+ static bool ring_push(uint32_t site) {
+     uint64_t position = __atomic_load_n(&g_diag_ring_tail, __ATOMIC_RELAXED);
+     DiagnosticCell* cell;
+     for (;;) {
+         cell = &g_diag_ring[position & DIAG_RING_MASK];
+         uint64_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+         int64_t lag = (int64_t)(sequence - (position & ~DIAG_RING_MASK));
+         if (lag == 0) {
+             if (__atomic_compare_exchange_n(&g_diag_ring_tail, &position,
+                                             position + 1, true,
+                                             __ATOMIC_RELAXED,
+                                             __ATOMIC_RELAXED)) {
+                 break;
+             }
+         } else if (lag < 0) {
+             return false;
+         } else {
+             position = __atomic_load_n(&g_diag_ring_tail, __ATOMIC_RELAXED);
+         }
+     }
+     cell->site = site;
+     __atomic_store_n(&cell->sequence, (position & ~DIAG_RING_MASK) + 1,
+                      __ATOMIC_RELEASE);
+     return true;
+ }
+ 
+ // Single-consumer pop under g_diag_drain_lock; false when empty
+ static bool ring_pop(uint32_t* site) {
+     uint64_t position = g_diag_ring_head;
+     DiagnosticCell* cell = &g_diag_ring[position & DIAG_RING_MASK];
+     uint64_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+     if (sequence != (position & ~DIAG_RING_MASK) + 1) {
+         return false;
+     }
+     *site = cell->site;
+     __atomic_store_n(&cell->sequence,
+                      (position & ~DIAG_RING_MASK) + MEMORY_DIAG_RING_SIZE,
+                      __ATOMIC_RELEASE);
+     g_diag_ring_head = position + 1;
+     return true;
+ }
+ 
+ void memory_diagnostic(
+     MemoryDiagnosticKind kind,
+     const char* filename,
+     int line_number
+ ) {
+     __atomic_add_fetch(&g_diag_stats.reported, 1, __ATOMIC_RELAXED);
+ 
+     uint32_t index = find_site(kind, filename, line_number);
+     if (index == MEMORY_DIAG_SITES) {
+         __atomic_add_fetch(&g_diag_stats.dropped, 1, __ATOMIC_RELAXED);
+         return;
+     }
+ 
+     // Only the first event since the last drain queues the site
+     if (__atomic_fetch_add(&g_diag_sites[index].pending, 1, __ATOMIC_RELAXED) == 0 &&
+         !ring_push(index)) {
+         __atomic_store_n(&g_diag_overflow, true, __ATOMIC_RELEASE);
+     }
+ }
+ 
+ // Print one site's pending events; the exchange makes each print once
+ static size_t print_site(uint32_t index) {
+     DiagnosticSite* site = &g_diag_sites[index];
+     uint64_t events = __atomic_exchange_n(&site->pending, 0, __ATOMIC_ACQUIRE);
+     if (events == 0) {
+         return 0;
+     }
+ 
+     fprintf(stderr, "%s: %s at ", g_diag_text[site->kind].severity,
+             g_diag_text[site->kind].message);
+     if (site->line_number == 0) {
+         // Interposed call: the "filename" is the caller's return address
+         fprintf(stderr, "caller %p", (const void*)site->filename);
+     } else {
+         fprintf(stderr, "%s:%d", site->filename ? site->filename : "unknown",
+                 site->line_number);
+     }
+     if (events > 1) {
+         fprintf(stderr, " (%llu times)", (unsigned long long)events);
+     }
+     fputc('\n', stderr);
+ 
+     __atomic_add_fetch(&g_diag_stats.printed, 1, __ATOMIC_RELAXED);
+     __atomic_add_fetch(&g_diag_stats.suppressed, events - 1, __ATOMIC_RELAXED);
+     return 1;
+ }
+ 
+ size_t memory_diagnostics_flush(void) {
+     size_t lines = 0;
+     uint32_t index;
+ 
+     pthread_mutex_lock(&g_diag_drain_lock);
+     while (ring_pop(&index)) {
+         lines += print_site(index);
+     }
+ 
+     // Sites that missed a full ring are found by sweeping the table
+     if (__atomic_exchange_n(&g_diag_overflow, false, __ATOMIC_ACQUIRE)) {
+         for (index = 0; index < MEMORY_DIAG_SITES; index++) {
+             if (__atomic_load_n(&g_diag_sites[index].state, __ATOMIC_ACQUIRE) ==
+                 DIAG_SITE_READY) {
+                 lines += print_site(index);
+             }
+         }
+     }
+     pthread_mutex_unlock(&g_diag_drain_lock);
+     return lines;
+ }
+ 
+ static void* drain_thread(void* argument) {
+     (void)argument;
+     pthread_mutex_lock(&g_diag_thread_lock);
+     while (!g_diag_thread_stop) {
+         struct timespec deadline;
+         clock_gettime(CLOCK_REALTIME, &deadline);
+         deadline.tv_sec += g_diag_interval_ms / 1000;
+         deadline.tv_nsec += (long)(g_diag_interval_ms % 1000) * 1000000L;
+         if (deadline.tv_nsec >= 1000000000L) {
+             deadline.tv_sec++;
+             deadline.tv_nsec -= 1000000000L;
+         }
+         pthread_cond_timedwait(&g_diag_thread_wake, &g_diag_thread_lock, &deadline);
+ 
+         pthread_mutex_unlock(&g_diag_thread_lock);
+         memory_diagnostics_flush();
+         pthread_mutex_lock(&g_diag_thread_lock);
+     }
+     pthread_mutex_unlock(&g_diag_thread_lock);
+     return NULL;
+ }
+ 
+ bool memory_diagnostics_start(unsigned interval_ms) {
+     pthread_mutex_lock(&g_diag_thread_lock);
+     if (!g_diag_thread_running) {
+         g_diag_interval_ms = interval_ms ? interval_ms : MEMORY_DIAG_DEFAULT_INTERVAL_MS;
+         g_diag_thread_stop = false;
+         g_diag_thread_running =
+             pthread_create(&g_diag_thread, NULL, drain_thread, NULL) == 0;
+     }
+     bool running = g_diag_thread_running;
+     pthread_mutex_unlock(&g_diag_thread_lock);
+     return running;
+ }
+ 
+ void memory_diagnostics_stop(void) {
+     pthread_mutex_lock(&g_diag_thread_lock);
+     bool running = g_diag_thread_running;
+     g_diag_thread_stop = true;
+     g_diag_thread_running = false;
+     pthread_cond_signal(&g_diag_thread_wake);
+     pthread_mutex_unlock(&g_diag_thread_lock);
+ 
+     if (running) {
+         pthread_join(g_diag_thread, NULL);
+     }
+     memory_diagnostics_flush();
+ }
+ 
+ void memory_diagnostics_get_stats(MemoryDiagnosticStats* stats) {
+     stats->reported = __atomic_load_n(&g_diag_stats.reported, __ATOMIC_RELAXED);
+     stats->printed = __atomic_load_n(&g_diag_stats.printed, __ATOMIC_RELAXED);
+     stats->suppressed = __atomic_load_n(&g_diag_stats.suppressed, __ATOMIC_RELAXED);
+     stats->dropped = __atomic_load_n(&g_diag_stats.dropped, __ATOMIC_RELAXED);
+ }
@@ -0,0 +1,88 @@
+/**
+ * @file memory_diagnostics.h
+ * @brief Deferred, Rate-Limited Allocator Diagnostics
+ *
+ * The allocate and free paths never write to stderr themselves. A
+ * diagnostic bumps a counter in a per-call-site slot and, when that slot
+ * had nothing pending, queues the slot on a lock-free ring. Draining
+ * (memory_diagnostics_flush, the optional background thread, or exit)
+ * prints one line per site with the number of events folded into it, so
+ * a caller that frees NULL in a loop costs an atomic add per call and one
+ * line per drain.
+ */
+ 
+ #ifndef MEMORY_DIAGNOSTICS_H
+ #define MEMORY_DIAGNOSTICS_H
+ 
+ #include <stdbool.h>
+ #include <stddef.h>
+ #include <stdint.h>
+ 
+ // Diagnostics Configuration (both sizes must be powers of two)
+ #define MEMORY_DIAG_RING_SIZE 256
+ #define MEMORY_DIAG_SITES 1024
+ 
+ // Drain period of the background thread when 0 is passed to start
+ #define MEMORY_DIAG_DEFAULT_INTERVAL_MS 100
+ 
+ // Conditions reported by the allocator
+ typedef enum {
+     MEMORY_DIAG_ZERO_BYTE,
+     MEMORY_DIAG_NULL_FREE,
+     MEMORY_DIAG_UNTRACKED_FREE,
+     MEMORY_DIAG_TRACKER_FULL,
+     MEMORY_DIAG_SITE_TABLE_FULL,
+     MEMORY_DIAG_ALLOCATION_FAILED,
+     MEMORY_DIAG_TRACKER_GROWTH,
+     MEMORY_DIAG_UNTRACKED_REALLOC,
+     MEMORY_DIAG_BAD_ALIGNMENT,
+     MEMORY_DIAG_SIZE_OVERFLOW,
+     MEMORY_DIAG_CORRUPTED,
+     MEMORY_DIAG_KIND_COUNT
+ } MemoryDiagnosticKind;
+ 
+ // Diagnostic counters since startup
+ typedef struct {
+     uint64_t reported;          // Events raised
+     uint64_t printed;           // Lines written
+     uint64_t suppressed;        // Events folded into another event's line
+     uint64_t dropped;           // Events lost because the site table was full
+ } MemoryDiagnosticStats;
+ 
+ /**
+  * @brief Record a diagnostic without blocking or doing I/O
+  * @param kind Condition being reported
+  * @param filename Source file of the caller (compared by address)
+  * @param line_number Line number of the caller
+  */
+ void memory_diagnostic(
+     MemoryDiagnosticKind kind,
+     const char* filename,
+     int line_number
+ );
+ 
+ /**
+  * @brief Print pending diagnostics to stderr
+  * @return Number of lines printed
+  */
+ size_t memory_diagnostics_flush(void);
+ 
+ /**
+  * @brief Start a background thread that flushes periodically
+  * @param interval_ms Drain period (0 for the default)
+  * @return true if the thread is running
+  */
+ bool memory_diagnostics_start(unsigned interval_ms);
+ 
+ /**
+  * @brief Stop the background thread and flush what is left
+  */
+ void memory_diagnostics_stop(void);
+ 
+ /**
+  * @brief Read the diagnostic counters
+  * @param stats Receives the counters
+  */
+ void memory_diagnostics_get_stats(MemoryDiagnosticStats* stats);
+ 
+ #endif // MEMORY_DIAGNOSTICS_H
@@ -0,0 +1,284 @@
+/**
+ * @file memory_guard.c
+ * @brief Guard-Page Heap Implementation
+ */
+ 
+ #define _DEFAULT_SOURCE
+ 
+ #include <string.h>
+ #include <sys/mman.h>
+ #include <unistd.h>
+ #include "memory_manager.h"
+ #include "memory_guard.h"
+ 
+ #if MEMORY_THREAD_SAFE
+ #define GUARD_LOCK(mutex) pthread_mutex_lock(mutex)
+ #define GUARD_UNLOCK(mutex) pthread_mutex_unlock(mutex)
+ #else
+ #define GUARD_LOCK(mutex) ((void)0)
+ #define GUARD_UNLOCK(mutex) ((void)0)
+ #endif
+ 
+ // Byte written between a block and its page boundaries
+ #define GUARD_FILL 0xa5
+ 
+ // Slot of data pages followed by its guard page, found by its first
+ // page. Free and quarantined slots are linked by first page + 1.
+ typedef struct {
+     uint64_t size;              // Block size while allocated
+     uint32_t pages;             // Data pages
+     uint32_t next;              // Next slot in a free list or the quarantine
+ } GuardSlot;
+ 
+ uintptr_t g_guard_region_begin = 0;
+ uintptr_t g_guard_region_end = 0;
+ 
+ // Heap state; guarded traffic is opt-in, so one lock covers it all
+ static size_t g_page_size = 0;
+ static GuardSlot* g_slots = NULL;      // One entry per page of the range
+ static uintptr_t g_guard_next = 0;     // Bump pointer
+ static uint32_t g_free[MEMORY_GUARD_FREE_LISTS + 1];  // Last list: larger slots
+ static uint32_t g_quarantine_head = 0; // Oldest freed slot
+ static uint32_t g_quarantine_tail = 0;
+ static size_t g_quarantine_limit = MEMORY_GUARD_DEFAULT_QUARANTINE;
+ static size_t g_quarantined_blocks = 0;
+ static size_t g_quarantined_bytes = 0;
+ static size_t g_live_blocks = 0;
+ static size_t g_live_bytes = 0;
+ static size_t g_live_pages = 0;
+ static size_t g_fallbacks = 0;
+ #if MEMORY_THREAD_SAFE
+ static pthread_mutex_t g_guard_lock = PTHREAD_MUTEX_INITIALIZER;
+ #endif
+ 
+ // Reserve the range inaccessible, with a page table beside it. The first
+ // page stays a guard page, so every slot has one in front as well.
+ static bool region_reserve(void) {
+     size_t page = (size_t)sysconf(_SC_PAGESIZE);
+     size_t table = MEMORY_GUARD_REGION_SIZE / page * sizeof(GuardSlot);
+     void* slots = mmap(
+         NULL, table, PROT_READ | PROT_WRITE,
+         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0
+     );
+     if (slots == MAP_FAILED) {
+         return false;
+     }
+     void* base = mmap(
+         NULL, MEMORY_GUARD_REGION_SIZE, PROT_NONE,
+         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0
+     );
+     if (base == MAP_FAILED) {
+         munmap(slots, table);
+         return false;
+     }
+ 
+     g_page_size = page;
+     g_slots = slots;
+     g_guard_next = (uintptr_t)base + page;
+     __atomic_store_n(&g_guard_region_end, (uintptr_t)base + MEMORY_GUARD_REGION_SIZE,
+                      __ATOMIC_RELEASE);
+     __atomic_store_n(&g_guard_region_begin, (uintptr_t)base, __ATOMIC_RELEASE);
+     return true;
+ }
+ 
+ static uint32_t slot_index(uintptr_t start) {
+     return (uint32_t)((start - g_guard_region_begin) / g_page_size);
+ }
+ 
+ static uintptr_t slot_start(uint32_t index) {
+     return g_guard_region_begin + (uintptr_t)index * g_page_size;
+ }
+ 
+ // Slot holding a block, which always starts in the slot's first page
+ static GuardSlot* slot_of(const void* memory) {
+     return &g_slots[slot_index((uintptr_t)memory & ~(uintptr_t)(g_page_size - 1))];
+ }
+ 
+ static void slot_put(uint32_t index, uint32_t pages) {
+     uint32_t* list = &g_free[pages > MEMORY_GUARD_FREE_LISTS ?
+                              MEMORY_GUARD_FREE_LISTS : pages - 1];
+     g_slots[index].pages = pages;
+     g_slots[index].next = *list;
+     *list = index + 1;
+ }
+ 
+ // Exact list first, then first fit among the larger slots. A larger
+ // slot keeps its guard page for the block at its end; the page before
+ // the block guards what is left in front, which becomes a slot of its own.
+ static uint32_t slot_take(uint32_t pages) {
+     if (pages <= MEMORY_GUARD_FREE_LISTS && g_free[pages - 1]) {
+         uint32_t index = g_free[pages - 1] - 1;
+         g_free[pages - 1] = g_slots[index].next;
+         return index + 1;
+     }
+ 
+     uint32_t* link = &g_free[MEMORY_GUARD_FREE_LISTS];
+     for (; *link; link = &g_slots[*link - 1].next) {
+         uint32_t index = *link - 1;
+         if (g_slots[index].pages < pages) {
+             continue;
+         }
+         uint32_t spare = g_slots[index].pages - pages;
+         *link = g_slots[index].next;
+         if (spare > 1) {
+             slot_put(index, spare - 1);
+         }
+         return index + spare + 1;
+     }
+     return 0;
+ }
+ 
+ // Recycle the oldest quarantined slots beyond the limit; the guard lock
+ // must be held
+ static void quarantine_trim(void) {
+     while (g_quarantined_bytes > g_quarantine_limit) {
+         uint32_t index = g_quarantine_head - 1;
+         GuardSlot* slot = &g_slots[index];
+         g_quarantine_head = slot->next;
+         if (g_quarantine_head == 0) {
+             g_quarantine_tail = 0;
+         }
+         g_quarantined_blocks--;
+         g_quarantined_bytes -= (size_t)slot->pages * g_page_size;
+         slot_put(index, slot->pages);
+     }
+ }
+ 
+ static bool fill_intact(const unsigned char* from, const unsigned char* to) {
+     uint64_t pattern = 0x0101010101010101ULL * GUARD_FILL;
+     for (; from < to && ((uintptr_t)from & 7) != 0; from++) {
+         if (*from != GUARD_FILL) {
+             return false;
+         }
+     }
+     for (; to - from >= 8; from += 8) {
+         uint64_t word;
+         memcpy(&word, from, sizeof(word));
+         if (word != pattern) {
+             return false;
+         }
+     }
+     for (; from < to; from++) {
+         if (*from != GUARD_FILL) {
+             return false;
+         }
+     }
+     return true;
+ }
+ 
+ void* memory_guard_allocate(size_t size, size_t alignment) {
+     uintptr_t start = 0;
+     uint32_t pages = 0;
+ 
+     GUARD_LOCK(&g_guard_lock);
+     if ((g_guard_next != 0 || region_reserve()) && alignment <= g_page_size &&
+         size <= MEMORY_GUARD_REGION_SIZE / 2) {
+         pages = size ? (uint32_t)((size + g_page_size - 1) / g_page_size) : 1;
+         uint32_t index = slot_take(pages);
+         if (index != 0) {
+             start = slot_start(index - 1);
+         } else if ((pages + 1) * g_page_size <= g_guard_region_end - g_guard_next) {
+             start = g_guard_next;
+             g_guard_next += (pages + 1) * g_page_size;
+         }
+     }
+     if (start == 0) {
+         g_fallbacks++;
+         GUARD_UNLOCK(&g_guard_lock);
+         return NULL;
+     }
+     GuardSlot* slot = &g_slots[slot_index(start)];
+     slot->size = size;
+     slot->pages = pages;
+     g_live_blocks++;
+     g_live_bytes += size;
+     g_live_pages += pages + 1;
+     GUARD_UNLOCK(&g_guard_lock);
+ 
+     // Each slot is a mapping of its own, which the system may refuse
+     size_t bytes = (size_t)pages * g_page_size;
+     if (mprotect((void*)start, bytes, PROT_READ | PROT_WRITE) != 0) {
+         GUARD_LOCK(&g_guard_lock);
+         slot_put(slot_index(start), pages);
+         g_live_blocks--;
+         g_live_bytes -= size;
+         g_live_pages -= pages + 1;
+         g_fallbacks++;
+         GUARD_UNLOCK(&g_guard_lock);
+         return NULL;
+     }
+ 
+     size_t offset = (bytes - size) & ~(alignment - 1);
+     memset((void*)start, GUARD_FILL, offset);
+     memset((char*)start + offset + size, GUARD_FILL, bytes - offset - size);
+     return (char*)start + offset;
+ }
+ 
+ // The pages are dropped right away, so quarantine costs address space
+ // and no memory
+ void memory_guard_release(void* memory) {
+     uintptr_t start = (uintptr_t)memory & ~(uintptr_t)(g_page_size - 1);
+     GuardSlot* slot = slot_of(memory);
+     size_t bytes = (size_t)slot->pages * g_page_size;
+     mprotect((void*)start, bytes, PROT_NONE);
+     madvise((void*)start, bytes, MADV_DONTNEED);
+ 
+     GUARD_LOCK(&g_guard_lock);
+     uint32_t index = slot_index(start);
+     g_live_blocks--;
+     g_live_bytes -= slot->size;
+     g_live_pages -= slot->pages + 1;
+     slot->next = 0;
+     if (g_quarantine_tail != 0) {
+         g_slots[g_quarantine_tail - 1].next = index + 1;
+     } else {
+         g_quarantine_head = index + 1;
+     }
+     g_quarantine_tail = index + 1;
+     g_quarantined_blocks++;
+     g_quarantined_bytes += bytes;
+     quarantine_trim();
+     GUARD_UNLOCK(&g_guard_lock);
+ }
+ 
+ bool memory_guard_intact(const void* memory) {
+     const GuardSlot* slot = slot_of(memory);
+     const unsigned char* start =
+         (const unsigned char*)((uintptr_t)memory & ~(uintptr_t)(g_page_size - 1));
+     const unsigned char* block = memory;
+     return fill_intact(start, block) &&
+            fill_intact(block + slot->size, start + (size_t)slot->pages * g_page_size);
+ }
+ 
+ size_t memory_guard_usable_size(const void* memory) {
+     return slot_of(memory)->size;
+ }
+ 
+ void memory_guard_set_quarantine(size_t bytes) {
+     GUARD_LOCK(&g_guard_lock);
+     g_quarantine_limit = bytes;
+     quarantine_trim();
+     GUARD_UNLOCK(&g_guard_lock);
+ }
+ 
+ void memory_guard_get_stats(MemoryGuardStats* stats) {
+     GUARD_LOCK(&g_guard_lock);
+     stats->blocks = g_live_blocks;
+     stats->bytes = g_live_bytes;
+     stats->pages = g_live_pages;
+     stats->quarantined_blocks = g_quarantined_blocks;
+     stats->quarantined_bytes = g_quarantined_bytes;
+     stats->fallbacks = g_fallbacks;
+     GUARD_UNLOCK(&g_guard_lock);
+ }
+ 
+ void memory_guard_forget_all(void) {
+     GUARD_LOCK(&g_guard_lock);
+     g_live_blocks = 0;
+     g_live_bytes = 0;
+     g_live_pages = 0;
+     g_fallbacks = 0;
+     g_quarantine_limit = MEMORY_GUARD_DEFAULT_QUARANTINE;
+     quarantine_trim();
+     GUARD_UNLOCK(&g_guard_lock);
+ }
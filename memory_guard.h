@@ -0,0 +1,107 @@
+/**
+ * @file memory_guard.h
+ * @brief Guard-Page Heap for Overrun and Use-After-Free Detection
+ *
+ * Each guarded block gets pages of its own in a reserved address range,
+ * placed so that it ends against an inaccessible (PROT_NONE) page: a read
+ * or write past the end faults on the spot, as does one more than a page
+ * before the start. The bytes between the block and its page boundaries,
+ * under one alignment unit behind it and under a page in front, are
+ * filled with a pattern checked on release. Freed blocks are made
+ * inaccessible and their pages dropped, then wait in a quarantine of
+ * bounded size before the pages are recycled, so a stale pointer faults
+ * as well while its block is quarantined.
+ */
+ 
+ #ifndef MEMORY_GUARD_H
+ #define MEMORY_GUARD_H
+ 
+ #include <stdbool.h>
+ #include <stddef.h>
+ #include <stdint.h>
+ 
+ // Guard Heap Configuration
+ #define MEMORY_GUARD_REGION_SIZE (16ULL << 30)
+ #define MEMORY_GUARD_FREE_LISTS 64
+ 
+ // Freed pages kept inaccessible before reuse, by default
+ #define MEMORY_GUARD_DEFAULT_QUARANTINE (64 * 1024 * 1024)
+ 
+ // Guard heap usage
+ typedef struct {
+     size_t blocks;              // Live guarded blocks
+     size_t bytes;               // Bytes requested by those blocks
+     size_t pages;               // Pages they take, guard pages included
+     size_t quarantined_blocks;  // Freed blocks not yet recycled
+     size_t quarantined_bytes;   // Pages those blocks hold, in bytes
+     size_t fallbacks;           // Requests left to the normal heap
+ } MemoryGuardStats;
+ 
+ // Reserved guard address range (empty until the first allocation)
+ extern uintptr_t g_guard_region_begin;
+ extern uintptr_t g_guard_region_end;
+ 
+ /**
+  * @brief Check whether a pointer lies inside the guard heap
+  * @param memory Pointer to test
+  * @return true for guard heap memory
+  */
+ static inline bool memory_guard_owns(const void* memory) {
+     uintptr_t begin = __atomic_load_n(&g_guard_region_begin, __ATOMIC_ACQUIRE);
+     uintptr_t end = __atomic_load_n(&g_guard_region_end, __ATOMIC_RELAXED);
+     return (uintptr_t)memory - begin < end - begin;
+ }
+ 
+ /**
+  * @brief Allocate a block ending against a guard page
+  * @param size Requested size
+  * @param alignment Alignment of the block, a power of two up to a page;
+  *                  the block ends less than this many bytes before the
+  *                  guard page
+  * @return Pointer to memory, or NULL when the range is exhausted or the
+  *         system refuses another mapping (counted as a fallback)
+  */
+ void* memory_guard_allocate(size_t size, size_t alignment);
+ 
+ /**
+  * @brief Quarantine a guarded block; its pages fault until recycled
+  * @param memory Block from memory_guard_allocate
+  */
+ void memory_guard_release(void* memory);
+ 
+ /**
+  * @brief Check the fill around a guarded block
+  * @param memory Block from memory_guard_allocate
+  * @return false if bytes between the block and its page boundaries were
+  *         written
+  */
+ bool memory_guard_intact(const void* memory);
+ 
+ /**
+  * @brief Get the size of a guarded block
+  * @param memory Block from memory_guard_allocate
+  * @return Size passed to memory_guard_allocate; the fill behind it is
+  *         checked, so it is not usable
+  */
+ size_t memory_guard_usable_size(const void* memory);
+ 
+ /**
+  * @brief Bound the pages freed blocks keep inaccessible
+  * @param bytes Quarantine size; the oldest blocks are recycled beyond it
+  *              (0 recycles pages as soon as they are freed)
+  */
+ void memory_guard_set_quarantine(size_t bytes);
+ 
+ /**
+  * @brief Get guard heap usage
+  * @param stats Output statistics
+  */
+ void memory_guard_get_stats(MemoryGuardStats* stats);
+ 
+ /**
+  * @brief Drop live block accounting and restore the default quarantine
+  *        (used by memory_manager_init)
+  */
+ void memory_guard_forget_all(void);
+ 
+ #endif // MEMORY_GUARD_H
@@ -9,10 +9,15 @@
  #include <stdlib.h>
  #include <string.h>
  #include <stdbool.h>
+ #include <stdint.h>
+ #include <pthread.h>
  
  // Constant definitions for improved readability
- #define MAX_FILENAME_LENGTH 256
+ #ifndef MEMORY_TRACKING_ENABLED
  #define MEMORY_TRACKING_ENABLED 1
+ #endif
+ #define MEMORY_POOL_CHUNK_NODES 1024
+ #define MEMORY_BLOCK_MAGIC 0x6d656d62u
  
  /**
   * @enum MemoryAllocationType
@@ -26,24 +31,99 @@
  
  /**
   * @struct MemoryBlock
-  * @brief Represents a tracked memory allocation
+  * @brief Represents a tracked memory allocation (a node of the pool)
   */
  typedef struct MemoryBlock {
      void* pointer;              // Actual memory pointer
      size_t size;                // Size of allocated memory
-     char filename[MAX_FILENAME_LENGTH];  // Source file of allocation
+     const char* filename;       // Source file (static string such as __FILE__)
      int line_number;            // Line number of allocation
      MemoryAllocationType type;  // Type of memory allocation
-     struct MemoryBlock* next;   // Pointer to next memory block
+     uint32_t index;             // Position of this node in the pool
+     struct MemoryBlock* previous;  // Previous live block
+     struct MemoryBlock* next;   // Next live block, or next free node
  } MemoryBlock;
  
+ /**
+  * @struct MemoryBlockPrefix
+  * @brief Stored in front of each tracked allocation to find its node
+  */
+ typedef struct {
+     uint32_t node_index;        // Pool index of the tracking node
+     uint32_t magic;             // MEMORY_BLOCK_MAGIC
+ } __attribute__((aligned(16))) MemoryBlockPrefix;
+ 
  // Global memory tracking structure
  static MemoryBlock* g_memory_tracker = NULL;
+ static pthread_mutex_t g_tracker_lock = PTHREAD_MUTEX_INITIALIZER;
+ 
+ #if MEMORY_TRACKING_ENABLED
+ // Node pool: fixed chunks of contiguous nodes, recycled through a free list
+ static MemoryBlock** g_pool_chunks = NULL;
+ static size_t g_pool_chunk_count = 0;
+ static size_t g_pool_chunk_capacity = 0;
+ static MemoryBlock* g_free_nodes = NULL;
+ 
+ /**
+  * @brief Takes a tracking node from the pool (tracker lock held)
+  * @return Node, or NULL if the pool cannot grow
+  */
+ static MemoryBlock* pool_acquire_node(void) {
+     if (g_free_nodes == NULL) {
+         if (g_pool_chunk_count == g_pool_chunk_capacity) {
+             size_t capacity = g_pool_chunk_capacity ? g_pool_chunk_capacity * 2 : 16;
+             MemoryBlock** chunks = realloc(
+                 g_pool_chunks, capacity * sizeof(MemoryBlock*)
+             );
+             if (chunks == NULL) {
+                 return NULL;
+             }
+             g_pool_chunks = chunks;
+             g_pool_chunk_capacity = capacity;
+         }
+ 
+         MemoryBlock* chunk = calloc(MEMORY_POOL_CHUNK_NODES, sizeof(MemoryBlock));
+         if (chunk == NULL) {
+             return NULL;
+         }
+ 
+         // Thread the new nodes onto the free list in address order
+         uint32_t first = (uint32_t)(g_pool_chunk_count * MEMORY_POOL_CHUNK_NODES);
+         for (size_t i = MEMORY_POOL_CHUNK_NODES; i-- > 0;) {
+             chunk[i].index = first + (uint32_t)i;
+             chunk[i].next = g_free_nodes;
+             g_free_nodes = &chunk[i];
+         }
+         g_pool_chunks[g_pool_chunk_count++] = chunk;
+     }
+ 
+     MemoryBlock* node = g_free_nodes;
+     g_free_nodes = node->next;
+     return node;
+ }
+ 
+ /**
+  * @brief Finds the live node for a tracked pointer (tracker lock held)
+  * @param memory Pointer returned by safe_memory_allocate
+  * @return Node, or NULL if the pointer is not tracked
+  */
+ static MemoryBlock* pool_find_node(void* memory) {
+     const MemoryBlockPrefix* prefix = (const MemoryBlockPrefix*)memory - 1;
+     if (prefix->magic != MEMORY_BLOCK_MAGIC ||
+         prefix->node_index >= g_pool_chunk_count * MEMORY_POOL_CHUNK_NODES) {
+         return NULL;
+     }
+ 
+     MemoryBlock* node = &g_pool_chunks[prefix->node_index / MEMORY_POOL_CHUNK_NODES]
+                                       [prefix->node_index % MEMORY_POOL_CHUNK_NODES];
+     return node->pointer == memory ? node : NULL;
+ }
+ #endif
  
  /**
   * @brief Safely allocates memory with enhanced tracking
   * @param size Size of memory to allocate
-  * @param filename Source file name
+  * @param filename Source file name (static string such as __FILE__)
   * @param line_number Source line number
   * @param type Memory allocation type
   * @return Pointer to allocated memory
@@ -54,14 +134,20 @@
      int line_number, 
      MemoryAllocationType type
  ) {
-     // Validate allocation size
+     // Validate input
      if (size == 0) {
          fprintf(stderr, "Warning: Attempting to allocate zero bytes\n");
          return NULL;
      }
  
-     // Attempt memory allocation
+     #if MEMORY_TRACKING_ENABLED
+     // One allocation holds the node prefix and the user memory
+     MemoryBlockPrefix* prefix = malloc(sizeof(MemoryBlockPrefix) + size);
+     void* allocated_memory = prefix ? prefix + 1 : NULL;
+     #else
+     (void)type;
      void* allocated_memory = malloc(size);
+     #endif
      if (allocated_memory == NULL) {
          fprintf(
              stderr, 
@@ -74,9 +160,11 @@
  
      // Create memory tracking block
      #if MEMORY_TRACKING_ENABLED
-     MemoryBlock* tracking_block = malloc(sizeof(MemoryBlock));
+     pthread_mutex_lock(&g_tracker_lock);
+     MemoryBlock* tracking_block = pool_acquire_node();
      if (tracking_block == NULL) {
-         free(allocated_memory);
+         pthread_mutex_unlock(&g_tracker_lock);
+         free(prefix);
          fprintf(
              stderr, 
              "CRITICAL: Tracking block allocation failed\n"
@@ -87,17 +175,20 @@
      // Populate tracking information
      tracking_block->pointer = allocated_memory;
      tracking_block->size = size;
-     strncpy(
-         tracking_block->filename, 
-         filename, 
-         MAX_FILENAME_LENGTH - 1
-     );
+     tracking_block->filename = filename;
      tracking_block->line_number = line_number;
      tracking_block->type = type;
-     
+     prefix->node_index = tracking_block->index;
+     prefix->magic = MEMORY_BLOCK_MAGIC;
+ 
      // Link to global tracker
+     tracking_block->previous = NULL;
      tracking_block->next = g_memory_tracker;
+     if (g_memory_tracker != NULL) {
+         g_memory_tracker->previous = tracking_block;
+     }
      g_memory_tracker = tracking_block;
+     pthread_mutex_unlock(&g_tracker_lock);
      #endif
  
      return allocated_memory;
@@ -126,30 +217,44 @@
      }
  
      #if MEMORY_TRACKING_ENABLED
-     // Find and remove from tracking
-     MemoryBlock* current = g_memory_tracker;
-     MemoryBlock* previous = NULL;
+     // Find the node through the prefix and unlink it
+     pthread_mutex_lock(&g_tracker_lock);
+     MemoryBlock* current = pool_find_node(memory);
+     if (current != NULL) {
+         if (current->previous == NULL) {
+             g_memory_tracker = current->next;
+         } else {
+             current->previous->next = current->next;
+         }
+         if (current->next != NULL) {
+             current->next->previous = current->previous;
+         }
  
-     while (current != NULL) {
-         if (current->pointer == memory) {
-             // Unlink from tracking list
-             if (previous == NULL) {
-                 g_memory_tracker = current->next;
-             } else {
-                 previous->next = current->next;
-             }
+         // Return the node to the pool
+         current->pointer = NULL;
+         current->next = g_free_nodes;
+         g_free_nodes = current;
+         ((MemoryBlockPrefix*)memory - 1)->magic = 0;
+     }
+     pthread_mutex_unlock(&g_tracker_lock);
  
-             // Free tracking block
-             free(current);
-             break;
-         }
-         previous = current;
-         current = current->next;
+     if (current == NULL) {
+         fprintf(
+             stderr, 
+             "Warning: Attempting to free untracked pointer at %s:%d\n", 
+             filename, 
+             line_number
+         );
+         return;
      }
-     #endif
  
-     // Actually free the memory
+     // Actually free the memory, prefix included
+     free((MemoryBlockPrefix*)memory - 1);
+     #else
+     (void)filename;
+     (void)line_number;
      free(memory);
+     #endif
  }
  
  /**
@@ -158,6 +263,7 @@
  void generate_memory_report(void) {
      printf("\n--- MEMORY ALLOCATION REPORT ---\n");
      
+     pthread_mutex_lock(&g_tracker_lock);
      MemoryBlock* current = g_memory_tracker;
      size_t total_allocated = 0;
      int block_count = 0;
@@ -180,6 +286,7 @@
          block_count++;
          current = current->next;
      }
+     pthread_mutex_unlock(&g_tracker_lock);
  
      printf(
          "Summary:\n"
@@ -190,11 +297,17 @@
      );
  }
  
- // Macro definitions for convenient usage
+ // Macro definitions for convenient usage; release builds call the
+ // system allocator directly
+ #if MEMORY_TRACKING_ENABLED
  #define ALLOCATE(size, type) \
      safe_memory_allocate(size, __FILE__, __LINE__, type)
  #define DEALLOCATE(ptr) \
      safe_memory_free(ptr, __FILE__, __LINE__)
+ #else
+ #define ALLOCATE(size, type) ((void)(type), malloc(size))
+ #define DEALLOCATE(ptr) free(ptr)
+ #endif
  
  /**
   * @brief Demonstration of memory management tool
@@ -2,152 +2,3834 @@
  * @file memory_manager.c
  * @brief Memory Management Utility Implementation
  */
-
+ 
+ #define _GNU_SOURCE
+ 
+ #include <dlfcn.h>
+ #include <time.h>
  #include "memory_manager.h"
-
- // Global memory tracker
- static MemoryTracker g_memory_tracker = {0};
+ #include "memory_diagnostics.h"
+ #include "memory_system.h"
+ #include "memory_slab.h"
+ #include "memory_arena.h"
+ #include "memory_persistent.h"
+ #include "memory_guard.h"
+ #include "memory_trace.h"
+ 
+ #define MEMORY_NO_SLOT UINT32_MAX
+ #define MEMORY_INDEX_MIN_CAPACITY 1024
+ #define MEMORY_SITE_MIN_CAPACITY 256
+ #define MEMORY_SITE_CHUNK 256
+ #define MEMORY_MAX_SITE_CHUNKS 4096
+ #define MEMORY_SITE_CACHE_SIZE 64
+ 
+ #if MEMORY_THREAD_SAFE
+ #define TRACKER_LOCK(mutex) pthread_mutex_lock(mutex)
+ #define TRACKER_UNLOCK(mutex) pthread_mutex_unlock(mutex)
+ #define TRACKER_LOCK_INIT { .lock = PTHREAD_MUTEX_INITIALIZER }
+ #else
+ #define TRACKER_LOCK(mutex) ((void)0)
+ #define TRACKER_UNLOCK(mutex) ((void)0)
+ #define TRACKER_LOCK_INIT { }
+ #endif
+ 
+ // Global memory tracker, one shard per address-hash bucket
+ static MemoryTracker g_memory_shards[MEMORY_TRACKER_SHARDS] = {
+     [0 ... MEMORY_TRACKER_SHARDS - 1] = TRACKER_LOCK_INIT
+ };
+ static size_t g_block_limit = MEMORY_DEFAULT_BLOCK_LIMIT;
+ static bool g_slab_enabled = true;
+ 
+ // Sampling mode: each thread counts down the bytes left before its next
+ // sample, drawn from its own random sequence
+ static size_t g_sample_interval = MEMORY_DEFAULT_SAMPLE_INTERVAL;
+ static __thread int64_t t_sample_countdown;
+ static __thread uint64_t t_sample_random;
+ 
+ // Stack traces: frames kept per tracked allocation, and the return address
+ // into the code that called the tracker, where a stack starts (set by
+ // each public allocation entry point)
+ static unsigned g_trace_depth = MEMORY_DEFAULT_TRACE_DEPTH;
+ static __thread const void* t_trace_entry;
+ #define TRACE_ENTRY() (t_trace_entry = __builtin_return_address(0))
+ 
+ #if MEMORY_CANARIES
+ // Canary word of this process, drawn again by memory_manager_init
+ static uint64_t g_canary = 0x5ca1ab1e0ddba11eULL;
+ #endif
+ 
+ // Guard pages (memory_guard.h): a bit per MemoryAllocationType, and the
+ // call sites set by memory_manager_set_guard_site. Each site caches its
+ // match, tagged with the rule epoch it was made under.
+ typedef struct {
+     const char* filename;       // Return address for MEMORY_CALLER_LINE
+     int line_number;
+ } MemoryGuardRule;
+ 
+ static unsigned g_guard_types = 0;
+ static MemoryGuardRule g_guard_sites[MEMORY_GUARD_MAX_SITES];
+ static size_t g_guard_site_count = 0;
+ static uint32_t g_guard_epoch = 1;
+ #if MEMORY_THREAD_SAFE
+ static pthread_mutex_t g_guard_rules_lock = PTHREAD_MUTEX_INITIALIZER;
+ #endif
+ 
+ // Live slab blocks are counted by the recording thread when the thread
+ // cache is enabled, which folds its count in here every
+ // MEMORY_PENDING_RECORDS blocks; these totals hold everything else
+ static int64_t g_slab_live_blocks = 0;
+ static int64_t g_slab_live_bytes = 0;
+ 
+ // Interned call site and its allocation counters. Counters are only
+ // ever added to with atomics, in batches published by MemorySiteDelta.
+ typedef struct {
+     MemoryCallSite site;
+     uint64_t first_timestamp;   // Clock reading when the site was interned
+     uint64_t allocations;
+     uint64_t frees;
+     uint64_t allocated_bytes;   // Cumulative
+     int64_t live_bytes;
+     int64_t peak_bytes;         // Highest live_bytes seen at a publish
+     uint32_t guard_state;       // (Guard rule epoch << 1) | guarded
+ } MemorySiteRecord;
+ 
+ // Call-site interning table: (filename pointer, line, type, trace) ->
+ // site id.
+ // Sites live in fixed chunks so lock-free readers never see them move.
+ typedef struct {
+ #if MEMORY_THREAD_SAFE
+     pthread_mutex_t lock;       // Guards index and insertion
+ #endif
+     MemorySiteRecord* chunks[MEMORY_MAX_SITE_CHUNKS];
+     uint32_t* index;            // Hash of sites (site id + 1, 0 = empty)
+     size_t count;
+     size_t capacity;            // Index buckets (power of two)
+ } MemorySiteTable;
+ 
+ static MemorySiteTable g_site_table = TRACKER_LOCK_INIT;
+ 
+ // Per-type counters fed by site_publish; index MEMORY_TYPE_COUNT sums
+ // every type
+ typedef struct {
+     uint64_t allocations;
+     uint64_t frees;
+     uint64_t allocated_bytes;
+     uint64_t failed_allocations;
+     uint64_t untracked_allocations;
+     int64_t live_blocks;
+     int64_t live_bytes;
+     int64_t peak_blocks;
+     int64_t peak_bytes;
+ } __attribute__((aligned(64))) MemoryTypeCounters;
+ 
+ static MemoryTypeCounters g_type_counters[MEMORY_TYPE_COUNT + 1];
+ 
+ // Site counter changes a thread has not published yet. Only the owner
+ // writes a delta; reports read it to add the unpublished part. Type
+ // counters have deltas of their own (site_id unused), netted across the
+ // type's sites so that their peaks see every live block of the type.
+ typedef struct {
+     uint32_t site_id;           // Site id + 1 (0 = empty)
+     uint32_t operations;        // Changes since the last publish
+     int64_t allocations;
+     int64_t frees;
+     int64_t allocated_bytes;
+     int64_t freed_bytes;
+     int64_t peak_blocks;        // Highest net block change since publish
+     int64_t peak_bytes;         // Highest net byte change since publish
+ } MemorySiteDelta;
+ 
+ // Per-thread direct-mapped cache in front of the shared site table
+ typedef struct {
+     const char* filename;
+     int line_number;
+     MemoryAllocationType type;
+     uint32_t trace_id;
+     uint32_t site_id;
+ } MemorySiteCacheEntry;
+ 
+ static __thread MemorySiteCacheEntry t_site_cache[MEMORY_SITE_CACHE_SIZE];
+ static uint64_t g_site_generation = 1;
+ static __thread uint64_t t_site_generation;
+ 
+ #if MEMORY_TIMESTAMP_TSC && !defined(__x86_64__) && !defined(__i386__)
+ #error "MEMORY_TIMESTAMP_TSC needs the x86 time-stamp counter"
+ #endif
+ 
+ // Lifetime histograms of blocks freed by exited threads (and by every
+ // thread when the thread cache is disabled)
+ static uint64_t g_lifetime_buckets[MEMORY_TYPE_COUNT][MEMORY_LIFETIME_BUCKETS];
+ static uint64_t g_lifetime_ticks[MEMORY_TYPE_COUNT];
+ 
+ // Clock readings taken together by memory_manager_init for TSC calibration
+ static uint64_t g_clock_base_ns = 0;
+ static uint64_t g_clock_base_ticks = 0;
  
  // Internal utility functions
+ static uint64_t clock_ns(void) {
+     struct timespec ts;
+     clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+     return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+ }
+ 
  static uint64_t get_current_timestamp(void) {
-     static uint64_t timestamp = 0;
-     return ++timestamp;
+ #if MEMORY_TIMESTAMP_TSC
+     return __builtin_ia32_rdtsc();
+ #else
+     return clock_ns();
+ #endif
+ }
+ 
+ // TSC ticks are scaled against CLOCK_MONOTONIC_RAW over at least 1 ms
+ static double clock_ns_per_tick(void) {
+ #if MEMORY_TIMESTAMP_TSC
+     uint64_t ns, ticks;
+     do {
+         ns = clock_ns();
+         ticks = get_current_timestamp();
+     } while (ns - g_clock_base_ns < 1000000);
+     return (double)(ns - g_clock_base_ns) / (double)(ticks - g_clock_base_ticks);
+ #else
+     return 1.0;
+ #endif
+ }
+ 
+ static unsigned lifetime_bucket(uint64_t ticks) {
+     unsigned bucket = 63 - (unsigned)__builtin_clzll(ticks | 1);
+     return bucket < MEMORY_LIFETIME_BUCKETS ? bucket : MEMORY_LIFETIME_BUCKETS - 1;
+ }
+ 
+ // Sampling needs a logarithm and an exponential; both are computed here
+ // so the tracker links without libm
+ #define MEMORY_LN2 0.69314718055994530942
+ 
+ // ln(value): the bit length gives the power of two, an atanh series the
+ // mantissa in [1, 2)
+ static double log_integer(uint64_t value) {
+     unsigned exponent = 63 - (unsigned)__builtin_clzll(value | 1);
+     double mantissa = (double)value / (double)(1ULL << exponent);
+     double t = (mantissa - 1) / (mantissa + 1);
+     double t2 = t * t;
+     double series = t * (1 + t2 * (1.0 / 3 + t2 * (1.0 / 5 + t2 * (1.0 / 7 +
+                     t2 * (1.0 / 9 + t2 * (1.0 / 11 + t2 / 13))))));
+     return exponent * MEMORY_LN2 + 2 * series;
+ }
+ 
+ // exp(-x) for x >= 0: a short series on x / 2^k, squared k times
+ static double exp_negative(double x) {
+     if (x > 700) {
+         return 0;
+     }
+     unsigned halvings = 0;
+     while (x > 0x1p-10) {
+         x *= 0.5;
+         halvings++;
+     }
+     double result = 1 - x * (1 - x / 2 * (1 - x / 3 * (1 - x / 4)));
+     while (halvings-- > 0) {
+         result *= result;
+     }
+     return result;
+ }
+ 
+ static bool sampling_enabled(void) {
+     return __atomic_load_n(&g_sample_interval, __ATOMIC_RELAXED) != 0;
+ }
+ 
+ // Bytes to this thread's next sample: exponential with mean interval,
+ // from a xorshift sequence
+ static int64_t sample_countdown(size_t interval) {
+     uint64_t random = t_sample_random;
+     random ^= random << 13;
+     random ^= random >> 7;
+     random ^= random << 17;
+     t_sample_random = random;
+ 
+     // -ln(u) for u uniform in (0, 1], u = ((random >> 11) + 1) / 2^53
+     double draw = (53 * MEMORY_LN2 - log_integer((random >> 11) + 1)) *
+                   (double)interval;
+     return draw < 0x1p62 ? (int64_t)draw + 1 : INT64_MAX;
+ }
+ 
+ // Pointer hash: the top bits select the shard, the low bits the bucket
+ static uint64_t hash_pointer(const void* pointer) {
+     uint64_t key = (uint64_t)(uintptr_t)pointer;
+     key ^= key >> 33;
+     key *= 0xff51afd7ed558ccdULL;
+     key ^= key >> 33;
+     key *= 0xc4ceb9fe1a85ec53ULL;
+     key ^= key >> 33;
+     return key;
+ }
+ 
+ // Blocks a tracked block stands for in the counters: 1, or in sampling
+ // mode the inverse of its chance of being sampled. The fraction rounds
+ // up or down by the block's address hash (hash_pointer), so every counter
+ // change of the block rounds alike and the sums stay unbiased.
+ static int64_t block_weight(
+     uint64_t hash,
+     size_t size,
+     MemoryAllocationType type
+ ) {
+     size_t interval = __atomic_load_n(&g_sample_interval, __ATOMIC_RELAXED);
+     if (interval == 0 || type == MEMORY_TYPE_PERSISTENT) {
+         return 1;
+     }
+     double chance = 1 - exp_negative((double)size / (double)interval);
+     double weight = chance > 0x1p-40 ? 1 / chance : 0x1p40;
+     int64_t whole = (int64_t)weight;
+     double position = (double)(uint32_t)hash * 0x1p-32;
+     return whole + (position < weight - (double)whole);
+ }
+ 
+ static unsigned shard_index(uint64_t hash) {
+     return (unsigned)(hash >> (64 - MEMORY_TRACKER_SHARD_BITS));
+ }
+ 
+ static MemoryTracker* tracker_shard(uint64_t hash) {
+     return &g_memory_shards[shard_index(hash)];
+ }
+ 
+ // Counting sort of up to MEMORY_BATCH_CHUNK entries by shard, so a batch
+ // visits each shard once
+ static void order_by_shard(const uint8_t* shards, size_t count, uint16_t* order) {
+     uint32_t start[MEMORY_TRACKER_SHARDS + 1] = { 0 };
+     for (size_t i = 0; i < count; i++) {
+         start[shards[i] + 1]++;
+     }
+     for (size_t s = 0; s < MEMORY_TRACKER_SHARDS; s++) {
+         start[s + 1] += start[s];
+     }
+     for (size_t i = 0; i < count; i++) {
+         order[start[shards[i]]++] = (uint16_t)i;
+     }
+ }
+ 
+ #if !MEMORY_HEADER_METADATA
+ 
+ // Slot -> block: segment k starts at slot BASE * (2^k - 1)
+ static MemoryBlock* tracker_block(MemoryTracker* tracker, uint32_t slot) {
+     uint64_t scaled = (uint64_t)slot / MEMORY_SEGMENT_BASE_BLOCKS + 1;
+     unsigned segment = 63 - (unsigned)__builtin_clzll(scaled);
+     uint64_t first = (uint64_t)MEMORY_SEGMENT_BASE_BLOCKS * ((1ULL << segment) - 1);
+     return &tracker->segments[segment][slot - first];
+ }
+ 
+ // Pointer index: open addressing with linear probing, keyed on address
+ static void index_place(
+     MemoryTracker* tracker,
+     uint32_t* index,
+     size_t mask,
+     uint32_t entry
+ ) {
+     const void* pointer = tracker_block(tracker, entry - 1)->pointer;
+     size_t position = hash_pointer(pointer) & mask;
+     while (index[position] != 0) {
+         position = (position + 1) & mask;
+     }
+     index[position] = entry;
  }
  
- static int find_available_slot(void) {
-     for (size_t i = 0; i < MAX_TRACKED_BLOCKS; i++) {
-         if (g_memory_tracker.blocks[i].pointer == NULL) {
-             return i;
+ // Keep the load factor at or below one half, doubling when needed
+ static bool index_reserve(MemoryTracker* tracker, size_t entries) {
+     size_t capacity = tracker->index_capacity;
+     if (entries * 2 <= capacity) {
+         return true;
+     }
+ 
+     size_t new_capacity = capacity ? capacity * 2 : MEMORY_INDEX_MIN_CAPACITY;
+     while (entries * 2 > new_capacity) {
+         new_capacity *= 2;
+     }
+     uint32_t* new_index = memory_system_calloc(new_capacity, sizeof(uint32_t));
+     if (!new_index) {
+         return false;
+     }
+ 
+     for (size_t i = 0; i < capacity; i++) {
+         if (tracker->index[i] != 0) {
+             index_place(tracker, new_index, new_capacity - 1, tracker->index[i]);
          }
      }
-     return -1;
+     memory_system_free(tracker->index);
+     tracker->index = new_index;
+     tracker->index_capacity = new_capacity;
+     return true;
  }
  
- void memory_manager_init(void) {
-     memset(&g_memory_tracker, 0, sizeof(MemoryTracker));
+ static size_t index_find(
+     MemoryTracker* tracker,
+     const void* pointer,
+     uint64_t hash
+ ) {
+     size_t mask = tracker->index_capacity - 1;
+     if (tracker->index_capacity == 0) {
+         return SIZE_MAX;
+     }
+ 
+     size_t position = hash & mask;
+     uint32_t entry;
+     while ((entry = tracker->index[position]) != 0) {
+         if (tracker_block(tracker, entry - 1)->pointer == pointer) {
+             return position;
+         }
+         position = (position + 1) & mask;
+     }
+     return SIZE_MAX;
  }
  
- void* safe_memory_allocate(
-     size_t size, 
-     const char* filename, 
-     int line_number, 
+ // Backward-shift deletion keeps probe chains intact without tombstones
+ static void index_remove(MemoryTracker* tracker, size_t position) {
+     size_t mask = tracker->index_capacity - 1;
+     size_t next = (position + 1) & mask;
+     uint32_t entry;
+     while ((entry = tracker->index[next]) != 0) {
+         const void* pointer = tracker_block(tracker, entry - 1)->pointer;
+         size_t home = hash_pointer(pointer) & mask;
+         size_t distance_next = (next - home) & mask;
+         size_t distance_hole = (position - home) & mask;
+         if (distance_hole < distance_next) {
+             tracker->index[position] = entry;
+             position = next;
+         }
+         next = (next + 1) & mask;
+     }
+     tracker->index[position] = 0;
+ }
+ 
+ #endif // !MEMORY_HEADER_METADATA
+ 
+ // Filenames come from __FILE__, so the literal's address is a stable key;
+ // caller sites are keyed by their return address the same way
+ static size_t hash_site(
+     const void* filename,
+     int line_number,
+     MemoryAllocationType type,
+     uint32_t trace_id
+ ) {
+     uint64_t key = (uint64_t)(uintptr_t)filename ^
+                    ((uint64_t)(uint32_t)line_number << 40) ^
+                    ((uint64_t)type << 32) ^
+                    ((uint64_t)trace_id * 0xff51afd7ed558ccdULL);
+     key *= 0x9e3779b97f4a7c15ULL;
+     return (size_t)(key >> 32);
+ }
+ 
+ static const void* site_key(const MemoryCallSite* site) {
+     return site->line_number == MEMORY_CALLER_LINE ? site->caller :
+                                                      (const void*)site->filename;
+ }
+ 
+ static MemorySiteRecord* site_record(uint32_t site_id) {
+     return &g_site_table.chunks[site_id / MEMORY_SITE_CHUNK]
+                                [site_id % MEMORY_SITE_CHUNK];
+ }
+ 
+ static bool site_index_grow(void) {
+     size_t capacity = g_site_table.capacity ?
+         g_site_table.capacity * 2 : MEMORY_SITE_MIN_CAPACITY;
+     uint32_t* index = memory_system_calloc(capacity, sizeof(uint32_t));
+     if (!index) {
+         return false;
+     }
+ 
+     for (uint32_t id = 0; id < g_site_table.count; id++) {
+         MemoryCallSite* site = &site_record(id)->site;
+         size_t position = hash_site(site_key(site), site->line_number,
+                                     site->type, site->trace_id) & (capacity - 1);
+         while (index[position] != 0) {
+             position = (position + 1) & (capacity - 1);
+         }
+         index[position] = id + 1;
+     }
+     memory_system_free(g_site_table.index);
+     g_site_table.index = index;
+     g_site_table.capacity = capacity;
+     return true;
+ }
+ 
+ // Slow path: look up or insert the site under the table lock
+ static uint32_t intern_site_locked(
+     const char* filename,
+     int line_number,
+     MemoryAllocationType type,
+     uint32_t trace_id
+ ) {
+     uint32_t id = MEMORY_NO_SLOT;
+     TRACKER_LOCK(&g_site_table.lock);
+ 
+     if (g_site_table.count + 1 > g_site_table.capacity / 2 &&
+         !site_index_grow()) {
+         goto done;
+     }
+ 
+     size_t mask = g_site_table.capacity - 1;
+     size_t position = hash_site(filename, line_number, type, trace_id) & mask;
+     uint32_t entry;
+     while ((entry = g_site_table.index[position]) != 0) {
+         MemoryCallSite* site = &site_record(entry - 1)->site;
+         if (site_key(site) == filename && site->line_number == line_number &&
+             site->type == type && site->trace_id == trace_id) {
+             id = entry - 1;
+             goto done;
+         }
+         position = (position + 1) & mask;
+     }
+ 
+     size_t chunk = g_site_table.count / MEMORY_SITE_CHUNK;
+     if (chunk >= MEMORY_MAX_SITE_CHUNKS) {
+         goto done;
+     }
+     if (!g_site_table.chunks[chunk]) {
+         MemorySiteRecord* sites =
+             memory_system_calloc(MEMORY_SITE_CHUNK, sizeof(MemorySiteRecord));
+         if (!sites) {
+             goto done;
+         }
+         g_site_table.chunks[chunk] = sites;
+     }
+ 
+     id = (uint32_t)g_site_table.count;
+     MemorySiteRecord* record = site_record(id);
+     memset(record, 0, sizeof(MemorySiteRecord));
+     if (line_number == MEMORY_CALLER_LINE) {
+         record->site.caller = filename;
+     } else {
+         record->site.filename = filename;
+     }
+     record->site.line_number = line_number;
+     record->site.type = type;
+     record->site.trace_id = trace_id;
+     record->first_timestamp = get_current_timestamp();
+     g_site_table.index[position] = id + 1;
+     __atomic_store_n(&g_site_table.count, g_site_table.count + 1, __ATOMIC_RELEASE);
+ 
+ done:
+     TRACKER_UNLOCK(&g_site_table.lock);
+     return id;
+ }
+ 
+ static uint32_t intern_site(
+     const char* filename,
+     int line_number,
+     MemoryAllocationType type,
+     uint32_t trace_id
+ ) {
+     // memory_manager_init bumps the generation to invalidate every cache
+     uint64_t generation = __atomic_load_n(&g_site_generation, __ATOMIC_ACQUIRE);
+     if (t_site_generation != generation) {
+         memset(t_site_cache, 0, sizeof(t_site_cache));
+         t_site_generation = generation;
+     }
+ 
+     MemorySiteCacheEntry* cached = &t_site_cache[
+         hash_site(filename, line_number, type, trace_id) % MEMORY_SITE_CACHE_SIZE
+     ];
+     if (cached->filename == filename && cached->line_number == line_number &&
+         cached->type == type && cached->trace_id == trace_id) {
+         return cached->site_id;
+     }
+ 
+     uint32_t id = intern_site_locked(filename, line_number, type, trace_id);
+     if (id != MEMORY_NO_SLOT) {
+         cached->filename = filename;
+         cached->line_number = line_number;
+         cached->type = type;
+         cached->trace_id = trace_id;
+         cached->site_id = id;
+     }
+     return id;
+ }
+ 
+ // Site of a tracked allocation, under the calling stack when traces are
+ // on. A stack the trace or site table has no room for is dropped.
+ static uint32_t intern_allocation_site(
+     const char* filename,
+     int line_number,
      MemoryAllocationType type
  ) {
-     // Validation checks
-     if (size == 0) {
-         fprintf(stderr, "WARNING: Zero-byte allocation\n");
-         return NULL;
+     unsigned depth = __atomic_load_n(&g_trace_depth, __ATOMIC_RELAXED);
+     uint32_t trace_id = MEMORY_NO_TRACE;
+     if (depth != 0) {
+         // A caller site's return address is where its stack starts
+         const void* entry = line_number == MEMORY_CALLER_LINE ?
+                             (const void*)filename : t_trace_entry;
+         trace_id = memory_trace_capture(entry, depth);
      }
  
-     if (g_memory_tracker.current_block_count >= MAX_TRACKED_BLOCKS) {
-         fprintf(stderr, "ERROR: Memory tracker full\n");
-         return NULL;
+     uint32_t id = intern_site(filename, line_number, type, trace_id);
+     if (id == MEMORY_NO_SLOT && trace_id != MEMORY_NO_TRACE) {
+         id = intern_site(filename, line_number, type, MEMORY_NO_TRACE);
      }
+     return id;
+ }
  
-     // Allocate memory
-     void* memory = malloc(size);
-     if (!memory) {
-         fprintf(
-             stderr, 
-             "CRITICAL: Allocation failed at %s:%d\n", 
-             filename, 
-             line_number
+ static void raise_peak(int64_t* peak, int64_t value) {
+     int64_t current = __atomic_load_n(peak, __ATOMIC_RELAXED);
+     while (value > current &&
+            !__atomic_compare_exchange_n(peak, &current, value, true,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+     }
+ }
+ 
+ static void delta_clear(MemorySiteDelta* delta) {
+     __atomic_store_n(&delta->allocations, 0, __ATOMIC_RELAXED);
+     __atomic_store_n(&delta->frees, 0, __ATOMIC_RELAXED);
+     __atomic_store_n(&delta->allocated_bytes, 0, __ATOMIC_RELAXED);
+     __atomic_store_n(&delta->freed_bytes, 0, __ATOMIC_RELAXED);
+     __atomic_store_n(&delta->peak_blocks, 0, __ATOMIC_RELAXED);
+     __atomic_store_n(&delta->peak_bytes, 0, __ATOMIC_RELAXED);
+     delta->operations = 0;
+ }
+ 
+ // Fold a type delta into its counters, its peak on top of the live
+ // count it started from as for sites
+ static void type_publish(
+     MemoryTypeCounters* counters,
+     MemorySiteDelta* delta
+ ) {
+     __atomic_add_fetch(&counters->allocations, delta->allocations, __ATOMIC_RELAXED);
+     __atomic_add_fetch(&counters->frees, delta->frees, __ATOMIC_RELAXED);
+     __atomic_add_fetch(&counters->allocated_bytes, delta->allocated_bytes,
+                        __ATOMIC_RELAXED);
+     int64_t net_blocks = delta->allocations - delta->frees;
+     int64_t net_bytes = delta->allocated_bytes - delta->freed_bytes;
+     int64_t live_blocks = __atomic_add_fetch(
+         &counters->live_blocks, net_blocks, __ATOMIC_RELAXED
+     );
+     int64_t live_bytes = __atomic_add_fetch(
+         &counters->live_bytes, net_bytes, __ATOMIC_RELAXED
+     );
+     raise_peak(&counters->peak_blocks, live_blocks - net_blocks + delta->peak_blocks);
+     raise_peak(&counters->peak_bytes, live_bytes - net_bytes + delta->peak_bytes);
+     delta_clear(delta);
+ }
+ 
+ // Fold a delta into its site record. A delta's own peak is applied on
+ // top of the live bytes it started from, so a site's peak is exact for
+ // one thread and otherwise within one batch per thread.
+ static void site_publish(MemorySiteDelta* delta) {
+     if (delta->site_id == 0) {
+         return;
+     }
+ 
+     MemorySiteRecord* record = site_record(delta->site_id - 1);
+     __atomic_add_fetch(&record->allocations, delta->allocations, __ATOMIC_RELAXED);
+     __atomic_add_fetch(&record->frees, delta->frees, __ATOMIC_RELAXED);
+     __atomic_add_fetch(&record->allocated_bytes, delta->allocated_bytes,
+                        __ATOMIC_RELAXED);
+     int64_t net_bytes = delta->allocated_bytes - delta->freed_bytes;
+     int64_t live = __atomic_add_fetch(&record->live_bytes, net_bytes,
+                                       __ATOMIC_RELAXED);
+     raise_peak(&record->peak_bytes, live - net_bytes + delta->peak_bytes);
+     delta_clear(delta);
+ }
+ 
+ #if !MEMORY_HEADER_METADATA
+ 
+ // Free slots form a stack threaded through unused blocks; slots past
+ // used_slot_limit have never been handed out and need no linking
+ static uint32_t find_available_slot(MemoryTracker* tracker) {
+     uint32_t head = tracker->free_slot_head;
+     if (head != 0) {
+         tracker->free_slot_head = tracker_block(tracker, head - 1)->next_free_slot;
+         return head - 1;
+     }
+ 
+     uint32_t slot = tracker->used_slot_limit;
+     if (slot >= MAX_TRACKED_BLOCKS) {
+         return MEMORY_NO_SLOT;
+     }
+ 
+     // Crossing into a new segment: allocate it, never touching older ones
+     uint64_t scaled = (uint64_t)slot / MEMORY_SEGMENT_BASE_BLOCKS + 1;
+     unsigned segment = 63 - (unsigned)__builtin_clzll(scaled);
+     if (!tracker->segments[segment]) {
+         size_t blocks = (size_t)MEMORY_SEGMENT_BASE_BLOCKS << segment;
+         tracker->segments[segment] =
+             memory_system_calloc(blocks, sizeof(MemoryBlock));
+         if (!tracker->segments[segment]) {
+             return MEMORY_NO_SLOT;
+         }
+     }
+ 
+     tracker->used_slot_limit++;
+     return slot;
+ }
+ 
+ static void release_slot(MemoryTracker* tracker, uint32_t slot) {
+     MemoryBlock* block = tracker_block(tracker, slot);
+     memset(block, 0, sizeof(MemoryBlock));
+     block->next_free_slot = tracker->free_slot_head;
+     tracker->free_slot_head = slot + 1;
+ }
+ 
+ #endif // !MEMORY_HEADER_METADATA
+ 
+ // Sums shard counters without locking; exact once allocators are quiet
+ static size_t sum_block_counts(void) {
+     size_t total = 0;
+     for (size_t i = 0; i < MEMORY_TRACKER_SHARDS; i++) {
+         total += __atomic_load_n(
+             &g_memory_shards[i].current_block_count, __ATOMIC_RELAXED
          );
-         return NULL;
      }
+     return total;
+ }
+ 
+ static void discard_pending_records(void);
+ static void reset_slab_counts(void);
+ static void reset_lifetimes(void);
+ static void reset_site_deltas(void);
+ 
+ void memory_manager_init(void) {
+     discard_pending_records();
+ 
+     for (size_t s = 0; s < MEMORY_TRACKER_SHARDS; s++) {
+         MemoryTracker* tracker = &g_memory_shards[s];
+ #if MEMORY_HEADER_METADATA
+         // Forgotten blocks must not pass the magic check when freed later
+         for (MemoryHeader* header = tracker->live_head; header;
+              header = header->next) {
+             header->magic = 0;
+         }
+         tracker->live_head = NULL;
+ #else
+         for (size_t i = 0; i < MEMORY_MAX_SEGMENTS; i++) {
+             memory_system_free(tracker->segments[i]);
+             tracker->segments[i] = NULL;
+         }
+         memory_system_free(tracker->index);
+         tracker->index = NULL;
+         tracker->index_capacity = 0;
+         tracker->free_slot_head = 0;
+         tracker->used_slot_limit = 0;
+ #endif
+         tracker->current_block_count = 0;
+         tracker->total_allocated_memory = 0;
+     }
+     g_block_limit = MEMORY_DEFAULT_BLOCK_LIMIT;
+     g_sample_interval = MEMORY_DEFAULT_SAMPLE_INTERVAL;
+     g_trace_depth = MEMORY_DEFAULT_TRACE_DEPTH;
+     memory_slab_forget_all();
+     reset_slab_counts();
+     reset_lifetimes();
+     reset_site_deltas();
+     memset(g_type_counters, 0, sizeof(g_type_counters));
+     memory_persistent_forget_all();
+     memory_guard_forget_all();
+     g_guard_types = 0;
+     g_guard_site_count = 0;
+     g_guard_epoch++;
+ 
+     g_clock_base_ns = clock_ns();
+     g_clock_base_ticks = get_current_timestamp();
+ #if MEMORY_CANARIES
+     g_canary = (g_clock_base_ticks ^ (uint64_t)(uintptr_t)&g_canary) *
+                0x9e3779b97f4a7c15ULL;
+ #endif
+ 
+     for (size_t i = 0; i < MEMORY_MAX_SITE_CHUNKS; i++) {
+         memory_system_free(g_site_table.chunks[i]);
+         g_site_table.chunks[i] = NULL;
+     }
+     memory_system_free(g_site_table.index);
+     g_site_table.index = NULL;
+     g_site_table.count = 0;
+     g_site_table.capacity = 0;
+     __atomic_add_fetch(&g_site_generation, 1, __ATOMIC_RELEASE);
+     memory_trace_forget_all();
+ }
+ 
+ void memory_manager_set_block_limit(size_t limit) {
+     __atomic_store_n(&g_block_limit, limit, __ATOMIC_RELAXED);
+ }
+ 
+ size_t memory_manager_get_sample_interval(void) {
+     return __atomic_load_n(&g_sample_interval, __ATOMIC_RELAXED);
+ }
+ 
+ unsigned memory_manager_get_trace_depth(void) {
+     return __atomic_load_n(&g_trace_depth, __ATOMIC_RELAXED);
+ }
+ 
+ // Shard totals are summed without the lock (sum_block_counts), so the
+ // holder of the lock updates them atomically
+ static void tracker_count(MemoryTracker* tracker, int64_t blocks, int64_t bytes) {
+     __atomic_store_n(&tracker->current_block_count,
+                      tracker->current_block_count + (size_t)blocks, __ATOMIC_RELAXED);
+     __atomic_store_n(&tracker->total_allocated_memory,
+                      tracker->total_allocated_memory + (size_t)bytes, __ATOMIC_RELAXED);
+ }
+ 
+ #if MEMORY_HEADER_METADATA
+ 
+ static MemoryHeader* header_of(void* memory) {
+     return (MemoryHeader*)memory - 1;
+ }
+ 
+ // Fill the block's header and link it; the shard lock must be held
+ static bool tracker_insert(
+     MemoryTracker* tracker,
+     void* memory,
+     size_t size,
+     uint32_t site_id,
+     MemoryAllocationType type,
+     uint64_t timestamp
+ ) {
+     MemoryHeader* header = header_of(memory);
+     header->size = size;
+     header->timestamp = timestamp;
+     header->site_id = site_id;
+     header->type = (uint16_t)type;
+     header->status = MEMORY_STATUS_ALLOCATED;
+     __atomic_store_n(&header->magic, MEMORY_HEADER_MAGIC, __ATOMIC_RELAXED);
+ 
+     header->previous = NULL;
+     header->next = tracker->live_head;
+     if (tracker->live_head) {
+         tracker->live_head->previous = header;
+     }
+     tracker->live_head = header;
+ 
+     tracker_count(tracker, 1, (int64_t)size);
+     return true;
+ }
+ 
+ // Unlink the block found by pointer arithmetic, copying it out; the
+ // shard lock must be held
+ static bool tracker_remove(
+     MemoryTracker* tracker,
+     void* memory,
+     uint64_t hash,
+     MemoryBlock* removed
+ ) {
+     (void)hash;
+     MemoryHeader* header = header_of(memory);
+     if (__atomic_load_n(&header->magic, __ATOMIC_RELAXED) != MEMORY_HEADER_MAGIC) {
+         return false;
+     }
+ 
+     if (header->previous) {
+         header->previous->next = header->next;
+     } else {
+         tracker->live_head = header->next;
+     }
+     if (header->next) {
+         header->next->previous = header->previous;
+     }
+     __atomic_store_n(&header->magic, 0, __ATOMIC_RELAXED);
+ 
+     removed->pointer = memory;
+     removed->size = header->size;
+     removed->timestamp = header->timestamp;
+     removed->site_id = header->site_id;
+     removed->type = (MemoryAllocationType)header->type;
+     removed->status = MEMORY_STATUS_FREED;
+     tracker_count(tracker, -1, -(int64_t)header->size);
+     return true;
+ }
+ 
+ #else
  
+ // Insert a tracking record; the shard lock must be held
+ static bool tracker_insert(
+     MemoryTracker* tracker,
+     void* memory,
+     size_t size,
+     uint32_t site_id,
+     MemoryAllocationType type,
+     uint64_t timestamp
+ ) {
      // Find tracking slot
-     int slot = find_available_slot();
-     if (slot == -1) {
-         free(memory);
-         return NULL;
+     uint32_t slot = find_available_slot(tracker);
+     if (slot == MEMORY_NO_SLOT ||
+         !index_reserve(tracker, tracker->current_block_count + 1)) {
+         if (slot != MEMORY_NO_SLOT) {
+             release_slot(tracker, slot);
+         }
+         return false;
      }
  
      // Populate memory block
-     MemoryBlock* block = &g_memory_tracker.blocks[slot];
+     MemoryBlock* block = tracker_block(tracker, slot);
      block->pointer = memory;
      block->size = size;
      block->type = type;
      block->status = MEMORY_STATUS_ALLOCATED;
-     block->line_number = line_number;
-     block->timestamp = get_current_timestamp();
+     block->site_id = site_id;
+     block->timestamp = timestamp;
  
-     strncpy(block->filename, filename, MAX_FILENAME_LENGTH - 1);
-     block->filename[MAX_FILENAME_LENGTH - 1] = '\0';
+     index_place(tracker, tracker->index, tracker->index_capacity - 1, slot + 1);
  
      // Update tracker
-     g_memory_tracker.current_block_count++;
-     g_memory_tracker.total_allocated_memory += size;
- 
-     return memory;
+     tracker_count(tracker, 1, (int64_t)size);
+     return true;
  }
  
- void safe_memory_free(
-     void* memory, 
-     const char* filename, 
-     int line_number
+ // Remove a tracking record, copying it out; the shard lock must be held
+ static bool tracker_remove(
+     MemoryTracker* tracker,
+     void* memory,
+     uint64_t hash,
+     MemoryBlock* removed
  ) {
-     if (!memory) {
-         fprintf(
-             stderr, 
-             "WARNING: Freeing NULL pointer at %s:%d\n", 
-             filename, 
-             line_number
-         );
-         return;
+     size_t position = index_find(tracker, memory, hash);
+     if (position == SIZE_MAX) {
+         return false;
      }
  
-     // Find and update memory block
-     for (size_t i = 0; i < MAX_TRACKED_BLOCKS; i++) {
-         MemoryBlock* block = &g_memory_tracker.blocks[i];
-         
-         if (block->pointer == memory) {
-             // Update tracker
-             g_memory_tracker.total_allocated_memory -= block->size;
-             g_memory_tracker.current_block_count--;
+     uint32_t slot = tracker->index[position] - 1;
+     MemoryBlock* block = tracker_block(tracker, slot);
  
-             block->status = MEMORY_STATUS_FREED;
-             free(memory);
-             
-             // Clear block
-             memset(block, 0, sizeof(MemoryBlock));
-             return;
-         }
+     // Update tracker
+     tracker_count(tracker, -1, -(int64_t)block->size);
+     index_remove(tracker, position);
+ 
+     block->status = MEMORY_STATUS_FREED;
+     *removed = *block;
+ 
+     // Clear block and return it to the free-slot list
+     release_slot(tracker, slot);
+     return true;
+ }
+ 
+ #endif // MEMORY_HEADER_METADATA
+ 
+ // Canary mode stores a tracked block as head canary, data, tail canary.
+ // Records keep the storage address and the requested size; only the
+ // public entry points see the data address.
+ #if MEMORY_CANARIES
+ #define CANARY_HEAD 16          // Keeps the data 16-byte aligned
+ #define CANARY_TAIL 8
+ #else
+ #define CANARY_HEAD 0
+ #define CANARY_TAIL 0
+ #endif
+ 
+ static size_t storage_size(size_t size) {
+     return size + CANARY_HEAD + CANARY_TAIL;
+ }
+ 
+ // Size class of a block's storage, which must be class-sized
+ static unsigned block_class(size_t size) {
+     return memory_size_class(storage_size(size));
+ }
+ 
+ static void* user_pointer(void* storage) {
+     return storage ? (char*)storage + CANARY_HEAD : NULL;
+ }
+ 
+ static void* storage_pointer(void* memory) {
+     return (char*)memory - CANARY_HEAD;
+ }
+ 
+ // Write both canaries. Done before the block's record is published, so
+ // a sweep never checks a block that has none yet.
+ static void canary_arm(void* storage, size_t size) {
+ #if MEMORY_CANARIES
+     uint64_t canary = g_canary;
+     memcpy(storage, &canary, sizeof(canary));
+     memcpy((char*)storage + sizeof(canary), &canary, sizeof(canary));
+     memcpy((char*)storage + CANARY_HEAD + size, &canary, sizeof(canary));
+ #else
+     (void)storage;
+     (void)size;
+ #endif
+ }
+ 
+ // Three word compares folded into one branch
+ static bool canary_intact(const void* storage, size_t size) {
+ #if MEMORY_CANARIES
+     uint64_t head[2];
+     uint64_t tail;
+     memcpy(head, storage, sizeof(head));
+     memcpy(&tail, (const char*)storage + CANARY_HEAD + size, sizeof(tail));
+     uint64_t canary = g_canary;
+     return ((head[0] ^ canary) | (head[1] ^ canary) | (tail ^ canary)) == 0;
+ #else
+     (void)storage;
+     (void)size;
+     return true;
+ #endif
+ }
+ 
+ // Corruption is reported at the site that allocated the block
+ static void report_corruption(uint32_t site_id) {
+     const MemoryCallSite* site = &site_record(site_id)->site;
+     memory_diagnostic(MEMORY_DIAG_CORRUPTED,
+                       site->line_number == MEMORY_CALLER_LINE ?
+                           (const char*)site->caller : site->filename,
+                       site->line_number);
+ }
+ 
+ static void* heap_raw(void* memory);
+ 
+ // A guarded block's fill up to its page boundaries counts as a canary
+ static bool block_intact(void* storage, size_t size) {
+     return __builtin_expect(canary_intact(storage, size), 1) &&
+            (!memory_guard_owns(storage) || memory_guard_intact(heap_raw(storage)));
+ }
+ 
+ // Check a block leaving its storage or changing size; false if overrun
+ static bool canary_verify(void* storage, size_t size, uint32_t site_id) {
+     if (block_intact(storage, size)) {
+         return true;
      }
+     report_corruption(site_id);
+     return false;
+ }
  
-     // Untracked memory
-     fprintf(
-         stderr, 
-         "WARNING: Untracked memory free at %s:%d\n", 
-         filename, 
-         line_number
-     );
-     free(memory);
+ // Tracked heap blocks; in header mode the MemoryHeader precedes the
+ // user pointer and is allocated with it. The block table has no room
+ // for the padding in front of an aligned block, which canaries add, so
+ // canary mode keeps its size in a small header of its own.
+ #if MEMORY_HEADER_METADATA
+ #define HEAP_HEADER_SIZE sizeof(MemoryHeader)
+ #elif MEMORY_CANARIES
+ #define HEAP_HEADER_SIZE 16
+ #else
+ #define HEAP_HEADER_SIZE 0
+ #endif
+ 
+ static void* heap_raw(void* memory) {
+ #if MEMORY_HEADER_METADATA
+     return (char*)memory - HEAP_HEADER_SIZE - header_of(memory)->offset;
+ #elif MEMORY_CANARIES
+     uint32_t offset;
+     memcpy(&offset, (char*)memory - sizeof(offset), sizeof(offset));
+     return (char*)memory - HEAP_HEADER_SIZE - offset;
+ #else
+     return memory;
+ #endif
  }
  
- void generate_memory_report(void) {
-     printf("\n--- MEMORY ALLOCATION REPORT ---\n");
-     printf("Total Blocks: %zu\n", g_memory_tracker.current_block_count);
-     printf("Total Allocated: %zu bytes\n", 
-            g_memory_tracker.total_allocated_memory);
- 
-     for (size_t i = 0; i < MAX_TRACKED_BLOCKS; i++) {
-         MemoryBlock* block = &g_memory_tracker.blocks[i];
-         
-         if (block->pointer) {
-             printf(
-                 "Block %zu: %p, %zu bytes, Type: %d, Status: %d\n",
-                 i, block->pointer, block->size, 
-                 block->type, block->status
-             );
+ // Bytes in front of a heap block of an alignment-aligned allocation:
+ // the header ends where the block starts, and the bytes after its head
+ // canary are aligned
+ static size_t heap_lead(size_t alignment) {
+     if (alignment <= MEMORY_MIN_ALIGNMENT) {
+         return HEAP_HEADER_SIZE;
+     }
+     return ((HEAP_HEADER_SIZE + CANARY_HEAD + alignment - 1) & ~(alignment - 1)) -
+            CANARY_HEAD;
+ }
+ 
+ // Header mode: a reused C library block may still hold the magic of its
+ // last owner, so a fresh block starts without one
+ static void* heap_place(char* raw, size_t lead) {
+     uint32_t offset = (uint32_t)(lead - HEAP_HEADER_SIZE);
+ #if MEMORY_HEADER_METADATA
+     header_of(raw + lead)->offset = offset;
+     __atomic_store_n(&header_of(raw + lead)->magic, 0, __ATOMIC_RELAXED);
+ #elif MEMORY_CANARIES
+     memcpy(raw + lead - sizeof(offset), &offset, sizeof(offset));
+ #else
+     (void)offset;
+ #endif
+     return raw + lead;
+ }
+ 
+ // Storage for a heap block: size counts the canaries as well
+ static void* heap_allocate(
+     size_t size,
+     MemoryAllocationType type,
+     size_t alignment
+ ) {
+     char* raw = NULL;
+     size_t lead = heap_lead(alignment);
+ 
+     if (alignment > MEMORY_MIN_ALIGNMENT) {
+         if (memory_system_memalign((void**)&raw, alignment, lead + size) != 0) {
+             raw = NULL;
+         }
+     } else {
+         // Persistent blocks are packed away from short-lived ones
+         if (type == MEMORY_TYPE_PERSISTENT) {
+             raw = memory_persistent_allocate(size + HEAP_HEADER_SIZE);
+         }
+         if (!raw) {
+             raw = memory_system_malloc(size + HEAP_HEADER_SIZE);
          }
      }
+     return raw ? heap_place(raw, lead) : NULL;
  }
  
- size_t get_total_allocated_memory(void) {
-     return g_memory_tracker.total_allocated_memory;
+ // Storage for a heap block ending against a guard page, header and all
+ static void* guard_allocate(size_t size, size_t alignment) {
+     size_t lead = heap_lead(alignment);
+     char* raw = memory_guard_allocate(lead + size, alignment);
+     return raw ? heap_place(raw, lead) : NULL;
  }
  
- size_t get_current_block_count(void) {
-     return g_memory_tracker.current_block_count;
- }
\ No newline at end of file
+ // realloc a plain heap block; the padding and header in front move with it
+ static void* heap_reallocate(void* memory, size_t size) {
+     char* raw = heap_raw(memory);
+     size_t lead = (size_t)((char*)memory - raw);
+     char* resized = memory_system_realloc(raw, lead + size);
+     return resized ? resized + lead : NULL;
+ }
+ 
+ // Blocks up to MEMORY_CACHE_MAX_SIZE outside the persistent heap are
+ // recycled through the magazines by recorded size, so they hold a whole
+ // size class and may only change size within it
+ static bool class_sized(void* memory, size_t size) {
+ #if MEMORY_THREAD_CACHE
+     return storage_size(size) <= MEMORY_CACHE_MAX_SIZE &&
+            !memory_persistent_owns(memory) && !memory_guard_owns(memory);
+ #else
+     (void)memory;
+     (void)size;
+     return false;
+ #endif
+ }
+ 
+ // Check whether a block can take a new size where it is; persistent
+ // blocks are resized in their heap as a side effect
+ static bool resize_in_place(void* memory, size_t size, size_t new_size) {
+     if (memory_persistent_owns(memory)) {
+         return memory_persistent_resize(heap_raw(memory),
+                                         storage_size(size) + HEAP_HEADER_SIZE,
+                                         storage_size(new_size) + HEAP_HEADER_SIZE);
+     }
+     if (class_sized(memory, size)) {
+         return class_sized(memory, new_size) &&
+                block_class(new_size) == block_class(size);
+     }
+     return false;
+ }
+ 
+ // Plain malloc'd blocks staying outside the size classes go to realloc;
+ // guarded blocks always move, to end against a guard page again
+ static bool heap_resizable(void* memory, size_t size, size_t new_size) {
+     return !memory_persistent_owns(memory) && !memory_guard_owns(memory) &&
+            !class_sized(memory, size) && !class_sized(memory, new_size);
+ }
+ 
+ // Outcome of resizing a block where its record is kept
+ typedef enum {
+     RESIZE_UNTRACKED,           // No record for the block
+     RESIZE_DONE,                // Record updated in place
+     RESIZE_MOVE,                // Needs new storage; record untouched
+     RESIZE_REHOME,              // realloc moved it; record removed for reinsertion
+     RESIZE_FAILED               // realloc failed; block untouched
+ } MemoryResizeResult;
+ 
+ #if MEMORY_HEADER_METADATA
+ 
+ // Resize a block's header in place or realloc it with its header; the
+ // shard lock must be held
+ static MemoryResizeResult tracker_resize(
+     MemoryTracker* tracker,
+     void* memory,
+     uint64_t hash,
+     size_t size,
+     MemoryBlock* old
+ ) {
+     MemoryHeader* header = header_of(memory);
+     if (__atomic_load_n(&header->magic, __ATOMIC_RELAXED) != MEMORY_HEADER_MAGIC) {
+         return RESIZE_UNTRACKED;
+     }
+ 
+     old->pointer = memory;
+     old->size = header->size;
+     old->timestamp = header->timestamp;
+     old->site_id = header->site_id;
+     old->type = (MemoryAllocationType)header->type;
+     old->status = MEMORY_STATUS_ALLOCATED;
+     canary_verify(memory, header->size, header->site_id);
+     if (resize_in_place(memory, header->size, size)) {
+         canary_arm(memory, size);
+         tracker_count(tracker, 0, (int64_t)size - (int64_t)header->size);
+         header->size = size;
+         return RESIZE_DONE;
+     }
+     if (!heap_resizable(memory, header->size, size)) {
+         return RESIZE_MOVE;
+     }
+ 
+     // The header may move, so it leaves the live list first
+     tracker_remove(tracker, memory, hash, old);
+     void* resized = heap_reallocate(memory, storage_size(size));
+     if (!resized) {
+         tracker_insert(tracker, memory, old->size, old->site_id, old->type,
+                        old->timestamp);
+         return RESIZE_FAILED;
+     }
+     old->pointer = resized;
+     return RESIZE_REHOME;
+ }
+ 
+ #else
+ 
+ // Resize a tracking record in place or realloc its block; the shard lock
+ // must be held
+ static MemoryResizeResult tracker_resize(
+     MemoryTracker* tracker,
+     void* memory,
+     uint64_t hash,
+     size_t size,
+     MemoryBlock* old
+ ) {
+     size_t position = index_find(tracker, memory, hash);
+     if (position == SIZE_MAX) {
+         return RESIZE_UNTRACKED;
+     }
+ 
+     uint32_t slot = tracker->index[position] - 1;
+     MemoryBlock* block = tracker_block(tracker, slot);
+     *old = *block;
+     canary_verify(memory, block->size, block->site_id);
+     if (resize_in_place(memory, block->size, size)) {
+         canary_arm(memory, size);
+         tracker_count(tracker, 0, (int64_t)size - (int64_t)block->size);
+         block->size = size;
+         return RESIZE_DONE;
+     }
+     if (!heap_resizable(memory, block->size, size)) {
+         return RESIZE_MOVE;
+     }
+ 
+     // realloc runs under the lock so a freed old address cannot be handed
+     // out and tracked by another thread before its record is gone
+     void* resized = heap_reallocate(memory, storage_size(size));
+     if (!resized) {
+         return RESIZE_FAILED;
+     }
+     if (resized == memory) {
+         canary_arm(memory, size);
+         tracker_count(tracker, 0, (int64_t)size - (int64_t)block->size);
+         block->size = size;
+         return RESIZE_DONE;
+     }
+     tracker_count(tracker, -1, -(int64_t)block->size);
+     index_remove(tracker, position);
+     release_slot(tracker, slot);
+     old->pointer = resized;
+     return RESIZE_REHOME;
+ }
+ 
+ #endif // MEMORY_HEADER_METADATA
+ 
+ #if MEMORY_THREAD_CACHE
+ 
+ // Header mode: a live magic means the record already reached its shard
+ static bool block_published(void* memory) {
+ #if MEMORY_HEADER_METADATA
+     return __atomic_load_n(&header_of(memory)->magic, __ATOMIC_RELAXED) ==
+            MEMORY_HEADER_MAGIC;
+ #else
+     (void)memory;
+     return false;
+ #endif
+ }
+ 
+ // Allocation not yet published to the shards
+ typedef struct {
+     void* pointer;
+     size_t size;
+     uint64_t timestamp;
+     uint32_t site_id;
+     MemoryAllocationType type;
+ } MemoryPendingRecord;
+ 
+ // Thread-local allocation cache. Only the owning thread touches it on
+ // the hot path; reports and cross-thread frees take its lock briefly.
+ typedef struct MemoryThreadCache {
+     uint8_t lock;
+     bool registered;
+     uint32_t pending_count;
+     MemoryPendingRecord pending[MEMORY_PENDING_RECORDS];
+     uint32_t magazine_count[MEMORY_SIZE_CLASSES];
+     void* magazines[MEMORY_SIZE_CLASSES][MEMORY_MAGAZINE_SIZE];
+     int64_t slab_blocks;        // Slab blocks recorded minus cleared here
+     int64_t slab_bytes;
+     uint64_t lifetime_buckets[MEMORY_TYPE_COUNT][MEMORY_LIFETIME_BUCKETS];
+     uint64_t lifetime_ticks[MEMORY_TYPE_COUNT];
+     MemorySiteDelta site_deltas[MEMORY_SITE_DELTA_SLOTS];  // By site id
+     MemorySiteDelta type_deltas[MEMORY_TYPE_COUNT + 1];    // As g_type_counters
+     struct MemoryThreadCache* previous;
+     struct MemoryThreadCache* next;
+ } MemoryThreadCache;
+ 
+ static __thread MemoryThreadCache t_thread_cache;
+ 
+ // Registry of live thread caches; lock order is registry, cache, shard
+ static MemoryThreadCache* g_cache_registry = NULL;
+ #if MEMORY_THREAD_SAFE
+ static pthread_mutex_t g_cache_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+ static pthread_key_t g_cache_key;
+ static pthread_once_t g_cache_key_once = PTHREAD_ONCE_INIT;
+ #endif
+ 
+ static void cache_lock(MemoryThreadCache* cache) {
+ #if MEMORY_THREAD_SAFE
+     while (__atomic_test_and_set(&cache->lock, __ATOMIC_ACQUIRE)) {
+ #if defined(__x86_64__) || defined(__i386__)
+         __builtin_ia32_pause();
+ #endif
+     }
+ #else
+     (void)cache;
+ #endif
+ }
+ 
+ static void cache_unlock(MemoryThreadCache* cache) {
+ #if MEMORY_THREAD_SAFE
+     __atomic_clear(&cache->lock, __ATOMIC_RELEASE);
+ #else
+     (void)cache;
+ #endif
+ }
+ 
+ // Publish pending records grouped by shard, one lock round-trip per shard
+ static void cache_flush_locked(MemoryThreadCache* cache) {
+     uint32_t count = cache->pending_count;
+     if (count == 0) {
+         return;
+     }
+ 
+     uint8_t order[MEMORY_PENDING_RECORDS];
+     uint8_t shards[MEMORY_PENDING_RECORDS];
+     for (uint32_t i = 0; i < count; i++) {
+         uint64_t hash = hash_pointer(cache->pending[i].pointer);
+         shards[i] = (uint8_t)(hash >> (64 - MEMORY_TRACKER_SHARD_BITS));
+         uint32_t j = i;
+         while (j > 0 && shards[order[j - 1]] > shards[i]) {
+             order[j] = order[j - 1];
+             j--;
+         }
+         order[j] = (uint8_t)i;
+     }
+ 
+     uint32_t i = 0;
+     while (i < count) {
+         MemoryTracker* tracker = &g_memory_shards[shards[order[i]]];
+         TRACKER_LOCK(&tracker->lock);
+         do {
+             MemoryPendingRecord* record = &cache->pending[order[i]];
+             if (!tracker_insert(tracker, record->pointer, record->size,
+                                 record->site_id, record->type,
+                                 record->timestamp)) {
+                 const MemoryCallSite* site = &site_record(record->site_id)->site;
+                 memory_diagnostic(MEMORY_DIAG_TRACKER_GROWTH,
+                                   (const char*)site_key(site), site->line_number);
+             }
+             i++;
+         } while (i < count && shards[order[i]] == shards[order[i - 1]]);
+         TRACKER_UNLOCK(&tracker->lock);
+     }
+     cache->pending_count = 0;
+ }
+ 
+ // Return cached objects of one size class to their owners; a magazine
+ // may mix slab objects and malloc'd class-sized blocks
+ static void magazine_spill(void** objects, uint32_t count) {
+     void* slab_objects[MEMORY_MAGAZINE_SIZE];
+     uint32_t slab_count = 0;
+     for (uint32_t i = 0; i < count; i++) {
+         if (memory_slab_owns(objects[i])) {
+             slab_objects[slab_count++] = objects[i];
+         } else {
+             memory_system_free(heap_raw(objects[i]));
+         }
+     }
+     memory_slab_release(slab_objects, slab_count);
+ }
+ 
+ #if MEMORY_THREAD_SAFE
+ static void cache_destroy(void* argument) {
+     MemoryThreadCache* cache = argument;
+ 
+     TRACKER_LOCK(&g_cache_registry_lock);
+     cache_lock(cache);
+     cache_flush_locked(cache);
+     for (size_t c = 0; c < MEMORY_SIZE_CLASSES; c++) {
+         magazine_spill(cache->magazines[c], cache->magazine_count[c]);
+         cache->magazine_count[c] = 0;
+     }
+     __atomic_add_fetch(&g_slab_live_blocks, cache->slab_blocks, __ATOMIC_RELAXED);
+     __atomic_add_fetch(&g_slab_live_bytes, cache->slab_bytes, __ATOMIC_RELAXED);
+     cache->slab_blocks = 0;
+     cache->slab_bytes = 0;
+     for (size_t t = 0; t < MEMORY_TYPE_COUNT; t++) {
+         for (size_t b = 0; b < MEMORY_LIFETIME_BUCKETS; b++) {
+             __atomic_add_fetch(&g_lifetime_buckets[t][b],
+                                cache->lifetime_buckets[t][b], __ATOMIC_RELAXED);
+         }
+         __atomic_add_fetch(&g_lifetime_ticks[t], cache->lifetime_ticks[t],
+                            __ATOMIC_RELAXED);
+     }
+     memset(cache->lifetime_buckets, 0, sizeof(cache->lifetime_buckets));
+     memset(cache->lifetime_ticks, 0, sizeof(cache->lifetime_ticks));
+     for (size_t i = 0; i < MEMORY_SITE_DELTA_SLOTS; i++) {
+         site_publish(&cache->site_deltas[i]);
+         cache->site_deltas[i].site_id = 0;
+     }
+     for (size_t t = 0; t <= MEMORY_TYPE_COUNT; t++) {
+         type_publish(&g_type_counters[t], &cache->type_deltas[t]);
+     }
+     cache_unlock(cache);
+ 
+     if (cache->previous) {
+         cache->previous->next = cache->next;
+     } else {
+         g_cache_registry = cache->next;
+     }
+     if (cache->next) {
+         cache->next->previous = cache->previous;
+     }
+     cache->registered = false;
+     TRACKER_UNLOCK(&g_cache_registry_lock);
+ }
+ 
+ static void cache_key_create(void) {
+     pthread_key_create(&g_cache_key, cache_destroy);
+ }
+ #endif
+ 
+ static MemoryThreadCache* thread_cache(void) {
+     MemoryThreadCache* cache = &t_thread_cache;
+     if (__builtin_expect(!cache->registered, 0)) {
+ #if MEMORY_THREAD_SAFE
+         pthread_once(&g_cache_key_once, cache_key_create);
+         pthread_setspecific(g_cache_key, cache);
+ #endif
+         TRACKER_LOCK(&g_cache_registry_lock);
+         cache->next = g_cache_registry;
+         if (g_cache_registry) {
+             g_cache_registry->previous = cache;
+         }
+         g_cache_registry = cache;
+         cache->registered = true;
+         TRACKER_UNLOCK(&g_cache_registry_lock);
+     }
+     return cache;
+ }
+ 
+ static void* cache_allocate(
+     size_t size,
+     uint32_t site_id,
+     MemoryAllocationType type,
+     uint64_t timestamp
+ ) {
+     MemoryThreadCache* cache = thread_cache();
+     unsigned size_class = block_class(size);
+ 
+     // Dynamic blocks refill the magazine from the slabs half a load at a time
+     if (cache->magazine_count[size_class] == 0 &&
+         type == MEMORY_TYPE_DYNAMIC &&
+         __atomic_load_n(&g_slab_enabled, __ATOMIC_RELAXED)) {
+         cache->magazine_count[size_class] = (uint32_t)memory_slab_refill(
+             size_class, cache->magazines[size_class], MEMORY_MAGAZINE_SIZE / 2
+         );
+     }
+ 
+     void* memory;
+     if (cache->magazine_count[size_class] > 0) {
+         memory = cache->magazines[size_class][--cache->magazine_count[size_class]];
+     } else {
+         memory = heap_allocate(memory_size_class_bytes(size_class), type,
+                                MEMORY_MIN_ALIGNMENT);
+         if (!memory) {
+             return NULL;
+         }
+     }
+     canary_arm(memory, size);
+ 
+     // Slab objects carry their tracking entry in the slab header
+     if (memory_slab_owns(memory)) {
+         memory_slab_record(memory, size, site_id, type, timestamp);
+         __atomic_store_n(&cache->slab_blocks, cache->slab_blocks + 1,
+                          __ATOMIC_RELAXED);
+         __atomic_store_n(&cache->slab_bytes, cache->slab_bytes + (int64_t)size,
+                          __ATOMIC_RELAXED);
+         return memory;
+     }
+ 
+     cache_lock(cache);
+     if (cache->pending_count == MEMORY_PENDING_RECORDS) {
+         cache_flush_locked(cache);
+     }
+     MemoryPendingRecord* record = &cache->pending[cache->pending_count++];
+     record->pointer = memory;
+     record->size = size;
+     record->timestamp = timestamp;
+     record->site_id = site_id;
+     record->type = type;
+     // Sampled blocks are published at once, so a block missing from the
+     // shards is an unsampled one (see take_record)
+     if (sampling_enabled()) {
+         cache_flush_locked(cache);
+     }
+     cache_unlock(cache);
+ 
+     return memory;
+ }
+ 
+ // Batch form of cache_allocate: the magazine is emptied first, dynamic
+ // blocks then come from the slabs in one refill, and pending records are
+ // queued under one cache lock; returns the blocks stored in objects
+ static size_t cache_allocate_batch(
+     size_t size,
+     size_t count,
+     void** objects,
+     uint32_t site_id,
+     MemoryAllocationType type,
+     uint64_t timestamp
+ ) {
+     MemoryThreadCache* cache = thread_cache();
+     unsigned size_class = block_class(size);
+     size_t taken = 0;
+ 
+     uint32_t cached = cache->magazine_count[size_class];
+     while (taken < count && cached > 0) {
+         objects[taken++] = cache->magazines[size_class][--cached];
+     }
+     cache->magazine_count[size_class] = cached;
+ 
+     if (taken < count && type == MEMORY_TYPE_DYNAMIC &&
+         __atomic_load_n(&g_slab_enabled, __ATOMIC_RELAXED)) {
+         taken += memory_slab_refill(size_class, objects + taken, count - taken);
+     }
+     while (taken < count) {
+         void* memory = heap_allocate(memory_size_class_bytes(size_class), type,
+                                      MEMORY_MIN_ALIGNMENT);
+         if (!memory) {
+             break;
+         }
+         objects[taken++] = memory;
+     }
+ 
+     int64_t slab_blocks = 0;
+     cache_lock(cache);
+     for (size_t i = 0; i < taken; i++) {
+         canary_arm(objects[i], size);
+         if (memory_slab_owns(objects[i])) {
+             memory_slab_record(objects[i], size, site_id, type, timestamp);
+             slab_blocks++;
+             continue;
+         }
+         if (cache->pending_count == MEMORY_PENDING_RECORDS) {
+             cache_flush_locked(cache);
+         }
+         MemoryPendingRecord* record = &cache->pending[cache->pending_count++];
+         record->pointer = objects[i];
+         record->size = size;
+         record->timestamp = timestamp;
+         record->site_id = site_id;
+         record->type = type;
+     }
+     if (sampling_enabled()) {
+         cache_flush_locked(cache);
+     }
+     cache_unlock(cache);
+ 
+     __atomic_store_n(&cache->slab_blocks, cache->slab_blocks + slab_blocks,
+                      __ATOMIC_RELAXED);
+     __atomic_store_n(&cache->slab_bytes,
+                      cache->slab_bytes + slab_blocks * (int64_t)size,
+                      __ATOMIC_RELAXED);
+     return taken;
+ }
+ 
+ static void pending_block(const MemoryPendingRecord* record, MemoryBlock* block) {
+     block->pointer = record->pointer;
+     block->size = record->size;
+     block->timestamp = record->timestamp;
+     block->site_id = record->site_id;
+     block->type = record->type;
+     block->status = MEMORY_STATUS_ALLOCATED;
+ }
+ 
+ // Drop a pending record for memory, copying it out if it was there; the
+ // cache lock must be held
+ static bool pending_take_locked(
+     MemoryThreadCache* cache,
+     void* memory,
+     MemoryBlock* removed
+ ) {
+     for (uint32_t i = cache->pending_count; i-- > 0;) {
+         if (cache->pending[i].pointer == memory) {
+             pending_block(&cache->pending[i], removed);
+             removed->status = MEMORY_STATUS_FREED;
+             cache->pending[i] = cache->pending[--cache->pending_count];
+             return true;
+         }
+     }
+     return false;
+ }
+ 
+ static bool cache_take_pending(
+     MemoryThreadCache* cache,
+     void* memory,
+     MemoryBlock* removed
+ ) {
+     cache_lock(cache);
+     bool found = pending_take_locked(cache, memory, removed);
+     cache_unlock(cache);
+     return found;
+ }
+ 
+ // Memory allocated on another thread may still sit in that thread's cache
+ static bool cache_take_remote(void* memory, MemoryBlock* removed) {
+     bool found = false;
+     TRACKER_LOCK(&g_cache_registry_lock);
+     for (MemoryThreadCache* cache = g_cache_registry; cache && !found;
+          cache = cache->next) {
+         if (cache != &t_thread_cache) {
+             found = cache_take_pending(cache, memory, removed);
+         }
+     }
+     TRACKER_UNLOCK(&g_cache_registry_lock);
+     return found;
+ }
+ 
+ // Resize a pending record if its block allows it, copying out the old one
+ static MemoryResizeResult cache_resize_pending(
+     MemoryThreadCache* cache,
+     void* memory,
+     size_t size,
+     MemoryBlock* old
+ ) {
+     MemoryResizeResult result = RESIZE_UNTRACKED;
+     cache_lock(cache);
+     for (uint32_t i = cache->pending_count; i-- > 0;) {
+         MemoryPendingRecord* record = &cache->pending[i];
+         if (record->pointer == memory) {
+             pending_block(record, old);
+             canary_verify(memory, record->size, record->site_id);
+             result = RESIZE_MOVE;
+             if (resize_in_place(memory, record->size, size)) {
+                 canary_arm(memory, size);
+                 record->size = size;
+                 result = RESIZE_DONE;
+             }
+             break;
+         }
+     }
+     cache_unlock(cache);
+     return result;
+ }
+ 
+ static MemoryResizeResult cache_resize_remote(
+     void* memory,
+     size_t size,
+     MemoryBlock* old
+ ) {
+     MemoryResizeResult result = RESIZE_UNTRACKED;
+     TRACKER_LOCK(&g_cache_registry_lock);
+     for (MemoryThreadCache* cache = g_cache_registry;
+          cache && result == RESIZE_UNTRACKED; cache = cache->next) {
+         if (cache != &t_thread_cache) {
+             result = cache_resize_pending(cache, memory, size, old);
+         }
+     }
+     TRACKER_UNLOCK(&g_cache_registry_lock);
+     return result;
+ }
+ 
+ // Keep a freed small block for reuse, spilling half a full magazine
+ static void cache_recycle(void* memory, size_t size) {
+     MemoryThreadCache* cache = thread_cache();
+     unsigned size_class = block_class(size);
+ 
+     if (cache->magazine_count[size_class] == MEMORY_MAGAZINE_SIZE) {
+         magazine_spill(&cache->magazines[size_class][MEMORY_MAGAZINE_SIZE / 2],
+                        MEMORY_MAGAZINE_SIZE / 2);
+         cache->magazine_count[size_class] = MEMORY_MAGAZINE_SIZE / 2;
+     }
+     cache->magazines[size_class][cache->magazine_count[size_class]++] = memory;
+ }
+ 
+ static void flush_all_thread_caches(void) {
+     TRACKER_LOCK(&g_cache_registry_lock);
+     for (MemoryThreadCache* cache = g_cache_registry; cache;
+          cache = cache->next) {
+         cache_lock(cache);
+         cache_flush_locked(cache);
+         cache_unlock(cache);
+     }
+     TRACKER_UNLOCK(&g_cache_registry_lock);
+ }
+ 
+ // Records of blocks allocated before memory_manager_init are forgotten
+ static void discard_pending_records(void) {
+     TRACKER_LOCK(&g_cache_registry_lock);
+     for (MemoryThreadCache* cache = g_cache_registry; cache;
+          cache = cache->next) {
+         cache_lock(cache);
+         cache->pending_count = 0;
+         cache_unlock(cache);
+     }
+     TRACKER_UNLOCK(&g_cache_registry_lock);
+ }
+ 
+ #else
+ 
+ static void flush_all_thread_caches(void) {
+ }
+ 
+ static void discard_pending_records(void) {
+ }
+ 
+ #endif // MEMORY_THREAD_CACHE
+ 
+ static void count_slab_blocks(int64_t blocks, int64_t bytes) {
+ #if MEMORY_THREAD_CACHE
+     MemoryThreadCache* cache = thread_cache();
+     blocks += cache->slab_blocks;
+     bytes += cache->slab_bytes;
+     // Folded counts keep the lock-free estimate of the soft cap close
+     if (blocks >= MEMORY_PENDING_RECORDS || blocks <= -MEMORY_PENDING_RECORDS) {
+         __atomic_add_fetch(&g_slab_live_blocks, blocks, __ATOMIC_RELAXED);
+         __atomic_add_fetch(&g_slab_live_bytes, bytes, __ATOMIC_RELAXED);
+         blocks = 0;
+         bytes = 0;
+     }
+     __atomic_store_n(&cache->slab_blocks, blocks, __ATOMIC_RELAXED);
+     __atomic_store_n(&cache->slab_bytes, bytes, __ATOMIC_RELAXED);
+ #else
+     __atomic_add_fetch(&g_slab_live_blocks, blocks, __ATOMIC_RELAXED);
+     __atomic_add_fetch(&g_slab_live_bytes, bytes, __ATOMIC_RELAXED);
+ #endif
+ }
+ 
+ static void sum_slab_counts(int64_t* blocks, int64_t* bytes) {
+     *blocks = __atomic_load_n(&g_slab_live_blocks, __ATOMIC_RELAXED);
+     *bytes = __atomic_load_n(&g_slab_live_bytes, __ATOMIC_RELAXED);
+ #if MEMORY_THREAD_CACHE
+     TRACKER_LOCK(&g_cache_registry_lock);
+     for (MemoryThreadCache* cache = g_cache_registry; cache;
+          cache = cache->next) {
+         *blocks += __atomic_load_n(&cache->slab_blocks, __ATOMIC_RELAXED);
+         *bytes += __atomic_load_n(&cache->slab_bytes, __ATOMIC_RELAXED);
+     }
+     TRACKER_UNLOCK(&g_cache_registry_lock);
+ #endif
+ }
+ 
+ // Live tracked blocks for the soft cap, without locks or flushing: short
+ // by the records and slab counts threads have not published yet
+ static size_t estimate_block_count(void) {
+     int64_t slab_blocks = __atomic_load_n(&g_slab_live_blocks, __ATOMIC_RELAXED);
+     return sum_block_counts() + (slab_blocks > 0 ? (size_t)slab_blocks : 0);
+ }
+ 
+ // Whether the soft cap, if one is set, has been reached
+ static bool tracker_at_limit(size_t wanted) {
+     size_t limit = __atomic_load_n(&g_block_limit, __ATOMIC_RELAXED);
+     return limit != 0 && estimate_block_count() + wanted > limit;
+ }
+ 
+ static void reset_slab_counts(void) {
+     __atomic_store_n(&g_slab_live_blocks, 0, __ATOMIC_RELAXED);
+     __atomic_store_n(&g_slab_live_bytes, 0, __ATOMIC_RELAXED);
+ #if MEMORY_THREAD_CACHE
+     TRACKER_LOCK(&g_cache_registry_lock);
+     for (MemoryThreadCache* cache = g_cache_registry; cache;
+          cache = cache->next) {
+         __atomic_store_n(&cache->slab_blocks, 0, __ATOMIC_RELAXED);
+         __atomic_store_n(&cache->slab_bytes, 0, __ATOMIC_RELAXED);
+     }
+     TRACKER_UNLOCK(&g_cache_registry_lock);
+ #endif
+ }
+ 
+ // Lifetimes are binned by the freeing thread, like the slab counts
+ static void record_lifetimes(
+     MemoryAllocationType type,
+     uint64_t timestamp,
+     uint64_t count
+ ) {
+     if ((unsigned)type >= MEMORY_TYPE_COUNT) {
+         return;
+     }
+     uint64_t now = get_current_timestamp();
+     uint64_t ticks = now > timestamp ? now - timestamp : 0;
+     unsigned bucket = lifetime_bucket(ticks);
+ 
+ #if MEMORY_THREAD_CACHE
+     MemoryThreadCache* cache = thread_cache();
+     __atomic_store_n(&cache->lifetime_buckets[type][bucket],
+                      cache->lifetime_buckets[type][bucket] + count,
+                      __ATOMIC_RELAXED);
+     __atomic_store_n(&cache->lifetime_ticks[type],
+                      cache->lifetime_ticks[type] + ticks * count,
+                      __ATOMIC_RELAXED);
+ #else
+     __atomic_add_fetch(&g_lifetime_buckets[type][bucket], count, __ATOMIC_RELAXED);
+     __atomic_add_fetch(&g_lifetime_ticks[type], ticks * count, __ATOMIC_RELAXED);
+ #endif
+ }
+ 
+ // Add a change to a delta, raising its peak on growth
+ static void delta_add(MemorySiteDelta* delta, int64_t blocks, int64_t bytes) {
+     delta->operations++;
+     if (blocks > 0 || bytes > 0) {
+         __atomic_store_n(&delta->allocations, delta->allocations + blocks,
+                          __ATOMIC_RELAXED);
+         __atomic_store_n(&delta->allocated_bytes, delta->allocated_bytes + bytes,
+                          __ATOMIC_RELAXED);
+         int64_t net_blocks = delta->allocations - delta->frees;
+         int64_t net_bytes = delta->allocated_bytes - delta->freed_bytes;
+         if (net_blocks > delta->peak_blocks) {
+             __atomic_store_n(&delta->peak_blocks, net_blocks, __ATOMIC_RELAXED);
+         }
+         if (net_bytes > delta->peak_bytes) {
+             __atomic_store_n(&delta->peak_bytes, net_bytes, __ATOMIC_RELAXED);
+         }
+     } else {
+         __atomic_store_n(&delta->frees, delta->frees - blocks, __ATOMIC_RELAXED);
+         __atomic_store_n(&delta->freed_bytes, delta->freed_bytes - bytes,
+                          __ATOMIC_RELAXED);
+     }
+ }
+ 
+ #if MEMORY_THREAD_CACHE
+ static void count_type(
+     MemorySiteDelta* deltas,
+     size_t index,
+     int64_t blocks,
+     int64_t bytes
+ ) {
+     if (deltas[index].operations == MEMORY_SITE_DELTA_BATCH) {
+         type_publish(&g_type_counters[index], &deltas[index]);
+     }
+     delta_add(&deltas[index], blocks, bytes);
+ }
+ #endif
+ 
+ // Per-site counters go through the thread's delta slot for the site, and
+ // the type counters through the thread's deltas for the site's type and
+ // for all types; a resize passes 0 blocks and its byte change
+ static void count_site(uint32_t site_id, int64_t blocks, int64_t bytes) {
+     MemoryAllocationType type = site_record(site_id)->site.type;
+ #if MEMORY_THREAD_CACHE
+     MemoryThreadCache* cache = thread_cache();
+     MemorySiteDelta* delta = &cache->site_deltas[site_id % MEMORY_SITE_DELTA_SLOTS];
+     if (delta->site_id != site_id + 1 ||
+         delta->operations == MEMORY_SITE_DELTA_BATCH) {
+         site_publish(delta);
+         __atomic_store_n(&delta->site_id, site_id + 1, __ATOMIC_RELAXED);
+     }
+     delta_add(delta, blocks, bytes);
+ 
+     if ((unsigned)type < MEMORY_TYPE_COUNT) {
+         count_type(cache->type_deltas, type, blocks, bytes);
+     }
+     count_type(cache->type_deltas, MEMORY_TYPE_COUNT, blocks, bytes);
+ #else
+     MemorySiteDelta delta = { .site_id = site_id + 1 };
+     delta_add(&delta, blocks, bytes);
+     if ((unsigned)type < MEMORY_TYPE_COUNT) {
+         MemorySiteDelta typed = delta;
+         type_publish(&g_type_counters[type], &typed);
+     }
+     MemorySiteDelta all = delta;
+     type_publish(&g_type_counters[MEMORY_TYPE_COUNT], &all);
+     site_publish(&delta);
+ #endif
+ }
+ 
+ // Failures are rare, so they go straight to the shared counters
+ static void count_failures(MemoryAllocationType type, uint64_t count) {
+     if ((unsigned)type < MEMORY_TYPE_COUNT) {
+         __atomic_add_fetch(&g_type_counters[type].failed_allocations, count,
+                            __ATOMIC_RELAXED);
+     }
+     __atomic_add_fetch(&g_type_counters[MEMORY_TYPE_COUNT].failed_allocations,
+                        count, __ATOMIC_RELAXED);
+ }
+ 
+ static void count_failure(MemoryAllocationType type) {
+     count_failures(type, 1);
+ }
+ 
+ // Blocks served past the soft cap, straight to the shared counters
+ static void count_untracked(MemoryAllocationType type) {
+     if ((unsigned)type < MEMORY_TYPE_COUNT) {
+         __atomic_add_fetch(&g_type_counters[type].untracked_allocations, 1,
+                            __ATOMIC_RELAXED);
+     }
+     __atomic_add_fetch(&g_type_counters[MEMORY_TYPE_COUNT].untracked_allocations,
+                        1, __ATOMIC_RELAXED);
+ }
+ 
+ // Whether blocks were served untracked past the soft cap since init
+ static bool served_untracked(void) {
+     return __atomic_load_n(&g_type_counters[MEMORY_TYPE_COUNT].untracked_allocations,
+                            __ATOMIC_RELAXED) != 0;
+ }
+ 
+ // Free-side accounting shared by every tracked release path
+ static void account_free(
+     uint64_t hash,
+     MemoryAllocationType type,
+     uint32_t site_id,
+     size_t size,
+     uint64_t timestamp
+ ) {
+     int64_t weight = block_weight(hash, size, type);
+     record_lifetimes(type, timestamp, (uint64_t)weight);
+     count_site(site_id, -weight, -weight * (int64_t)size);
+ }
+ 
+ // Counter change of a resized block. In sampling mode the resize was
+ // sampled as a new allocation, so a change of weight counts as a free
+ // and an allocation.
+ static void count_resize(
+     uint32_t site_id,
+     MemoryAllocationType type,
+     uint64_t hash,
+     size_t size,
+     uint64_t new_hash,
+     size_t new_size
+ ) {
+     int64_t weight = block_weight(hash, size, type);
+     int64_t new_weight = block_weight(new_hash, new_size, type);
+     if (weight == new_weight) {
+         count_site(site_id, 0, weight * ((int64_t)new_size - (int64_t)size));
+         return;
+     }
+     count_site(site_id, -weight, -weight * (int64_t)size);
+     count_site(site_id, new_weight, new_weight * (int64_t)new_size);
+ }
+ 
+ static void reset_site_deltas(void) {
+ #if MEMORY_THREAD_CACHE
+     TRACKER_LOCK(&g_cache_registry_lock);
+     for (MemoryThreadCache* cache = g_cache_registry; cache;
+          cache = cache->next) {
+         memset(cache->site_deltas, 0, sizeof(cache->site_deltas));
+         memset(cache->type_deltas, 0, sizeof(cache->type_deltas));
+     }
+     TRACKER_UNLOCK(&g_cache_registry_lock);
+ #endif
+ }
+ 
+ static void sum_lifetimes(
+     MemoryAllocationType type,
+     MemoryLifetimeHistogram* histogram
+ ) {
+     for (size_t b = 0; b < MEMORY_LIFETIME_BUCKETS; b++) {
+         histogram->buckets[b] =
+             __atomic_load_n(&g_lifetime_buckets[type][b], __ATOMIC_RELAXED);
+     }
+     histogram->total_ticks = __atomic_load_n(&g_lifetime_ticks[type], __ATOMIC_RELAXED);
+ #if MEMORY_THREAD_CACHE
+     TRACKER_LOCK(&g_cache_registry_lock);
+     for (MemoryThreadCache* cache = g_cache_registry; cache;
+          cache = cache->next) {
+         for (size_t b = 0; b < MEMORY_LIFETIME_BUCKETS; b++) {
+             histogram->buckets[b] += __atomic_load_n(
+                 &cache->lifetime_buckets[type][b], __ATOMIC_RELAXED
+             );
+         }
+         histogram->total_ticks +=
+             __atomic_load_n(&cache->lifetime_ticks[type], __ATOMIC_RELAXED);
+     }
+     TRACKER_UNLOCK(&g_cache_registry_lock);
+ #endif
+ }
+ 
+ static void reset_lifetimes(void) {
+     memset(g_lifetime_buckets, 0, sizeof(g_lifetime_buckets));
+     memset(g_lifetime_ticks, 0, sizeof(g_lifetime_ticks));
+ #if MEMORY_THREAD_CACHE
+     TRACKER_LOCK(&g_cache_registry_lock);
+     for (MemoryThreadCache* cache = g_cache_registry; cache;
+          cache = cache->next) {
+         memset(cache->lifetime_buckets, 0, sizeof(cache->lifetime_buckets));
+         memset(cache->lifetime_ticks, 0, sizeof(cache->lifetime_ticks));
+     }
+     TRACKER_UNLOCK(&g_cache_registry_lock);
+ #endif
+ }
+ 
+ // Hand freed memory back to its heap, the thread cache or the system allocator
+ static void release_memory(void* memory, size_t size) {
+     if (memory_persistent_owns(memory)) {
+         memory_persistent_release(heap_raw(memory),
+                                   storage_size(size) + HEAP_HEADER_SIZE);
+         return;
+     }
+     if (memory_guard_owns(memory)) {
+         memory_guard_release(heap_raw(memory));
+         return;
+     }
+ 
+ #if MEMORY_THREAD_CACHE
+     if (storage_size(size) <= MEMORY_CACHE_MAX_SIZE) {
+         cache_recycle(memory, size);
+         return;
+     }
+ #else
+     (void)size;
+ #endif
+     memory_system_free(heap_raw(memory));
+ }
+ 
+ // Slab objects whose entry has been cleared go back to the cache or slab
+ static void release_slab_object(void* memory, size_t size) {
+ #if MEMORY_THREAD_CACHE
+     cache_recycle(memory, size);
+ #else
+     (void)size;
+     memory_slab_release(&memory, 1);
+ #endif
+ }
+ 
+ // Sampling mode and blocks past the soft cap: untracked blocks are plain
+ // system allocations, marked in header mode so they are told apart
+ // before any lookup
+ static void mark_unsampled(void* memory) {
+ #if MEMORY_HEADER_METADATA
+     __atomic_store_n(&header_of(memory)->magic, MEMORY_HEADER_UNSAMPLED,
+                      __ATOMIC_RELAXED);
+ #else
+     (void)memory;
+ #endif
+ }
+ 
+ static void* unsampled_allocate(size_t size, size_t alignment) {
+     void* memory = heap_allocate(storage_size(size), MEMORY_TYPE_DYNAMIC, alignment);
+     if (memory) {
+         mark_unsampled(memory);
+     }
+     return memory;
+ }
+ 
+ static bool unsampled_block(void* memory) {
+ #if MEMORY_HEADER_METADATA
+     return __atomic_load_n(&header_of(memory)->magic, __ATOMIC_RELAXED) ==
+            MEMORY_HEADER_UNSAMPLED;
+ #else
+     (void)memory;
+     return false;
+ #endif
+ }
+ 
+ // The mark goes before the block does, so the C library never hands out
+ // memory that still reads as unsampled
+ static void unsampled_release(void* memory) {
+ #if MEMORY_HEADER_METADATA
+     __atomic_store_n(&header_of(memory)->magic, 0, __ATOMIC_RELAXED);
+ #endif
+     memory_system_free(heap_raw(memory));
+ }
+ 
+ // Without headers an unsampled block is only known by its missing
+ // record, so sampling mode cannot report stray pointers, nor can a
+ // tracker that served blocks past its soft cap
+ static bool report_untracked(void) {
+     return MEMORY_HEADER_METADATA || (!sampling_enabled() && !served_untracked());
+ }
+ 
+ // Heap memory without a record goes to the C library unless it lies in
+ // the persistent or guard heap. With canaries a stray pointer's layout is
+ // unknown, so only sampling mode's unsampled blocks are released.
+ static void release_untracked(void* memory, const char* filename, int line_number) {
+     bool foreign = !memory_persistent_owns(memory) && !memory_guard_owns(memory);
+     if (report_untracked()) {
+         memory_diagnostic(MEMORY_DIAG_UNTRACKED_FREE, filename, line_number);
+         if (!MEMORY_CANARIES && foreign) {
+             memory_system_free(memory);
+         }
+         return;
+     }
+     if (foreign) {
+         unsampled_release(memory);
+     }
+ }
+ 
+ static bool shard_take(void* memory, uint64_t hash, MemoryBlock* removed) {
+     MemoryTracker* tracker = tracker_shard(hash);
+     TRACKER_LOCK(&tracker->lock);
+     bool tracked = tracker_remove(tracker, memory, hash, removed);
+     TRACKER_UNLOCK(&tracker->lock);
+     return tracked;
+ }
+ 
+ // Remove the tracking record of a heap block wherever it is kept. In
+ // sampling mode every record is in the shards, so unsampled blocks miss
+ // after a single lookup.
+ static bool take_record(void* memory, MemoryBlock* removed) {
+ #if MEMORY_THREAD_CACHE
+     bool pending = !sampling_enabled();
+     // Common case: freed on the allocating thread before being published
+     if (pending && !block_published(memory) &&
+         cache_take_pending(thread_cache(), memory, removed)) {
+         return true;
+     }
+ #endif
+ 
+     uint64_t hash = hash_pointer(memory);
+     bool tracked = shard_take(memory, hash, removed);
+ 
+ #if MEMORY_THREAD_CACHE
+     // The owner may publish the record between the two lookups. Records
+     // only move from caches to shards, so after a remote miss one more
+     // look at the shard is conclusive.
+     if (!tracked && pending) {
+         tracked = cache_take_remote(memory, removed) ||
+                   shard_take(memory, hash, removed);
+     }
+ #endif
+     return tracked;
+ }
+ 
+ static MemoryResizeResult shard_resize(
+     void* memory,
+     uint64_t hash,
+     size_t size,
+     MemoryBlock* old
+ ) {
+     MemoryTracker* tracker = tracker_shard(hash);
+     TRACKER_LOCK(&tracker->lock);
+     MemoryResizeResult result = tracker_resize(tracker, memory, hash, size, old);
+     TRACKER_UNLOCK(&tracker->lock);
+     return result;
+ }
+ 
+ // Resize the record of a heap block wherever it is kept, searched in the
+ // same order as take_record
+ static MemoryResizeResult resize_record(
+     void* memory,
+     size_t size,
+     MemoryBlock* old
+ ) {
+     MemoryResizeResult result;
+ #if MEMORY_THREAD_CACHE
+     bool pending = !sampling_enabled();
+     if (pending && !block_published(memory)) {
+         result = cache_resize_pending(thread_cache(), memory, size, old);
+         if (result != RESIZE_UNTRACKED) {
+             return result;
+         }
+     }
+ #endif
+ 
+     uint64_t hash = hash_pointer(memory);
+     result = shard_resize(memory, hash, size, old);
+ 
+ #if MEMORY_THREAD_CACHE
+     if (result == RESIZE_UNTRACKED && pending) {
+         result = cache_resize_remote(memory, size, old);
+         if (result == RESIZE_UNTRACKED) {
+             result = shard_resize(memory, hash, size, old);
+         }
+     }
+ #endif
+     return result;
+ }
+ 
+ // Filenames are compared by content, as a site set from another file
+ // may see another copy of the literal
+ static bool guard_rule_matches(
+     const MemoryGuardRule* rule,
+     const char* filename,
+     int line_number
+ ) {
+     if (rule->line_number != line_number) {
+         return false;
+     }
+     return line_number == MEMORY_CALLER_LINE ? rule->filename == filename :
+                                                strcmp(rule->filename, filename) == 0;
+ }
+ 
+ // Whether a site matches a guard rule, decided again once the rules change
+ static bool site_guarded(uint32_t site_id) {
+     MemorySiteRecord* record = site_record(site_id);
+     uint32_t epoch = __atomic_load_n(&g_guard_epoch, __ATOMIC_ACQUIRE);
+     uint32_t state = __atomic_load_n(&record->guard_state, __ATOMIC_RELAXED);
+     if (state >> 1 == epoch) {
+         return state & 1;
+     }
+ 
+     bool guarded = false;
+     TRACKER_LOCK(&g_guard_rules_lock);
+     for (size_t i = 0; i < g_guard_site_count && !guarded; i++) {
+         guarded = guard_rule_matches(&g_guard_sites[i], site_key(&record->site),
+                                      record->site.line_number);
+     }
+     epoch = g_guard_epoch;
+     TRACKER_UNLOCK(&g_guard_rules_lock);
+     __atomic_store_n(&record->guard_state, epoch << 1 | guarded, __ATOMIC_RELAXED);
+     return guarded;
+ }
+ 
+ static bool guard_type(MemoryAllocationType type) {
+     return (__atomic_load_n(&g_guard_types, __ATOMIC_RELAXED) >> type) & 1;
+ }
+ 
+ static bool guard_wanted(uint32_t site_id, MemoryAllocationType type) {
+     return guard_type(type) ||
+            (__atomic_load_n(&g_guard_site_count, __ATOMIC_RELAXED) != 0 &&
+             site_guarded(site_id));
+ }
+ 
+ // Storage and tracking record for a block of an interned site; the
+ // caller counts the site on success
+ static void* allocate_tracked(
+     size_t size,
+     size_t alignment,
+     uint32_t site_id,
+     MemoryAllocationType type,
+     uint64_t timestamp,
+     const char* filename,
+     int line_number
+ ) {
+     bool aligned = alignment > MEMORY_MIN_ALIGNMENT;
+ 
+     // Guarded blocks the guard heap cannot take are served like the rest
+     void* memory = guard_wanted(site_id, type) ?
+                    guard_allocate(storage_size(size), alignment) : NULL;
+ 
+     // Small blocks: thread-local magazine, tracking record published later
+ #if MEMORY_THREAD_CACHE
+     if (!memory && storage_size(size) <= MEMORY_CACHE_MAX_SIZE &&
+         type != MEMORY_TYPE_PERSISTENT && !aligned) {
+         memory = cache_allocate(size, site_id, type, timestamp);
+         if (!memory) {
+             memory_diagnostic(MEMORY_DIAG_ALLOCATION_FAILED, filename, line_number);
+             count_failure(type);
+             return NULL;
+         }
+         return memory;
+     }
+ #else
+     // Without the thread cache, dynamic blocks come straight from the slabs
+     if (!memory && storage_size(size) <= MEMORY_SLAB_MAX_OBJECT &&
+         type == MEMORY_TYPE_DYNAMIC && !aligned &&
+         __atomic_load_n(&g_slab_enabled, __ATOMIC_RELAXED)) {
+         if (memory_slab_refill(block_class(size), &memory, 1) == 1) {
+             canary_arm(memory, size);
+             memory_slab_record(memory, size, site_id, type, timestamp);
+             count_slab_blocks(1, (int64_t)size);
+             return memory;
+         }
+     }
+ #endif
+ 
+     // Freed small blocks are recycled by size class, so over-aligned ones
+     // take a whole class
+     if (!memory) {
+         size_t capacity = storage_size(size);
+ #if MEMORY_THREAD_CACHE
+         if (aligned && capacity <= MEMORY_CACHE_MAX_SIZE) {
+             capacity = memory_size_class_bytes(memory_size_class(capacity));
+         }
+ #endif
+         memory = heap_allocate(capacity, type, alignment);
+         if (!memory) {
+             memory_diagnostic(MEMORY_DIAG_ALLOCATION_FAILED, filename, line_number);
+             count_failure(type);
+             return NULL;
+         }
+     }
+     canary_arm(memory, size);
+ 
+     uint64_t hash = hash_pointer(memory);
+     MemoryTracker* tracker = tracker_shard(hash);
+     TRACKER_LOCK(&tracker->lock);
+     bool tracked = tracker_insert(tracker, memory, size, site_id, type, timestamp);
+     TRACKER_UNLOCK(&tracker->lock);
+ 
+     if (!tracked) {
+         memory_diagnostic(MEMORY_DIAG_TRACKER_GROWTH, filename, line_number);
+         release_memory(memory, size);
+         count_failure(type);
+         return NULL;
+     }
+     return memory;
+ }
+ 
+ // Charge a block to this thread's sampling countdown; true when it is to
+ // be tracked. Persistent blocks always are.
+ static bool sample_allocation(size_t size, MemoryAllocationType type) {
+     size_t interval = __atomic_load_n(&g_sample_interval, __ATOMIC_RELAXED);
+     if (interval == 0 || type == MEMORY_TYPE_PERSISTENT) {
+         return true;
+     }
+     t_sample_countdown -= (int64_t)size;
+     if (__builtin_expect(t_sample_countdown > 0, 1)) {
+         return false;
+     }
+ 
+     // A thread's first countdown starts at its first allocation
+     if (t_sample_random == 0) {
+         t_sample_random = ((uint64_t)(uintptr_t)&t_sample_random ^
+                            get_current_timestamp()) * 0x9e3779b97f4a7c15ULL | 1;
+         t_sample_countdown = sample_countdown(interval) - (int64_t)size;
+         if (t_sample_countdown > 0) {
+             return false;
+         }
+     }
+     t_sample_countdown = sample_countdown(interval);
+     return true;
+ }
+ 
+ static void* allocate_block(
+     size_t size,
+     size_t alignment,
+     const char* filename,
+     int line_number,
+     MemoryAllocationType type
+ ) {
+     // Validation checks
+     if (size == 0) {
+         memory_diagnostic(MEMORY_DIAG_ZERO_BYTE, filename, line_number);
+         return NULL;
+     }
+ 
+     // Release builds: direct callers get the system allocator untracked
+ #if !MEMORY_TRACKING_ENABLED
+     (void)filename;
+     (void)line_number;
+     (void)type;
+     if (alignment > MEMORY_MIN_ALIGNMENT) {
+         void* memory;
+         return posix_memalign(&memory, alignment, size) == 0 ? memory : NULL;
+     }
+     return malloc(size);
+ #endif
+ 
+     // Temporary blocks inside an arena scope are bump-allocated and
+     // released in bulk when it is popped, unless the type is guarded;
+     // outside one they are tracked, as DEALLOCATE must release them
+     if (type == MEMORY_TYPE_TEMPORARY && size <= MEMORY_ARENA_MAX_BLOCK &&
+         alignment <= MEMORY_ARENA_ALIGNMENT && !guard_type(type) &&
+         memory_arena_in_scope()) {
+         void* memory = memory_arena_allocate(size);
+         if (memory) {
+             return memory;
+         }
+     }
+ 
+     // Sampling mode: most blocks skip the tracker altogether
+     if (!sample_allocation(size, type)) {
+         void* memory = unsampled_allocate(size, alignment);
+         if (!memory) {
+             memory_diagnostic(MEMORY_DIAG_ALLOCATION_FAILED, filename, line_number);
+             count_failure(type);
+         }
+         return user_pointer(memory);
+     }
+ 
+     // Past the soft cap blocks are still served, untracked and counted
+     if (tracker_at_limit(1)) {
+         memory_diagnostic(MEMORY_DIAG_TRACKER_FULL, filename, line_number);
+         void* memory = unsampled_allocate(size, alignment);
+         if (!memory) {
+             memory_diagnostic(MEMORY_DIAG_ALLOCATION_FAILED, filename, line_number);
+             count_failure(type);
+             return NULL;
+         }
+         count_untracked(type);
+         return user_pointer(memory);
+     }
+ 
+     uint32_t site_id = intern_allocation_site(filename, line_number, type);
+     if (site_id == MEMORY_NO_SLOT) {
+         memory_diagnostic(MEMORY_DIAG_SITE_TABLE_FULL, filename, line_number);
+         count_failure(type);
+         return NULL;
+     }
+ 
+     void* memory = allocate_tracked(size, alignment, site_id, type,
+                                     get_current_timestamp(), filename, line_number);
+     if (memory) {
+         int64_t weight = block_weight(hash_pointer(memory), size, type);
+         count_site(site_id, weight, weight * (int64_t)size);
+     }
+     return user_pointer(memory);
+ }
+ 
+ void* safe_memory_allocate(
+     size_t size, 
+     const char* filename, 
+     int line_number, 
+     MemoryAllocationType type
+ ) {
+     TRACE_ENTRY();
+     return allocate_block(size, MEMORY_MIN_ALIGNMENT, filename, line_number, type);
+ }
+ 
+ void* safe_memory_aligned_allocate(
+     size_t alignment,
+     size_t size,
+     const char* filename,
+     int line_number,
+     MemoryAllocationType type
+ ) {
+     if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+         memory_diagnostic(MEMORY_DIAG_BAD_ALIGNMENT, filename, line_number);
+         count_failure(type);
+         return NULL;
+     }
+     TRACE_ENTRY();
+     return allocate_block(size, alignment, filename, line_number, type);
+ }
+ 
+ void* safe_memory_callocate(
+     size_t count,
+     size_t size,
+     const char* filename,
+     int line_number,
+     MemoryAllocationType type
+ ) {
+     size_t total;
+     if (__builtin_mul_overflow(count, size, &total)) {
+         memory_diagnostic(MEMORY_DIAG_SIZE_OVERFLOW, filename, line_number);
+         count_failure(type);
+         return NULL;
+     }
+ 
+     TRACE_ENTRY();
+     void* memory = allocate_block(total, MEMORY_MIN_ALIGNMENT, filename,
+                                   line_number, type);
+     if (memory) {
+         memset(memory, 0, total);
+     }
+     return memory;
+ }
+ 
+ // Slab objects keep their entry while they stay in their size class
+ static void* reallocate_slab(
+     void* memory,
+     size_t size,
+     const char* filename,
+     int line_number
+ ) {
+     MemorySlabEntry entry = memory_slab_entry(memory);
+     if (entry.size == 0) {
+         memory_diagnostic(MEMORY_DIAG_UNTRACKED_REALLOC, filename, line_number);
+         return NULL;
+     }
+ 
+     canary_verify(memory, entry.size, entry.site_id);
+     MemoryAllocationType type = (MemoryAllocationType)entry.type;
+     if (storage_size(size) <= MEMORY_SLAB_MAX_OBJECT &&
+         block_class(size) == block_class(entry.size)) {
+         canary_arm(memory, size);
+         memory_slab_record(memory, size, entry.site_id, type, entry.timestamp);
+         count_slab_blocks(0, (int64_t)size - (int64_t)entry.size);
+         uint64_t hash = hash_pointer(memory);
+         count_resize(entry.site_id, type, hash, entry.size, hash, size);
+         return memory;
+     }
+ 
+     void* moved = allocate_tracked(size, MEMORY_MIN_ALIGNMENT, entry.site_id,
+                                    type, entry.timestamp, filename, line_number);
+     if (!moved) {
+         return NULL;
+     }
+     memcpy(user_pointer(moved), user_pointer(memory),
+            size < entry.size ? size : entry.size);
+     memory_slab_clear(memory);
+     count_slab_blocks(-1, -(int64_t)entry.size);
+     count_resize(entry.site_id, type, hash_pointer(memory), entry.size,
+                  hash_pointer(moved), size);
+     release_slab_object(memory, entry.size);
+     return moved;
+ }
+ 
+ // Sampling mode: a slab object the resize left unsampled moves to the
+ // system allocator, counted as freed
+ static void* unsample_slab(
+     void* memory,
+     size_t size,
+     const char* filename,
+     int line_number
+ ) {
+     MemorySlabEntry entry = memory_slab_entry(memory);
+     if (entry.size == 0) {
+         memory_diagnostic(MEMORY_DIAG_UNTRACKED_REALLOC, filename, line_number);
+         return NULL;
+     }
+ 
+     canary_verify(memory, entry.size, entry.site_id);
+     MemoryAllocationType type = (MemoryAllocationType)entry.type;
+     void* moved = unsampled_allocate(size, MEMORY_MIN_ALIGNMENT);
+     if (!moved) {
+         memory_diagnostic(MEMORY_DIAG_ALLOCATION_FAILED, filename, line_number);
+         count_failure(type);
+         return NULL;
+     }
+     memcpy(user_pointer(moved), user_pointer(memory),
+            size < entry.size ? size : entry.size);
+     memory_slab_clear(memory);
+     count_slab_blocks(-1, -(int64_t)entry.size);
+     account_free(hash_pointer(memory), type, entry.site_id, entry.size,
+                  entry.timestamp);
+     release_slab_object(memory, entry.size);
+     return moved;
+ }
+ 
+ // Sampling mode: an unsampled block the resize sampled joins the tracker
+ // under the resizing call site, as a new dynamic block would. It keeps
+ // the C library block, grown to a whole size class if it is class-sized.
+ static void* adopt_unsampled(
+     void* memory,
+     size_t size,
+     const char* filename,
+     int line_number
+ ) {
+     // Past the soft cap the block stays untracked
+     if (tracker_at_limit(1)) {
+         return heap_reallocate(memory, storage_size(size));
+     }
+ 
+     size_t capacity = storage_size(size);
+ #if MEMORY_THREAD_CACHE
+     if (capacity <= MEMORY_CACHE_MAX_SIZE) {
+         capacity = memory_size_class_bytes(memory_size_class(capacity));
+     }
+ #endif
+     void* resized = heap_reallocate(memory, capacity);
+     if (!resized) {
+         memory_diagnostic(MEMORY_DIAG_ALLOCATION_FAILED, filename, line_number);
+         count_failure(MEMORY_TYPE_DYNAMIC);
+         return NULL;
+     }
+ 
+     uint32_t site_id = intern_allocation_site(filename, line_number,
+                                               MEMORY_TYPE_DYNAMIC);
+     if (site_id == MEMORY_NO_SLOT) {
+         memory_diagnostic(MEMORY_DIAG_SITE_TABLE_FULL, filename, line_number);
+         return resized;
+     }
+     canary_arm(resized, size);
+     uint64_t hash = hash_pointer(resized);
+     MemoryTracker* tracker = tracker_shard(hash);
+     TRACKER_LOCK(&tracker->lock);
+     bool tracked = tracker_insert(tracker, resized, size, site_id,
+                                   MEMORY_TYPE_DYNAMIC, get_current_timestamp());
+     TRACKER_UNLOCK(&tracker->lock);
+     if (!tracked) {
+         memory_diagnostic(MEMORY_DIAG_TRACKER_GROWTH, filename, line_number);
+         return resized;
+     }
+ 
+     int64_t weight = block_weight(hash, size, MEMORY_TYPE_DYNAMIC);
+     count_site(site_id, weight, weight * (int64_t)size);
+     return resized;
+ }
+ 
+ // Heap blocks keep their call site, type and timestamp wherever they end up
+ static void* reallocate_heap(
+     void* memory,
+     size_t size,
+     const char* filename,
+     int line_number
+ ) {
+     // The old address keys the weight counted for the block even after
+     // realloc moves it
+     uint64_t hash = hash_pointer(memory);
+     MemoryBlock block;
+     switch (resize_record(memory, size, &block)) {
+     case RESIZE_UNTRACKED:
+         if (memory_persistent_owns(memory) || memory_guard_owns(memory)) {
+             memory_diagnostic(MEMORY_DIAG_UNTRACKED_REALLOC, filename, line_number);
+             return NULL;
+         }
+         // Sampling mode without headers: an unsampled block the resize sampled
+         if (!report_untracked()) {
+             return adopt_unsampled(memory, size, filename, line_number);
+         }
+         // Untracked memory goes to the C library, as in safe_memory_free
+         memory_diagnostic(MEMORY_DIAG_UNTRACKED_REALLOC, filename, line_number);
+         if (MEMORY_CANARIES) {
+             return NULL;
+         }
+         return memory_system_realloc(memory, size);
+ 
+     case RESIZE_FAILED:
+         memory_diagnostic(MEMORY_DIAG_ALLOCATION_FAILED, filename, line_number);
+         count_failure(block.type);
+         return NULL;
+ 
+     case RESIZE_MOVE: {
+         void* moved = allocate_tracked(size, MEMORY_MIN_ALIGNMENT, block.site_id,
+                                        block.type, block.timestamp, filename,
+                                        line_number);
+         if (!moved) {
+             return NULL;
+         }
+         memcpy(user_pointer(moved), user_pointer(memory),
+                size < block.size ? size : block.size);
+         if (take_record(memory, &block)) {
+             release_memory(memory, block.size);
+         }
+         block.pointer = moved;
+         break;
+     }
+ 
+     case RESIZE_REHOME: {
+         canary_arm(block.pointer, size);
+         uint64_t hash = hash_pointer(block.pointer);
+         MemoryTracker* tracker = tracker_shard(hash);
+         TRACKER_LOCK(&tracker->lock);
+         bool tracked = tracker_insert(tracker, block.pointer, size, block.site_id,
+                                       block.type, block.timestamp);
+         TRACKER_UNLOCK(&tracker->lock);
+         if (!tracked) {
+             // The data already moved; hand it back untracked
+             memory_diagnostic(MEMORY_DIAG_TRACKER_GROWTH, filename, line_number);
+             account_free(hash, block.type, block.site_id, block.size,
+                          block.timestamp);
+             mark_unsampled(block.pointer);
+             return block.pointer;
+         }
+         break;
+     }
+ 
+     case RESIZE_DONE:
+         break;
+     }
+ 
+     count_resize(block.site_id, block.type, hash, block.size,
+                  hash_pointer(block.pointer), size);
+     return block.pointer;
+ }
+ 
+ // Sampling mode: a tracked heap block the resize left unsampled drops
+ // its record, counted as freed, and is resized by the C library.
+ // Persistent blocks keep theirs.
+ static void* unsample_heap(
+     void* memory,
+     size_t size,
+     const char* filename,
+     int line_number
+ ) {
+     MemoryBlock removed;
+     if (!take_record(memory, &removed)) {
+         if (report_untracked()) {
+             memory_diagnostic(MEMORY_DIAG_UNTRACKED_REALLOC, filename, line_number);
+             return MEMORY_CANARIES ? NULL : memory_system_realloc(memory, size);
+         }
+         return heap_reallocate(memory, storage_size(size));
+     }
+     canary_verify(memory, removed.size, removed.site_id);
+     if (removed.type == MEMORY_TYPE_PERSISTENT) {
+         uint64_t hash = hash_pointer(memory);
+         MemoryTracker* tracker = tracker_shard(hash);
+         TRACKER_LOCK(&tracker->lock);
+         bool tracked = tracker_insert(tracker, memory, removed.size, removed.site_id,
+                                       removed.type, removed.timestamp);
+         TRACKER_UNLOCK(&tracker->lock);
+         if (tracked) {
+             return reallocate_heap(memory, size, filename, line_number);
+         }
+         memory_diagnostic(MEMORY_DIAG_TRACKER_GROWTH, filename, line_number);
+     }
+ 
+     account_free(hash_pointer(memory), removed.type, removed.site_id,
+                  removed.size, removed.timestamp);
+     mark_unsampled(memory);
+     return heap_reallocate(memory, storage_size(size));
+ }
+ 
+ void* safe_memory_reallocate(
+     void* memory,
+     size_t size,
+     const char* filename,
+     int line_number
+ ) {
+     TRACE_ENTRY();
+     if (!memory) {
+         return allocate_block(size, MEMORY_MIN_ALIGNMENT, filename, line_number,
+                               MEMORY_TYPE_DYNAMIC);
+     }
+     if (size == 0) {
+         safe_memory_free(memory, filename, line_number);
+         return NULL;
+     }
+ 
+ #if !MEMORY_TRACKING_ENABLED
+     return realloc(memory, size);
+ #endif
+ 
+     // Arena blocks: the newest grows in place, others are copied out and
+     // left for memory_arena_pop like any arena block. Their sizes are not
+     // kept, so a block that grows gets whatever followed it in its chunk
+     // past the old size.
+     if (memory_arena_owns(memory)) {
+         if (memory_arena_resize(memory, size)) {
+             return memory;
+         }
+         size_t extent = memory_arena_extent(memory);
+         void* moved = allocate_block(size, MEMORY_MIN_ALIGNMENT, filename,
+                                      line_number, MEMORY_TYPE_TEMPORARY);
+         if (moved) {
+             memcpy(moved, memory, size < extent ? size : extent);
+         }
+         return moved;
+     }
+ 
+     // Sampling mode samples the new size afresh, so a tracked block always
+     // stands for 1 / P(sampled) blocks of its current size; blocks move
+     // into or out of the tracker as the draw decides, save persistent and
+     // guarded ones
+     memory = storage_pointer(memory);
+     bool sampled = memory_persistent_owns(memory) || memory_guard_owns(memory) ||
+                    !sampling_enabled() || sample_allocation(size, MEMORY_TYPE_DYNAMIC);
+ 
+     void* resized;
+     if (memory_slab_owns(memory)) {
+         resized = sampled ? reallocate_slab(memory, size, filename, line_number) :
+                             unsample_slab(memory, size, filename, line_number);
+     } else if (unsampled_block(memory)) {
+         resized = sampled ? adopt_unsampled(memory, size, filename, line_number) :
+                             heap_reallocate(memory, storage_size(size));
+     } else if (!sampled) {
+         resized = unsample_heap(memory, size, filename, line_number);
+     } else {
+         resized = reallocate_heap(memory, size, filename, line_number);
+     }
+     return user_pointer(resized);
+ }
+ 
+ 
+ void safe_memory_free(
+     void* memory, 
+     const char* filename, 
+     int line_number
+ ) {
+     if (!memory) {
+         memory_diagnostic(MEMORY_DIAG_NULL_FREE, filename, line_number);
+         return;
+     }
+ 
+ #if !MEMORY_TRACKING_ENABLED
+     free(memory);
+     return;
+ #endif
+ 
+     // Arena blocks are released by memory_arena_pop/reset, not one by one
+     if (memory_arena_owns(memory)) {
+         return;
+     }
+ 
+     // Slab objects: the header entry is the tracking record. A block with
+     // a broken canary is accounted for but never reused.
+     memory = storage_pointer(memory);
+     if (memory_slab_owns(memory)) {
+         MemorySlabEntry entry = memory_slab_clear(memory);
+         if (entry.size == 0) {
+             memory_diagnostic(MEMORY_DIAG_UNTRACKED_FREE, filename, line_number);
+             return;
+         }
+         count_slab_blocks(-1, -(int64_t)entry.size);
+         account_free(hash_pointer(memory), (MemoryAllocationType)entry.type,
+                      entry.site_id, entry.size, entry.timestamp);
+         if (canary_verify(memory, entry.size, entry.site_id)) {
+             release_slab_object(memory, entry.size);
+         }
+         return;
+     }
+ 
+     if (unsampled_block(memory)) {
+         unsampled_release(memory);
+         return;
+     }
+ 
+     MemoryBlock removed;
+     if (take_record(memory, &removed)) {
+         account_free(hash_pointer(memory), removed.type, removed.site_id,
+                      removed.size, removed.timestamp);
+         if (canary_verify(memory, removed.size, removed.site_id)) {
+             release_memory(memory, removed.size);
+         }
+         return;
+     }
+     release_untracked(memory, filename, line_number);
+ }
+ 
+ // Track heap blocks of one site, locking each shard once per chunk;
+ // blocks the tracker cannot take are released and set to NULL. Returns
+ // the number lost.
+ static size_t tracker_insert_batch(
+     void** objects,
+     size_t count,
+     size_t size,
+     uint32_t site_id,
+     MemoryAllocationType type,
+     uint64_t timestamp
+ ) {
+     uint8_t shards[MEMORY_BATCH_CHUNK];
+     uint16_t order[MEMORY_BATCH_CHUNK];
+     size_t lost = 0;
+ 
+     for (size_t base = 0; base < count; base += MEMORY_BATCH_CHUNK) {
+         size_t chunk = count - base < MEMORY_BATCH_CHUNK ?
+                        count - base : MEMORY_BATCH_CHUNK;
+         void** memory = objects + base;
+         for (size_t i = 0; i < chunk; i++) {
+             shards[i] = (uint8_t)shard_index(hash_pointer(memory[i]));
+         }
+         order_by_shard(shards, chunk, order);
+ 
+         size_t i = 0;
+         while (i < chunk) {
+             unsigned shard = shards[order[i]];
+             MemoryTracker* tracker = &g_memory_shards[shard];
+             TRACKER_LOCK(&tracker->lock);
+             for (; i < chunk && shards[order[i]] == shard; i++) {
+                 void** entry = &memory[order[i]];
+                 if (!tracker_insert(tracker, *entry, size, site_id, type,
+                                     timestamp)) {
+                     release_memory(*entry, size);
+                     *entry = NULL;
+                     lost++;
+                 }
+             }
+             TRACKER_UNLOCK(&tracker->lock);
+         }
+     }
+     return lost;
+ }
+ 
+ // Batch form of allocate_tracked; returns the blocks stored at the front
+ // of objects
+ static size_t allocate_tracked_batch(
+     size_t size,
+     size_t count,
+     void** objects,
+     uint32_t site_id,
+     MemoryAllocationType type,
+     uint64_t timestamp,
+     const char* filename,
+     int line_number
+ ) {
+     size_t done = 0;
+ 
+     // Guarded blocks each take pages of their own
+     if (guard_wanted(site_id, type)) {
+         for (size_t i = 0; i < count; i++) {
+             void* memory = allocate_tracked(size, MEMORY_MIN_ALIGNMENT, site_id, type,
+                                             timestamp, filename, line_number);
+             if (memory) {
+                 objects[done++] = memory;
+             }
+         }
+         return done;
+     }
+ 
+ #if MEMORY_THREAD_CACHE
+     if (storage_size(size) <= MEMORY_CACHE_MAX_SIZE && type != MEMORY_TYPE_PERSISTENT) {
+         done = cache_allocate_batch(size, count, objects, site_id, type,
+                                     timestamp);
+         if (done < count) {
+             memory_diagnostic(MEMORY_DIAG_ALLOCATION_FAILED, filename, line_number);
+             count_failures(type, count - done);
+         }
+         return done;
+     }
+ #else
+     if (storage_size(size) <= MEMORY_SLAB_MAX_OBJECT && type == MEMORY_TYPE_DYNAMIC &&
+         __atomic_load_n(&g_slab_enabled, __ATOMIC_RELAXED)) {
+         done = memory_slab_refill(block_class(size), objects, count);
+         for (size_t i = 0; i < done; i++) {
+             canary_arm(objects[i], size);
+             memory_slab_record(objects[i], size, site_id, type, timestamp);
+         }
+         count_slab_blocks((int64_t)done, (int64_t)(done * size));
+     }
+ #endif
+ 
+     size_t first = done;
+     while (done < count) {
+         void* memory = heap_allocate(storage_size(size), type, MEMORY_MIN_ALIGNMENT);
+         if (!memory) {
+             memory_diagnostic(MEMORY_DIAG_ALLOCATION_FAILED, filename, line_number);
+             break;
+         }
+         canary_arm(memory, size);
+         objects[done++] = memory;
+     }
+ 
+     size_t lost = tracker_insert_batch(objects + first, done - first, size,
+                                        site_id, type, timestamp);
+     if (lost > 0) {
+         memory_diagnostic(MEMORY_DIAG_TRACKER_GROWTH, filename, line_number);
+         size_t kept = first;
+         for (size_t i = first; i < done; i++) {
+             if (objects[i]) {
+                 objects[kept++] = objects[i];
+             }
+         }
+         done = kept;
+     }
+ 
+     if (done < count) {
+         count_failures(type, count - done);
+     }
+     return done;
+ }
+ 
+ size_t safe_memory_allocate_batch(
+     size_t count,
+     size_t size,
+     void** objects,
+     const char* filename,
+     int line_number,
+     MemoryAllocationType type
+ ) {
+     // Validation checks
+     if (size == 0) {
+         if (count > 0) {
+             memory_diagnostic(MEMORY_DIAG_ZERO_BYTE, filename, line_number);
+         }
+         for (size_t i = 0; i < count; i++) {
+             objects[i] = NULL;
+         }
+         return 0;
+     }
+ 
+ #if !MEMORY_TRACKING_ENABLED
+     (void)type;
+     return memory_malloc_batch(count, size, objects);
+ #endif
+ 
+     // A batch of one has nothing to share
+     TRACE_ENTRY();
+     if (count == 1) {
+         objects[0] = allocate_block(size, MEMORY_MIN_ALIGNMENT, filename,
+                                     line_number, type);
+         return objects[0] != NULL;
+     }
+ 
+     // Sampling mode: each block is sampled on its own and few are tracked
+     size_t done = 0;
+     if (sampling_enabled() && type != MEMORY_TYPE_PERSISTENT) {
+         while (done < count && (objects[done] = allocate_block(
+                    size, MEMORY_MIN_ALIGNMENT, filename, line_number, type)) != NULL) {
+             done++;
+         }
+         for (size_t i = done; i < count; i++) {
+             objects[i] = NULL;
+         }
+         return done;
+     }
+ 
+     // Temporary blocks in a scope: the arena is already a bump per block
+     if (type == MEMORY_TYPE_TEMPORARY && size <= MEMORY_ARENA_MAX_BLOCK &&
+         !guard_type(type) && memory_arena_in_scope()) {
+         while (done < count && (objects[done] = memory_arena_allocate(size)) != NULL) {
+             done++;
+         }
+     }
+ 
+     // A batch that crosses the soft cap goes block by block, so the
+     // blocks past it are served untracked
+     if (done < count && tracker_at_limit(count - done)) {
+         while (done < count && (objects[done] = allocate_block(
+                    size, MEMORY_MIN_ALIGNMENT, filename, line_number, type)) != NULL) {
+             done++;
+         }
+     }
+ 
+     if (done < count) {
+         size_t wanted = count - done;
+         uint32_t site_id = intern_allocation_site(filename, line_number, type);
+         if (site_id == MEMORY_NO_SLOT) {
+             memory_diagnostic(MEMORY_DIAG_SITE_TABLE_FULL, filename, line_number);
+             count_failures(type, wanted);
+         } else {
+             size_t tracked = allocate_tracked_batch(
+                 size, wanted, objects + done, site_id, type,
+                 get_current_timestamp(), filename, line_number
+             );
+             if (tracked > 0) {
+                 count_site(site_id, (int64_t)tracked, (int64_t)(tracked * size));
+             }
+             for (size_t i = done; i < done + tracked; i++) {
+                 objects[i] = user_pointer(objects[i]);
+             }
+             done += tracked;
+         }
+     }
+ 
+     for (size_t i = done; i < count; i++) {
+         objects[i] = NULL;
+     }
+     return done;
+ }
+ 
+ // Frees of one site and allocation timestamp in a row, as a batch
+ // allocation leaves them, are counted together
+ typedef struct {
+     MemoryAllocationType type;
+     uint32_t site_id;
+     uint64_t timestamp;
+     int64_t blocks;
+     int64_t bytes;
+ } MemoryFreeRun;
+ 
+ static void free_run_flush(MemoryFreeRun* run) {
+     if (run->blocks > 0) {
+         record_lifetimes(run->type, run->timestamp, (uint64_t)run->blocks);
+         count_site(run->site_id, -run->blocks, -run->bytes);
+         run->blocks = 0;
+         run->bytes = 0;
+     }
+ }
+ 
+ static void free_run_add(
+     MemoryFreeRun* run,
+     const void* memory,
+     MemoryAllocationType type,
+     uint32_t site_id,
+     size_t size,
+     uint64_t timestamp
+ ) {
+     if (run->blocks > 0 && (run->site_id != site_id ||
+                             run->timestamp != timestamp || run->type != type)) {
+         free_run_flush(run);
+     }
+     int64_t weight = block_weight(hash_pointer(memory), size, type);
+     run->type = type;
+     run->site_id = site_id;
+     run->timestamp = timestamp;
+     run->blocks += weight;
+     run->bytes += weight * (int64_t)size;
+ }
+ 
+ // Batch form of take_record for up to MEMORY_BATCH_CHUNK heap blocks;
+ // untracked entries come back with a NULL pointer
+ static void take_records_batch(
+     void* const* memory,
+     size_t count,
+     MemoryBlock* removed
+ ) {
+     uint16_t lookup[MEMORY_BATCH_CHUNK];
+     uint64_t hashes[MEMORY_BATCH_CHUNK];
+     uint8_t shards[MEMORY_BATCH_CHUNK] = { 0 };
+     uint16_t order[MEMORY_BATCH_CHUNK];
+     size_t missing = 0;
+ 
+ #if MEMORY_THREAD_CACHE
+     MemoryThreadCache* cache = thread_cache();
+     cache_lock(cache);
+     for (size_t i = 0; i < count; i++) {
+         removed[i].pointer = NULL;
+         if (cache->pending_count == 0 || block_published(memory[i]) ||
+             !pending_take_locked(cache, memory[i], &removed[i])) {
+             lookup[missing++] = (uint16_t)i;
+         }
+     }
+     cache_unlock(cache);
+ #else
+     for (size_t i = 0; i < count; i++) {
+         removed[i].pointer = NULL;
+         lookup[missing++] = (uint16_t)i;
+     }
+ #endif
+ 
+     for (size_t k = 0; k < missing; k++) {
+         hashes[k] = hash_pointer(memory[lookup[k]]);
+         shards[k] = (uint8_t)shard_index(hashes[k]);
+     }
+     order_by_shard(shards, missing, order);
+ 
+     size_t k = 0;
+     while (k < missing) {
+         unsigned shard = shards[order[k]];
+         MemoryTracker* tracker = &g_memory_shards[shard];
+         TRACKER_LOCK(&tracker->lock);
+         for (; k < missing && shards[order[k]] == shard; k++) {
+             size_t i = lookup[order[k]];
+             if (!tracker_remove(tracker, memory[i], hashes[order[k]], &removed[i])) {
+                 removed[i].pointer = NULL;
+             }
+         }
+         TRACKER_UNLOCK(&tracker->lock);
+     }
+ 
+ #if MEMORY_THREAD_CACHE
+     // As in take_record, a remote miss is settled by a second shard lookup
+     for (size_t m = 0; m < missing && !sampling_enabled(); m++) {
+         size_t i = lookup[m];
+         if (!removed[i].pointer && !cache_take_remote(memory[i], &removed[i]) &&
+             !shard_take(memory[i], hashes[m], &removed[i])) {
+             removed[i].pointer = NULL;
+         }
+     }
+ #endif
+ }
+ 
+ static void free_batch_chunk(
+     void* const* objects,
+     size_t count,
+     const char* filename,
+     int line_number
+ ) {
+     void* heap[MEMORY_BATCH_CHUNK];
+     MemoryBlock removed[MEMORY_BATCH_CHUNK];
+     size_t heap_count = 0;
+     MemoryFreeRun run = { .blocks = 0 };
+     int64_t slab_blocks = 0;
+     int64_t slab_bytes = 0;
+ #if !MEMORY_THREAD_CACHE
+     // Slab objects go back one size class run at a time
+     void* slab_objects[MEMORY_BATCH_CHUNK];
+     size_t slab_count = 0;
+     size_t slab_usable = 0;
+ #endif
+ 
+     for (size_t i = 0; i < count; i++) {
+         void* memory = objects[i];
+         if (!memory) {
+             memory_diagnostic(MEMORY_DIAG_NULL_FREE, filename, line_number);
+             continue;
+         }
+         if (memory_arena_owns(memory)) {
+             continue;
+         }
+         memory = storage_pointer(memory);
+         if (!memory_slab_owns(memory)) {
+             if (unsampled_block(memory)) {
+                 unsampled_release(memory);
+             } else {
+                 heap[heap_count++] = memory;
+             }
+             continue;
+         }
+ 
+         MemorySlabEntry entry = memory_slab_clear(memory);
+         if (entry.size == 0) {
+             memory_diagnostic(MEMORY_DIAG_UNTRACKED_FREE, filename, line_number);
+             continue;
+         }
+         slab_blocks++;
+         slab_bytes += entry.size;
+         free_run_add(&run, memory, (MemoryAllocationType)entry.type,
+                      entry.site_id, entry.size, entry.timestamp);
+         if (!canary_verify(memory, entry.size, entry.site_id)) {
+             continue;
+         }
+ #if MEMORY_THREAD_CACHE
+         cache_recycle(memory, entry.size);
+ #else
+         size_t usable = memory_slab_usable_size(memory);
+         if (slab_count > 0 && usable != slab_usable) {
+             memory_slab_release(slab_objects, slab_count);
+             slab_count = 0;
+         }
+         slab_usable = usable;
+         slab_objects[slab_count++] = memory;
+ #endif
+     }
+ #if !MEMORY_THREAD_CACHE
+     if (slab_count > 0) {
+         memory_slab_release(slab_objects, slab_count);
+     }
+ #endif
+     if (slab_blocks > 0) {
+         count_slab_blocks(-slab_blocks, -slab_bytes);
+     }
+ 
+     take_records_batch(heap, heap_count, removed);
+     for (size_t i = 0; i < heap_count; i++) {
+         if (!removed[i].pointer) {
+             release_untracked(heap[i], filename, line_number);
+             continue;
+         }
+         free_run_add(&run, heap[i], removed[i].type, removed[i].site_id,
+                      removed[i].size, removed[i].timestamp);
+         if (canary_verify(heap[i], removed[i].size, removed[i].site_id)) {
+             release_memory(heap[i], removed[i].size);
+         }
+     }
+     free_run_flush(&run);
+ }
+ 
+ void safe_memory_free_batch(
+     void* const* objects,
+     size_t count,
+     const char* filename,
+     int line_number
+ ) {
+ #if !MEMORY_TRACKING_ENABLED
+     (void)filename;
+     (void)line_number;
+     memory_free_batch(objects, count);
+     return;
+ #endif
+ 
+     if (count == 1) {
+         safe_memory_free(objects[0], filename, line_number);
+         return;
+     }
+     for (size_t base = 0; base < count; base += MEMORY_BATCH_CHUNK) {
+         size_t chunk = count - base < MEMORY_BATCH_CHUNK ?
+                        count - base : MEMORY_BATCH_CHUNK;
+         free_batch_chunk(objects + base, chunk, filename, line_number);
+     }
+ }
+ 
+ void memory_manager_flush_thread_cache(void) {
+ #if MEMORY_THREAD_CACHE
+     MemoryThreadCache* cache = thread_cache();
+     cache_lock(cache);
+     cache_flush_locked(cache);
+     cache_unlock(cache);
+ #endif
+ }
+ 
+ const MemoryCallSite* memory_manager_get_site(uint32_t site_id) {
+     if (site_id >= __atomic_load_n(&g_site_table.count, __ATOMIC_ACQUIRE)) {
+         return NULL;
+     }
+     return &site_record(site_id)->site;
+ }
+ 
+ void memory_manager_set_slab_backend(bool enabled) {
+     __atomic_store_n(&g_slab_enabled, enabled, __ATOMIC_RELAXED);
+ }
+ 
+ // Records still pending when sampling starts are published first, since
+ // sampling mode looks for records in the shards only
+ void memory_manager_set_sample_interval(size_t interval) {
+     flush_all_thread_caches();
+     __atomic_store_n(&g_sample_interval, interval, __ATOMIC_RELAXED);
+ }
+ 
+ void memory_manager_set_trace_depth(unsigned depth) {
+     if (depth > MEMORY_TRACE_MAX_DEPTH) {
+         depth = MEMORY_TRACE_MAX_DEPTH;
+     }
+     if (depth != 0) {
+         memory_trace_prepare();
+     }
+     __atomic_store_n(&g_trace_depth, depth, __ATOMIC_RELAXED);
+ }
+ 
+ void memory_manager_set_guard_type(MemoryAllocationType type, bool enabled) {
+     if (enabled) {
+         __atomic_or_fetch(&g_guard_types, 1u << type, __ATOMIC_RELAXED);
+     } else {
+         __atomic_and_fetch(&g_guard_types, ~(1u << type), __ATOMIC_RELAXED);
+     }
+ }
+ 
+ // Sites decide again under the next epoch, so blocks allocated from now
+ // on follow the new rules
+ bool memory_manager_set_guard_site(const char* filename, int line_number, bool enabled) {
+     TRACKER_LOCK(&g_guard_rules_lock);
+     size_t count = g_guard_site_count;
+     size_t i = 0;
+     while (i < count && !guard_rule_matches(&g_guard_sites[i], filename, line_number)) {
+         i++;
+     }
+     bool done = true;
+     if (!enabled && i < count) {
+         g_guard_sites[i] = g_guard_sites[--count];
+     } else if (enabled && i == count) {
+         done = count < MEMORY_GUARD_MAX_SITES;
+         if (done) {
+             g_guard_sites[count++] = (MemoryGuardRule){ filename, line_number };
+         }
+     }
+     __atomic_store_n(&g_guard_site_count, count, __ATOMIC_RELAXED);
+     __atomic_store_n(&g_guard_epoch, g_guard_epoch + 1, __ATOMIC_RELEASE);
+     TRACKER_UNLOCK(&g_guard_rules_lock);
+     return done;
+ }
+ 
+ void memory_manager_set_guard_quarantine(size_t bytes) {
+     memory_guard_set_quarantine(bytes);
+ }
+ 
+ int memory_manager_format_site(
+     const MemoryCallSite* site,
+     char* buffer,
+     size_t size
+ ) {
+     if (site->line_number != MEMORY_CALLER_LINE) {
+         return snprintf(buffer, size, "%s:%d",
+                         site->filename ? site->filename : "unknown",
+                         site->line_number);
+     }
+ 
+     return memory_manager_format_address(site->caller, buffer, size);
+ }
+ 
+ int memory_manager_format_address(const void* address, char* buffer, size_t size) {
+     // Offsets from the object's load address survive ASLR
+     Dl_info info;
+     if (!dladdr(address, &info) || !info.dli_fname) {
+         return snprintf(buffer, size, "%p", address);
+     }
+     const char* object = strrchr(info.dli_fname, '/');
+     object = object ? object + 1 : info.dli_fname;
+     int length = snprintf(buffer, size, "%s+0x%zx", object,
+                           (size_t)((uintptr_t)address - (uintptr_t)info.dli_fbase));
+     if (info.dli_sname && length >= 0) {
+         size_t used = (size_t)length < size ? (size_t)length : size;
+         length += snprintf(buffer + used, size - used, " (%s+0x%zx)",
+                            info.dli_sname,
+                            (size_t)((uintptr_t)address - (uintptr_t)info.dli_saddr));
+     }
+     return length;
+ }
+ 
+ uint64_t memory_manager_timestamp(void) {
+     return get_current_timestamp();
+ }
+ 
+ void memory_manager_record_lifetimes(
+     MemoryAllocationType type,
+     uint64_t timestamp,
+     size_t count
+ ) {
+     record_lifetimes(type, timestamp, count);
+ }
+ 
+ void memory_manager_get_lifetimes(
+     MemoryAllocationType type,
+     MemoryLifetimeHistogram* histogram
+ ) {
+     memset(histogram, 0, sizeof(MemoryLifetimeHistogram));
+     histogram->ns_per_tick = clock_ns_per_tick();
+     if ((unsigned)type >= MEMORY_TYPE_COUNT) {
+         return;
+     }
+ 
+     sum_lifetimes(type, histogram);
+     for (size_t b = 0; b < MEMORY_LIFETIME_BUCKETS; b++) {
+         histogram->frees += histogram->buckets[b];
+     }
+ }
+ 
+ // Slab entries are presented to block visitors as MemoryBlocks
+ typedef struct {
+     MemoryBlockVisitor visitor;
+     void* context;
+ } MemorySlabVisit;
+ 
+ static void visit_slab_block(
+     void* object,
+     const MemorySlabEntry* entry,
+     void* context
+ ) {
+     MemorySlabVisit* visit = context;
+     MemoryBlock block = {
+         .pointer = user_pointer(object),
+         .size = entry->size,
+         .timestamp = entry->timestamp,
+         .site_id = entry->site_id,
+         .type = (MemoryAllocationType)entry->type,
+         .status = (MemoryStatus)entry->status
+     };
+     visit->visitor(&block, visit->context);
+ }
+ 
+ void memory_manager_for_each_block(MemoryBlockVisitor visitor, void* context) {
+     flush_all_thread_caches();
+ 
+     // Shards are locked one at a time so allocators stall only briefly
+     for (size_t s = 0; s < MEMORY_TRACKER_SHARDS; s++) {
+         MemoryTracker* tracker = &g_memory_shards[s];
+ 
+ #if MEMORY_HEADER_METADATA
+         // The live list cannot be resumed once unlocked, so the shard
+         // stays locked for its whole walk
+         TRACKER_LOCK(&tracker->lock);
+         for (MemoryHeader* header = tracker->live_head; header;
+              header = header->next) {
+             MemoryBlock block = {
+                 .pointer = user_pointer(header + 1),
+                 .size = header->size,
+                 .timestamp = header->timestamp,
+                 .site_id = header->site_id,
+                 .type = (MemoryAllocationType)header->type,
+                 .status = (MemoryStatus)header->status
+             };
+             visitor(&block, context);
+         }
+         TRACKER_UNLOCK(&tracker->lock);
+ #else
+         // Copy a batch of slots per lock hold and visit it unlocked
+         MemoryBlock batch[MEMORY_VISIT_BATCH];
+         uint32_t slot = 0;
+         bool more = true;
+         while (more) {
+             size_t count = 0;
+             TRACKER_LOCK(&tracker->lock);
+             while (slot < tracker->used_slot_limit && count < MEMORY_VISIT_BATCH) {
+                 MemoryBlock* block = tracker_block(tracker, slot++);
+                 if (block->pointer) {
+                     batch[count++] = *block;
+                 }
+             }
+             more = slot < tracker->used_slot_limit;
+             TRACKER_UNLOCK(&tracker->lock);
+ 
+             for (size_t i = 0; i < count; i++) {
+                 batch[i].pointer = user_pointer(batch[i].pointer);
+                 visitor(&batch[i], context);
+             }
+         }
+ #endif
+     }
+ 
+     MemorySlabVisit visit = { visitor, context };
+     memory_slab_for_each(visit_slab_block, &visit);
+ }
+ 
+ #if MEMORY_CANARIES
+ 
+ static void check_slab_canaries(
+     void* object,
+     const MemorySlabEntry* entry,
+     void* context
+ ) {
+     size_t* corrupted = context;
+     if (canary_intact(object, entry->size)) {
+         return;
+     }
+     // The entry is rechecked, as its owner may have freed or reused the
+     // object since it was copied
+     if (!memory_slab_flag_corrupted(object, entry)) {
+         return;
+     }
+     (*corrupted)++;
+     if (entry->status != MEMORY_STATUS_CORRUPTED) {
+         report_corruption(entry->site_id);
+     }
+ }
+ 
+ #endif // MEMORY_CANARIES
+ 
+ size_t memory_manager_check_canaries(void) {
+ #if MEMORY_CANARIES
+     size_t corrupted = 0;
+     flush_all_thread_caches();
+ 
+     // Only a block's first detection is reported. A record is removed
+     // before its block is released, so every block read here is live
+     // while its shard is locked.
+     for (size_t s = 0; s < MEMORY_TRACKER_SHARDS; s++) {
+         MemoryTracker* tracker = &g_memory_shards[s];
+ 
+ #if MEMORY_HEADER_METADATA
+         TRACKER_LOCK(&tracker->lock);
+         for (MemoryHeader* header = tracker->live_head; header;
+              header = header->next) {
+             if (block_intact(header + 1, header->size)) {
+                 continue;
+             }
+             corrupted++;
+             if (header->status != MEMORY_STATUS_CORRUPTED) {
+                 header->status = MEMORY_STATUS_CORRUPTED;
+                 report_corruption(header->site_id);
+             }
+         }
+         TRACKER_UNLOCK(&tracker->lock);
+ #else
+         uint32_t slot = 0;
+         bool more = true;
+         while (more) {
+             TRACKER_LOCK(&tracker->lock);
+             uint32_t end = slot + MEMORY_VISIT_BATCH;
+             while (slot < tracker->used_slot_limit && slot < end) {
+                 MemoryBlock* block = tracker_block(tracker, slot++);
+                 if (!block->pointer || block_intact(block->pointer, block->size)) {
+                     continue;
+                 }
+                 corrupted++;
+                 if (block->status != MEMORY_STATUS_CORRUPTED) {
+                     block->status = MEMORY_STATUS_CORRUPTED;
+                     report_corruption(block->site_id);
+                 }
+             }
+             more = slot < tracker->used_slot_limit;
+             TRACKER_UNLOCK(&tracker->lock);
+         }
+ #endif
+     }
+ 
+     memory_slab_for_each(check_slab_canaries, &corrupted);
+     return corrupted;
+ #else
+     return 0;
+ #endif
+ }
+ 
+ // Published counters plus the deltas threads have not published yet
+ static void sum_type_stats(size_t index, MemoryTypeStats* stats) {
+     MemoryTypeCounters* counters = &g_type_counters[index];
+     int64_t live_blocks = __atomic_load_n(&counters->live_blocks, __ATOMIC_RELAXED);
+     int64_t live_bytes = __atomic_load_n(&counters->live_bytes, __ATOMIC_RELAXED);
+     stats->allocations = __atomic_load_n(&counters->allocations, __ATOMIC_RELAXED);
+     stats->frees = __atomic_load_n(&counters->frees, __ATOMIC_RELAXED);
+     stats->allocated_bytes =
+         __atomic_load_n(&counters->allocated_bytes, __ATOMIC_RELAXED);
+     stats->failed_allocations =
+         __atomic_load_n(&counters->failed_allocations, __ATOMIC_RELAXED);
+     stats->untracked_allocations =
+         __atomic_load_n(&counters->untracked_allocations, __ATOMIC_RELAXED);
+     int64_t peak_blocks = __atomic_load_n(&counters->peak_blocks, __ATOMIC_RELAXED);
+     int64_t peak_bytes = __atomic_load_n(&counters->peak_bytes, __ATOMIC_RELAXED);
+ 
+ #if MEMORY_THREAD_CACHE
+     // An unpublished delta's peak counts on top of the published level
+     int64_t published_blocks = live_blocks;
+     int64_t published_bytes = live_bytes;
+     TRACKER_LOCK(&g_cache_registry_lock);
+     for (MemoryThreadCache* cache = g_cache_registry; cache;
+          cache = cache->next) {
+         MemorySiteDelta* delta = &cache->type_deltas[index];
+         int64_t allocations = __atomic_load_n(&delta->allocations, __ATOMIC_RELAXED);
+         int64_t frees = __atomic_load_n(&delta->frees, __ATOMIC_RELAXED);
+         int64_t allocated = __atomic_load_n(&delta->allocated_bytes, __ATOMIC_RELAXED);
+         int64_t freed = __atomic_load_n(&delta->freed_bytes, __ATOMIC_RELAXED);
+         stats->allocations += (uint64_t)allocations;
+         stats->frees += (uint64_t)frees;
+         stats->allocated_bytes += (uint64_t)allocated;
+         live_blocks += allocations - frees;
+         live_bytes += allocated - freed;
+ 
+         int64_t delta_peak_blocks = published_blocks +
+             __atomic_load_n(&delta->peak_blocks, __ATOMIC_RELAXED);
+         int64_t delta_peak_bytes = published_bytes +
+             __atomic_load_n(&delta->peak_bytes, __ATOMIC_RELAXED);
+         if (delta_peak_blocks > peak_blocks) {
+             peak_blocks = delta_peak_blocks;
+         }
+         if (delta_peak_bytes > peak_bytes) {
+             peak_bytes = delta_peak_bytes;
+         }
+     }
+     TRACKER_UNLOCK(&g_cache_registry_lock);
+ #endif
+ 
+     // A peak once reported stays, even if publishing frees lowers the
+     // level later deltas are added to
+     if (live_blocks > peak_blocks) {
+         peak_blocks = live_blocks;
+     }
+     if (live_bytes > peak_bytes) {
+         peak_bytes = live_bytes;
+     }
+     raise_peak(&counters->peak_blocks, peak_blocks);
+     raise_peak(&counters->peak_bytes, peak_bytes);
+ 
+     stats->live_blocks = live_blocks > 0 ? (uint64_t)live_blocks : 0;
+     stats->live_bytes = live_bytes > 0 ? (uint64_t)live_bytes : 0;
+     stats->peak_blocks = (uint64_t)peak_blocks;
+     stats->peak_bytes = (uint64_t)peak_bytes;
+ }
+ 
+ void memory_manager_get_type_stats(
+     MemoryAllocationType type,
+     MemoryTypeStats* stats
+ ) {
+     memset(stats, 0, sizeof(MemoryTypeStats));
+     if ((unsigned)type < MEMORY_TYPE_COUNT) {
+         sum_type_stats(type, stats);
+     }
+ }
+ 
+ void memory_manager_get_stats(MemoryTypeStats* stats) {
+     memset(stats, 0, sizeof(MemoryTypeStats));
+     sum_type_stats(MEMORY_TYPE_COUNT, stats);
+ }
+ 
+ size_t memory_manager_get_site_count(void) {
+     return __atomic_load_n(&g_site_table.count, __ATOMIC_ACQUIRE);
+ }
+ 
+ double memory_manager_ns_per_tick(void) {
+     return clock_ns_per_tick();
+ }
+ 
+ // Report numbering carried across shards and slabs
+ static void report_block(const MemoryBlock* block, void* context) {
+     size_t* number = context;
+     printf(
+         "Block %zu: %p, %zu bytes, Type: %d, Status: %d\n",
+         (*number)++, block->pointer, block->size, block->type, block->status
+     );
+ }
+ 
+ static int compare_site_profiles(const void* left, const void* right) {
+     const MemorySiteProfile* a = left;
+     const MemorySiteProfile* b = right;
+     if (a->live_bytes != b->live_bytes) {
+         return a->live_bytes < b->live_bytes ? 1 : -1;
+     }
+     if (a->allocated_bytes != b->allocated_bytes) {
+         return a->allocated_bytes < b->allocated_bytes ? 1 : -1;
+     }
+     return 0;
+ }
+ 
+ size_t memory_manager_get_site_profiles(
+     MemorySiteProfile* profiles,
+     size_t capacity
+ ) {
+     size_t count = __atomic_load_n(&g_site_table.count, __ATOMIC_ACQUIRE);
+     if (count == 0 || capacity == 0) {
+         return 0;
+     }
+     MemorySiteProfile* all =
+         memory_system_malloc(count * sizeof(MemorySiteProfile));
+     if (!all) {
+         return 0;
+     }
+ 
+     // Published counters; live_blocks holds frees until the end
+     for (uint32_t id = 0; id < count; id++) {
+         MemorySiteRecord* record = site_record(id);
+         MemorySiteProfile* profile = &all[id];
+         profile->site = record->site;
+         profile->site_id = id;
+         profile->allocations =
+             __atomic_load_n(&record->allocations, __ATOMIC_RELAXED);
+         profile->live_blocks = __atomic_load_n(&record->frees, __ATOMIC_RELAXED);
+         profile->allocated_bytes =
+             __atomic_load_n(&record->allocated_bytes, __ATOMIC_RELAXED);
+         profile->live_bytes =
+             (uint64_t)__atomic_load_n(&record->live_bytes, __ATOMIC_RELAXED);
+         profile->peak_bytes =
+             (uint64_t)__atomic_load_n(&record->peak_bytes, __ATOMIC_RELAXED);
+     }
+ 
+     // Changes still sitting in thread delta slots
+ #if MEMORY_THREAD_CACHE
+     TRACKER_LOCK(&g_cache_registry_lock);
+     for (MemoryThreadCache* cache = g_cache_registry; cache;
+          cache = cache->next) {
+         for (size_t i = 0; i < MEMORY_SITE_DELTA_SLOTS; i++) {
+             MemorySiteDelta* delta = &cache->site_deltas[i];
+             uint32_t site = __atomic_load_n(&delta->site_id, __ATOMIC_RELAXED);
+             if (site == 0 || site > count) {
+                 continue;
+             }
+             MemorySiteProfile* profile = &all[site - 1];
+             uint64_t delta_peak = (uint64_t)(
+                 __atomic_load_n(&site_record(site - 1)->live_bytes, __ATOMIC_RELAXED) +
+                 __atomic_load_n(&delta->peak_bytes, __ATOMIC_RELAXED)
+             );
+             if (delta_peak > profile->peak_bytes) {
+                 profile->peak_bytes = delta_peak;
+             }
+             int64_t allocated =
+                 __atomic_load_n(&delta->allocated_bytes, __ATOMIC_RELAXED);
+             profile->allocations +=
+                 (uint64_t)__atomic_load_n(&delta->allocations, __ATOMIC_RELAXED);
+             profile->live_blocks +=
+                 (uint64_t)__atomic_load_n(&delta->frees, __ATOMIC_RELAXED);
+             profile->allocated_bytes += (uint64_t)allocated;
+             profile->live_bytes += (uint64_t)(allocated - __atomic_load_n(
+                 &delta->freed_bytes, __ATOMIC_RELAXED
+             ));
+         }
+     }
+     TRACKER_UNLOCK(&g_cache_registry_lock);
+ #endif
+ 
+     uint64_t now = get_current_timestamp();
+     double ns_per_tick = clock_ns_per_tick();
+     for (uint32_t id = 0; id < count; id++) {
+         MemorySiteProfile* profile = &all[id];
+         uint64_t frees = profile->live_blocks;
+         profile->live_blocks = profile->allocations > frees ?
+                                profile->allocations - frees : 0;
+         if ((int64_t)profile->live_bytes < 0) {
+             profile->live_bytes = 0;
+         }
+         if (profile->live_bytes > profile->peak_bytes) {
+             profile->peak_bytes = profile->live_bytes;
+         }
+         double seconds = (double)(now - site_record(id)->first_timestamp) *
+                          ns_per_tick / 1e9;
+         profile->allocations_per_second =
+             seconds > 0 ? (double)profile->allocations / seconds : 0;
+     }
+ 
+     qsort(all, count, sizeof(MemorySiteProfile), compare_site_profiles);
+     size_t written = count < capacity ? count : capacity;
+     memcpy(profiles, all, written * sizeof(MemorySiteProfile));
+     memory_system_free(all);
+     return written;
+ }
+ 
+ static void report_type_stats(void) {
+     for (int type = 0; type < MEMORY_TYPE_COUNT; type++) {
+         MemoryTypeStats stats;
+         memory_manager_get_type_stats((MemoryAllocationType)type, &stats);
+         if (stats.allocations == 0 && stats.failed_allocations == 0 &&
+             stats.untracked_allocations == 0) {
+             continue;
+         }
+         printf(
+             "Type %d: %llu live blocks, %llu live bytes, peak %llu blocks / %llu bytes, "
+             "%llu allocs, %llu frees, %llu bytes allocated, %llu failed, "
+             "%llu untracked\n",
+             type, (unsigned long long)stats.live_blocks,
+             (unsigned long long)stats.live_bytes,
+             (unsigned long long)stats.peak_blocks,
+             (unsigned long long)stats.peak_bytes,
+             (unsigned long long)stats.allocations,
+             (unsigned long long)stats.frees,
+             (unsigned long long)stats.allocated_bytes,
+             (unsigned long long)stats.failed_allocations,
+             (unsigned long long)stats.untracked_allocations
+         );
+     }
+ }
+ 
+ // Upper bound of the bucket holding a fraction of the frees, in ns
+ static double lifetime_percentile(
+     const MemoryLifetimeHistogram* histogram,
+     double fraction
+ ) {
+     uint64_t target = (uint64_t)(fraction * (double)histogram->frees);
+     uint64_t seen = 0;
+     size_t b = 0;
+     for (; b < MEMORY_LIFETIME_BUCKETS - 1; b++) {
+         seen += histogram->buckets[b];
+         if (seen > target) {
+             break;
+         }
+     }
+     return (double)(2ULL << b) * histogram->ns_per_tick;
+ }
+ 
+ static void report_lifetimes(void) {
+     for (int type = 0; type < MEMORY_TYPE_COUNT; type++) {
+         MemoryLifetimeHistogram histogram;
+         memory_manager_get_lifetimes((MemoryAllocationType)type, &histogram);
+         if (histogram.frees == 0) {
+             continue;
+         }
+         printf(
+             "Lifetimes Type %d: %llu frees, mean %.0f ns, p50 < %.0f ns, p99 < %.0f ns\n",
+             type, (unsigned long long)histogram.frees,
+             (double)histogram.total_ticks * histogram.ns_per_tick /
+                 (double)histogram.frees,
+             lifetime_percentile(&histogram, 0.50),
+             lifetime_percentile(&histogram, 0.99)
+         );
+     }
+ }
+ 
+ void generate_memory_report(void) {
+     printf("\n--- MEMORY ALLOCATION REPORT ---\n");
+     flush_all_thread_caches();
+     printf("Total Blocks: %zu\n", get_current_block_count());
+     printf("Total Allocated: %zu bytes\n", get_total_allocated_memory());
+ 
+     MemoryArenaStats arena;
+     memory_arena_get_stats(&arena);
+     printf(
+         "Temporary Arena: %zu blocks, %zu bytes (%zu bytes reserved)\n",
+         arena.blocks, arena.bytes, arena.reserved_bytes
+     );
+ 
+     MemoryPersistentStats persistent;
+     memory_persistent_get_stats(&persistent);
+     printf(
+         "Persistent Heap: %zu blocks, %zu bytes (%zu bytes used, %zu bytes mapped, %zu hugetlb extents)\n",
+         persistent.blocks, persistent.bytes, persistent.used_bytes,
+         persistent.mapped_bytes, persistent.hugetlb_extents
+     );
+     MemoryGuardStats guard;
+     memory_guard_get_stats(&guard);
+     if (guard.blocks != 0 || guard.quarantined_blocks != 0 || guard.fallbacks != 0) {
+         printf(
+             "Guard Pages: %zu blocks, %zu bytes (%zu pages, %zu blocks / %zu bytes quarantined, %zu fallbacks)\n",
+             guard.blocks, guard.bytes, guard.pages, guard.quarantined_blocks,
+             guard.quarantined_bytes, guard.fallbacks
+         );
+     }
+     size_t interval = memory_manager_get_sample_interval();
+     if (interval) {
+         printf("Sampling: one sample per %zu bytes allocated; blocks listed "
+                "below are the samples, counters are estimates\n", interval);
+     }
+     report_type_stats();
+     report_lifetimes();
+ 
+     size_t number = 0;
+     memory_manager_for_each_block(report_block, &number);
+ }
+ 
+ size_t get_total_allocated_memory(void) {
+     flush_all_thread_caches();
+ 
+     int64_t slab_blocks, slab_bytes;
+     sum_slab_counts(&slab_blocks, &slab_bytes);
+ 
+     size_t total = (size_t)slab_bytes;
+     for (size_t i = 0; i < MEMORY_TRACKER_SHARDS; i++) {
+         total += __atomic_load_n(
+             &g_memory_shards[i].total_allocated_memory, __ATOMIC_RELAXED
+         );
+     }
+     return total;
+ }
+ 
+ size_t get_current_block_count(void) {
+     flush_all_thread_caches();
+ 
+     int64_t slab_blocks, slab_bytes;
+     sum_slab_counts(&slab_blocks, &slab_bytes);
+     return sum_block_counts() + (size_t)slab_blocks;
+ }
+ 
+ void generate_site_report(size_t limit) {
+     write_site_report(stdout, limit);
+ }
+ 
+ void write_site_report(FILE* stream, size_t limit) {
+     size_t count = __atomic_load_n(&g_site_table.count, __ATOMIC_ACQUIRE);
+     if (limit == 0 || limit > count) {
+         limit = count;
+     }
+     MemorySiteProfile* profiles =
+         limit ? memory_system_malloc(limit * sizeof(MemorySiteProfile)) : NULL;
+     size_t written = profiles ?
+                      memory_manager_get_site_profiles(profiles, limit) : 0;
+ 
+     fprintf(stream, "\n--- ALLOCATION SITE REPORT ---\n");
+     size_t interval = __atomic_load_n(&g_sample_interval, __ATOMIC_RELAXED);
+     if (interval != 0) {
+         fprintf(stream, "Estimated from one sample per %zu bytes allocated\n",
+                 interval);
+     }
+     fprintf(
+         stream, "%10s %12s %12s %10s %14s %12s %4s  %s\n",
+         "live", "live bytes", "peak bytes", "allocs", "alloc bytes",
+         "allocs/s", "type", "site"
+     );
+     for (size_t i = 0; i < written; i++) {
+         const MemorySiteProfile* profile = &profiles[i];
+         char site[256];
+         memory_manager_format_site(&profile->site, site, sizeof(site));
+         fprintf(
+             stream, "%10llu %12llu %12llu %10llu %14llu %12.0f %4d  %s\n",
+             (unsigned long long)profile->live_blocks,
+             (unsigned long long)profile->live_bytes,
+             (unsigned long long)profile->peak_bytes,
+             (unsigned long long)profile->allocations,
+             (unsigned long long)profile->allocated_bytes,
+             profile->allocations_per_second, profile->site.type, site
+         );
+ 
+         // The site's stack, innermost frame first, under the site column
+         const void* frames[MEMORY_TRACE_MAX_DEPTH];
+         size_t depth = memory_trace_frames(profile->site.trace_id, frames,
+                                            MEMORY_TRACE_MAX_DEPTH);
+         for (size_t f = 0; f < depth; f++) {
+             memory_manager_format_address(frames[f], site, sizeof(site));
+             fprintf(stream, "%82s#%-2zu %s\n", "", f, site);
+         }
+     }
+     memory_system_free(profiles);
+ }
@@ -15,18 +15,110 @@
  #include <stdint.h>
  
  // Configuration Constants
- #define MAX_FILENAME_LENGTH 256
- #define MAX_TRACKED_BLOCKS 1000
+ // Release builds (-DMEMORY_TRACKING_ENABLED=0): ALLOCATE/DEALLOCATE expand
+ // to malloc/free behind the tracked build's input checks, and the
+ // tracker is never entered
+ #ifndef MEMORY_TRACKING_ENABLED
  #define MEMORY_TRACKING_ENABLED 1
+ #endif
+ 
+ // Thread-safe mode: the tracker is split into address-hashed shards,
+ // each guarded by its own mutex (build with -pthread)
+ #ifndef MEMORY_THREAD_SAFE
+ #define MEMORY_THREAD_SAFE 1
+ #endif
+ #define MEMORY_TRACKER_SHARD_BITS 6
+ #define MEMORY_TRACKER_SHARDS (1 << MEMORY_TRACKER_SHARD_BITS)
+ 
+ // Per-thread caches: small blocks are recycled through thread-local
+ // magazines and their tracking records reach the shards in batches
+ #ifndef MEMORY_THREAD_CACHE
+ #define MEMORY_THREAD_CACHE 1
+ #endif
+ #define MEMORY_CACHE_MAX_SIZE 1024
+ #define MEMORY_MAGAZINE_SIZE 32
+ #define MEMORY_PENDING_RECORDS 64
+ 
+ // Per-site counter changes are batched in thread-local delta slots and
+ // published to the shared counters every MEMORY_SITE_DELTA_BATCH changes
+ #define MEMORY_SITE_DELTA_SLOTS 64
+ #define MEMORY_SITE_DELTA_BATCH 256
+ 
+ // Header-embedded metadata: tracked heap blocks carry a MemoryHeader in
+ // front of the user pointer and shards keep an intrusive live list
+ // instead of the block table and pointer index
+ #ifndef MEMORY_HEADER_METADATA
+ #define MEMORY_HEADER_METADATA 0
+ #endif
+ 
+ // Timestamp clock: the time-stamp counter on x86 (needs an invariant
+ // TSC), or CLOCK_MONOTONIC_RAW nanoseconds when set to 0
+ #ifndef MEMORY_TIMESTAMP_TSC
+ #if defined(__x86_64__) || defined(__i386__)
+ #define MEMORY_TIMESTAMP_TSC 1
+ #else
+ #define MEMORY_TIMESTAMP_TSC 0
+ #endif
+ #endif
+ 
+ // Canaries: tracked blocks carry a 16-byte head and an 8-byte tail
+ // canary around the caller's bytes, checked on free, on resize and by
+ // memory_manager_check_canaries. Untracked pointers are then reported
+ // but never passed on to the C library, as their layout is unknown.
+ #ifndef MEMORY_CANARIES
+ #define MEMORY_CANARIES 0
+ #endif
+ 
+ // Lifetime histograms: bucket k counts blocks that lived [2^k, 2^(k+1))
+ // clock ticks; the last bucket also takes everything longer
+ #define MEMORY_LIFETIME_BUCKETS 48
+ 
+ #if MEMORY_THREAD_SAFE
+ #include <pthread.h>
+ #endif
+ 
+ // Block table layout: segment k holds MEMORY_SEGMENT_BASE_BLOCKS << k
+ // blocks, so capacity doubles per segment and existing blocks never move
+ #define MEMORY_SEGMENT_BASE_BLOCKS 1024
+ #define MEMORY_MAX_SEGMENTS 22
+ #define MAX_TRACKED_BLOCKS \
+     ((size_t)MEMORY_SEGMENT_BASE_BLOCKS * ((1ULL << MEMORY_MAX_SEGMENTS) - 1))
+ 
+ // Default soft cap on live tracked blocks (0 = grow up to MAX_TRACKED_BLOCKS)
+ #define MEMORY_DEFAULT_BLOCK_LIMIT 0
+ 
+ // Sampling mode: track about one allocation per this many bytes and hand
+ // the rest to the system allocator untracked (0 = track every allocation)
+ #define MEMORY_DEFAULT_SAMPLE_INTERVAL 0
+ 
+ // Stack frames kept per tracked allocation (0 = no stack traces)
+ #define MEMORY_DEFAULT_TRACE_DEPTH 0
+ 
+ // Call sites memory_manager_set_guard_site can guard at once
+ #define MEMORY_GUARD_MAX_SITES 16
+ 
+ // Blocks copied out of a shard per lock hold by memory_manager_for_each_block
+ #define MEMORY_VISIT_BATCH 256
+ 
+ // Pointers handled per pass by the batch calls (each shard is locked at
+ // most once per pass)
+ #define MEMORY_BATCH_CHUNK 256
+ 
+ // Alignment of every block; ALIGNED_ALLOCATE serves stricter requests
+ #define MEMORY_MIN_ALIGNMENT 16
  
  // Memory Allocation Types
  typedef enum {
      MEMORY_TYPE_STATIC,     // Compile-time allocated memory
      MEMORY_TYPE_DYNAMIC,    // Runtime heap allocation
-     MEMORY_TYPE_TEMPORARY,  // Short-lived allocations
+     MEMORY_TYPE_TEMPORARY,  // Short-lived allocations; inside a
+                             // memory_arena_push scope they come from the
+                             // arena and DEALLOCATE leaves them to the pop
      MEMORY_TYPE_PERSISTENT  // Long-lived allocations
  } MemoryAllocationType;
  
+ #define MEMORY_TYPE_COUNT 4
+ 
  // Memory Block Status
  typedef enum {
      MEMORY_STATUS_ALLOCATED,
@@ -34,33 +126,167 @@
      MEMORY_STATUS_CORRUPTED
  } MemoryStatus;
  
- // Memory Block Tracking Structure
+ // Memory Block Tracking Structure (40 bytes, fits one cache line)
  typedef struct {
      void* pointer;              // Memory address
      size_t size;                // Allocated memory size
-     char filename[MAX_FILENAME_LENGTH];  // Source file
-     int line_number;            // Line number of allocation
+     uint64_t timestamp;         // Allocation clock reading
+     uint32_t site_id;           // Interned allocation call site
+     uint32_t next_free_slot;    // Free-slot list link while unused (slot + 1)
      MemoryAllocationType type;  // Allocation category
      MemoryStatus status;        // Current block status
-     uint64_t timestamp;         // Allocation timestamp
  } MemoryBlock;
  
- // Memory Tracker Structure
+ // Line number that marks a call site named by a return address: callers
+ // without source locations (the LD_PRELOAD shim) pass the address of
+ // the calling instruction in place of the filename
+ #define MEMORY_CALLER_LINE 0
+ 
+ // Interned Allocation Call Site
  typedef struct {
-     MemoryBlock blocks[MAX_TRACKED_BLOCKS];
+     const char* filename;       // Source file (NULL for a caller site)
+     int line_number;            // Line number of allocation
+     MemoryAllocationType type;  // Allocation category requested there
+     const void* caller;         // Return address of a caller site
+     uint32_t trace_id;          // Stack above the site (memory_trace.h)
+ } MemoryCallSite;
+ 
+ // In-band Block Header (48 bytes, keeps the user pointer 16-byte aligned)
+ typedef struct MemoryHeader {
+     struct MemoryHeader* previous;  // Shard live-list links
+     struct MemoryHeader* next;
+     size_t size;                // Requested size
+     uint64_t timestamp;         // Allocation timestamp
+     uint32_t site_id;           // Interned allocation call site
+     uint16_t type;              // MemoryAllocationType
+     uint16_t magic;             // MEMORY_HEADER_MAGIC while live
+     uint32_t offset;            // Alignment padding in front of the header
+     uint32_t status;            // MemoryStatus
+ } __attribute__((aligned(16))) MemoryHeader;
+ 
+ #define MEMORY_HEADER_MAGIC 0xA110
+ #define MEMORY_HEADER_UNSAMPLED 0xA111  // Untracked (unsampled or past the soft cap)
+ 
+ // Allocations aggregated over one call site
+ typedef struct {
+     MemoryCallSite site;
+     uint32_t site_id;           // Matches MemoryBlock::site_id
+     uint64_t live_blocks;
+     uint64_t live_bytes;
+     uint64_t peak_bytes;        // Highest live_bytes, to within one batch
+     uint64_t allocations;       // Cumulative since the site was interned
+     uint64_t allocated_bytes;   // Cumulative bytes
+     double allocations_per_second;
+ } MemorySiteProfile;
+ 
+ // Counters of tracked blocks (arena blocks excluded, as in
+ // get_total_allocated_memory), kept without walking the block table
+ typedef struct {
+     uint64_t live_blocks;
+     uint64_t live_bytes;
+     uint64_t peak_blocks;       // High-water marks, to within one batch
+     uint64_t peak_bytes;        // of MEMORY_SITE_DELTA_BATCH per thread
+     uint64_t allocations;       // Cumulative since memory_manager_init
+     uint64_t frees;
+     uint64_t allocated_bytes;
+     uint64_t failed_allocations;
+     uint64_t untracked_allocations;  // Served untracked past the soft cap
+ } MemoryTypeStats;
+ 
+ // Lifetimes of freed blocks of one allocation type
+ typedef struct {
+     uint64_t buckets[MEMORY_LIFETIME_BUCKETS];  // Frees per log2(ticks) bucket
+     uint64_t frees;             // Blocks counted
+     uint64_t total_ticks;       // Summed lifetimes
+     double ns_per_tick;         // Clock tick length (1.0 unless TSC)
+ } MemoryLifetimeHistogram;
+ 
+ // Memory Tracker Structure (one shard; blocks are assigned by address hash)
+ typedef struct {
+ #if MEMORY_THREAD_SAFE
+     pthread_mutex_t lock;       // Guards every field of this shard
+ #endif
+ #if MEMORY_HEADER_METADATA
+     MemoryHeader* live_head;    // Live blocks, most recent first
+ #else
+     MemoryBlock* segments[MEMORY_MAX_SEGMENTS];  // Geometric block segments
+     uint32_t* index;            // Pointer -> slot + 1 (0 = empty)
+     size_t index_capacity;      // Index buckets (power of two)
+     uint32_t free_slot_head;    // Most recently released slot + 1 (0 = none)
+     uint32_t used_slot_limit;   // Slots at or above this were never used
+ #endif
      size_t current_block_count;
      size_t total_allocated_memory;
- } MemoryTracker;
+ } __attribute__((aligned(64))) MemoryTracker;
  
  /**
   * @brief Initialize memory tracking system
+  * @note Not thread-safe; call before other threads start allocating
   */
  void memory_manager_init(void);
  
+ /**
+  * @brief Set the soft cap on simultaneously tracked blocks
+  * @param limit Maximum live blocks, or 0 to grow up to MAX_TRACKED_BLOCKS
+  * @note Allocations past the cap still succeed: the blocks come from the
+  *       system allocator untracked, as sampling mode's unsampled blocks
+  *       do, and count as untracked_allocations (MemoryTypeStats). Without
+  *       headers a stray free can no longer be told from theirs, so it
+  *       is released silently from then on.
+  */
+ void memory_manager_set_block_limit(size_t limit);
+ 
+ /**
+  * @brief Track only a sample of allocations, as a heap profiler does
+  * @param interval Mean bytes allocated between samples (524288 is a
+  *                 common production setting), or 0 to track every block
+  * @note A thread samples the allocation that crosses the next point of a
+  *       Poisson process over its allocated bytes, so a block of s bytes
+  *       is tracked with probability 1 - exp(-s / interval), and a resize
+  *       is sampled again for its new size. Unsampled blocks come from the
+  *       system allocator with no call site, record or counters. Tracked
+  *       blocks count as 1 / probability blocks, so site and type counters
+  *       are unbiased estimates of every allocation. Persistent blocks are
+  *       always tracked and temporary ones in an arena scope still come
+  *       from the arena.
+  *       Without MEMORY_HEADER_METADATA freeing an untracked pointer is
+  *       not diagnosed, as it cannot be told from an unsampled block. Set
+  *       it right after memory_manager_init, before allocating: counters
+  *       are weighted by the interval in force at each change
+  *       (memory_manager_init restores the default).
+  */
+ void memory_manager_set_sample_interval(size_t interval);
+ 
+ /**
+  * @brief Get the sampling interval
+  * @return Mean bytes between samples, or 0 when every block is tracked
+  */
+ size_t memory_manager_get_sample_interval(void);
+ 
+ /**
+  * @brief Record the call stack of every tracked allocation
+  * @param depth Frames kept per stack, at most MEMORY_TRACE_MAX_DEPTH, or
+  *              0 to stop capturing
+  * @note A stack costs about 2 us with the C library unwinder and tens of
+  *       nanoseconds with MEMORY_TRACE_FRAME_POINTERS; in production pair
+  *       the unwinder with sampling mode so only sampled blocks pay. Each
+  *       (site, stack) pair is interned as its own call site, so site
+  *       profiles split a wrapper by its callers. A full trace table
+  *       leaves new stacks untraced.
+  */
+ void memory_manager_set_trace_depth(unsigned depth);
+ 
+ /**
+  * @brief Get the stack trace depth
+  * @return Frames kept per stack, or 0 when traces are off
+  */
+ unsigned memory_manager_get_trace_depth(void);
+ 
  /**
   * @brief Safely allocate memory with tracking
   * @param size Requested memory size
-  * @param filename Source file name
+  * @param filename Source file name (static string such as __FILE__), or
+  *                 a return address when line_number is MEMORY_CALLER_LINE
   * @param line_number Source line number
   * @param type Memory allocation type
   * @return Pointer to allocated memory
@@ -84,17 +310,307 @@
      int line_number
  );
  
+ /**
+  * @brief Resize a tracked block, keeping its call site and timestamp
+  * @param memory Block to resize (NULL allocates MEMORY_TYPE_DYNAMIC)
+  * @param size New size (0 frees the block and returns NULL)
+  * @param filename Source file name
+  * @param line_number Source line number
+  * @return Resized block, or NULL with the old block intact on failure
+  * @note Blocks grow or shrink in place when their size class, arena
+  *       position or heap allows it. Alignment beyond MEMORY_MIN_ALIGNMENT
+  *       is not kept when a block moves. An arena block that moves keeps
+  *       its contents, but the bytes past its old size are unspecified, as
+  *       arena blocks carry no size. Untracked heap memory is reported
+  *       and handed to realloc, as safe_memory_free hands it to free.
+  */
+ void* safe_memory_reallocate(
+     void* memory,
+     size_t size,
+     const char* filename,
+     int line_number
+ );
+ 
+ /**
+  * @brief Allocate a zero-filled tracked array
+  * @param count Number of elements
+  * @param size Element size
+  * @param filename Source file name
+  * @param line_number Source line number
+  * @param type Memory allocation type
+  * @return Pointer to zeroed memory, or NULL (also when count * size overflows)
+  */
+ void* safe_memory_callocate(
+     size_t count,
+     size_t size,
+     const char* filename,
+     int line_number,
+     MemoryAllocationType type
+ );
+ 
+ /**
+  * @brief Allocate a tracked block with a given alignment
+  * @param alignment Power of two
+  * @param size Requested memory size
+  * @param filename Source file name
+  * @param line_number Source line number
+  * @param type Memory allocation type
+  * @return Aligned pointer, or NULL
+  * @note Alignments above MEMORY_MIN_ALIGNMENT bypass the thread cache,
+  *       slabs, arena and persistent heap
+  */
+ void* safe_memory_aligned_allocate(
+     size_t alignment,
+     size_t size,
+     const char* filename,
+     int line_number,
+     MemoryAllocationType type
+ );
+ 
+ /**
+  * @brief Allocate count tracked blocks of one size and call site
+  * @param count Number of blocks
+  * @param size Size of each block
+  * @param objects Receives the blocks
+  * @param filename Source file name
+  * @param line_number Source line number
+  * @param type Memory allocation type
+  * @return Blocks allocated; they fill the front of objects and the
+  *         remaining entries are set to NULL
+  * @note The site lookup, block limit check, magazine, slab and shard
+  *       locks and counter updates are paid once per batch rather than
+  *       once per block. The blocks share one allocation timestamp.
+  */
+ size_t safe_memory_allocate_batch(
+     size_t count,
+     size_t size,
+     void** objects,
+     const char* filename,
+     int line_number,
+     MemoryAllocationType type
+ );
+ 
+ /**
+  * @brief Free count blocks as safe_memory_free would, one by one
+  * @param objects Blocks to free (NULL entries are reported)
+  * @param count Number of entries
+  * @param filename Source file name
+  * @param line_number Source line number
+  * @note Records are removed with one thread-cache lock and at most one
+  *       lock per shard for every MEMORY_BATCH_CHUNK pointers, and frees
+  *       of one site and timestamp are counted together
+  */
+ void safe_memory_free_batch(
+     void* const* objects,
+     size_t count,
+     const char* filename,
+     int line_number
+ );
+ 
+ /**
+  * @brief Route small MEMORY_TYPE_DYNAMIC blocks to the slab backend
+  * @param enabled true for slabs (the default), false for malloc
+  */
+ void memory_manager_set_slab_backend(bool enabled);
+ 
+ /**
+  * @brief Give every block of a type pages of its own, ending against an
+  *        inaccessible guard page (see memory_guard.h)
+  * @param type Allocation type
+  * @param enabled true to guard new blocks of the type, false to stop
+  * @note An overrun faults on the spot, a write into the slack around the
+  *       block is reported as corruption when it is freed, and freed
+  *       blocks fault until they leave the quarantine. Guarded
+  *       MEMORY_TYPE_TEMPORARY blocks bypass the arena. Each live block
+  *       is a mapping of its own and costs at least two pages; once the
+  *       system refuses more mappings (vm.max_map_count) blocks fall back
+  *       to the normal heap, which the report counts. In sampling mode
+  *       only sampled blocks are guarded.
+  */
+ void memory_manager_set_guard_type(MemoryAllocationType type, bool enabled);
+ 
+ /**
+  * @brief Guard the blocks allocated at one call site
+  * @param filename Source file name as passed to the allocation calls
+  *                 (compared by content), or a return address when
+  *                 line_number is MEMORY_CALLER_LINE
+  * @param line_number Source line number
+  * @param enabled true to guard the site, false to stop
+  * @return false when MEMORY_GUARD_MAX_SITES sites are already guarded
+  * @note Temporary blocks served by the arena are not guarded by site;
+  *       see memory_manager_set_guard_type for those and for the costs
+  */
+ bool memory_manager_set_guard_site(const char* filename, int line_number, bool enabled);
+ 
+ /**
+  * @brief Bound the pages freed guarded blocks keep inaccessible
+  * @param bytes Quarantine size (64 MiB by default; 0 recycles pages as
+  *              soon as they are freed)
+  * @note Quarantined pages are dropped, so they cost address space only
+  */
+ void memory_manager_set_guard_quarantine(size_t bytes);
+ 
+ /**
+  * @brief Publish the calling thread's buffered tracking records
+  * @note Reports and counters flush every thread's cache automatically
+  */
+ void memory_manager_flush_thread_cache(void);
+ 
+ /**
+  * @brief Look up an interned allocation call site
+  * @param site_id Site identifier stored in MemoryBlock::site_id
+  * @return Call site, or NULL for an unknown identifier
+  */
+ const MemoryCallSite* memory_manager_get_site(uint32_t site_id);
+ 
+ /**
+  * @brief Format a call site as "file:line", or for a caller site as
+  *        "object+0xoffset (symbol+0xoffset)" so it can be fed to addr2line
+  * @param site Call site
+  * @param buffer Output buffer
+  * @param size Bytes available in buffer
+  * @return Length of the full text, as snprintf
+  */
+ int memory_manager_format_site(
+     const MemoryCallSite* site,
+     char* buffer,
+     size_t size
+ );
+ 
+ /**
+  * @brief Format a code address as "object+0xoffset (symbol+0xoffset)",
+  *        as caller sites and stack frames are printed
+  * @param address Return address
+  * @param buffer Output buffer
+  * @param size Bytes available in buffer
+  * @return Length of the full text, as snprintf
+  */
+ int memory_manager_format_address(const void* address, char* buffer, size_t size);
+ 
+ /**
+  * @brief Read the clock used for allocation timestamps
+  * @return Clock ticks (nanoseconds unless MEMORY_TIMESTAMP_TSC is 1)
+  */
+ uint64_t memory_manager_timestamp(void);
+ 
+ /**
+  * @brief Count blocks released together in the lifetime histograms
+  * @param type Memory allocation type of the blocks
+  * @param timestamp Clock reading when the blocks were allocated
+  * @param count Number of blocks
+  */
+ void memory_manager_record_lifetimes(
+     MemoryAllocationType type,
+     uint64_t timestamp,
+     size_t count
+ );
+ 
+ /**
+  * @brief Get the lifetime histogram of one allocation type
+  * @param type Memory allocation type
+  * @param histogram Output histogram
+  * @note With MEMORY_TIMESTAMP_TSC the first call may spend up to a
+  *       millisecond calibrating the counter
+  */
+ void memory_manager_get_lifetimes(
+     MemoryAllocationType type,
+     MemoryLifetimeHistogram* histogram
+ );
+ 
+ // Visitor for live tracked blocks
+ typedef void (*MemoryBlockVisitor)(const MemoryBlock* block, void* context);
+ 
+ /**
+  * @brief Visit every live tracked block (arena blocks are not tracked)
+  * @param visitor Callback invoked per live block
+  * @param context Opaque pointer passed to the visitor
+  * @note Shards are locked one at a time. With the block table at most
+  *       MEMORY_VISIT_BATCH blocks are copied per lock hold and the visitor
+  *       runs unlocked; in header mode it runs under the shard lock. The
+  *       visitor must not allocate through the tracker.
+  */
+ void memory_manager_for_each_block(MemoryBlockVisitor visitor, void* context);
+ 
+ /**
+  * @brief Check the canaries of every live tracked block
+  * @return Blocks found overrun; each is flagged MEMORY_STATUS_CORRUPTED
+  *         and reported once at its allocation site
+  * @note Needs MEMORY_CANARIES (returns 0 otherwise). Shards are locked
+  *       MEMORY_VISIT_BATCH blocks at a time while their blocks are read;
+  *       a corrupted block is still reported, and not reused, when freed.
+  *       Arena blocks and sampling mode's unsampled blocks carry no
+  *       canaries.
+  */
+ size_t memory_manager_check_canaries(void);
+ 
+ /**
+  * @brief Get the number of interned call sites
+  * @return Site count (valid site ids are below it)
+  */
+ size_t memory_manager_get_site_count(void);
+ 
+ /**
+  * @brief Get the length of one timestamp clock tick
+  * @return Nanoseconds per tick (1.0 unless MEMORY_TIMESTAMP_TSC)
+  */
+ double memory_manager_ns_per_tick(void);
+ 
+ /**
+  * @brief Get per-call-site profiles, largest live bytes first
+  * @param profiles Output array
+  * @param capacity Entries available in profiles
+  * @return Entries written
+  * @note Read from per-site counters without walking the block table;
+  *       arena-served MEMORY_TYPE_TEMPORARY blocks are not counted. In
+  *       sampling mode the counters are estimates (see
+  *       memory_manager_set_sample_interval).
+  */
+ size_t memory_manager_get_site_profiles(
+     MemorySiteProfile* profiles,
+     size_t capacity
+ );
+ 
  /**
   * @brief Generate comprehensive memory usage report
   */
  void generate_memory_report(void);
  
+ /**
+  * @brief Print allocations aggregated by call site, largest first
+  * @param limit Sites to print, or 0 for every site
+  */
+ void generate_site_report(size_t limit);
+ 
+ /**
+  * @brief Write the call-site report of generate_site_report to a stream
+  * @param stream Output stream
+  * @param limit Sites to print, or 0 for every site
+  */
+ void write_site_report(FILE* stream, size_t limit);
+ 
  /**
   * @brief Get total allocated memory
   * @return Total bytes allocated
   */
  size_t get_total_allocated_memory(void);
  
+ /**
+  * @brief Get live, peak and cumulative counters of one allocation type
+  * @param type Memory allocation type
+  * @param stats Output counters
+  * @note In sampling mode these are estimates, as are site profiles
+  */
+ void memory_manager_get_type_stats(
+     MemoryAllocationType type,
+     MemoryTypeStats* stats
+ );
+ 
+ /**
+  * @brief Get live, peak and cumulative counters over every type
+  * @param stats Output counters (peaks of the combined totals)
+  */
+ void memory_manager_get_stats(MemoryTypeStats* stats);
+ 
  /**
   * @brief Get current number of tracked memory blocks
   * @return Number of tracked memory blocks
@@ -102,9 +618,77 @@
  size_t get_current_block_count(void);
  
  // Convenient macro definitions
+ #if MEMORY_TRACKING_ENABLED
  #define ALLOCATE(size, type) \
      safe_memory_allocate(size, __FILE__, __LINE__, type)
  #define DEALLOCATE(ptr) \
      safe_memory_free(ptr, __FILE__, __LINE__)
+ #define REALLOCATE(ptr, size) \
+     safe_memory_reallocate(ptr, size, __FILE__, __LINE__)
+ #define CALLOCATE(count, size, type) \
+     safe_memory_callocate(count, size, __FILE__, __LINE__, type)
+ #define ALIGNED_ALLOCATE(alignment, size, type) \
+     safe_memory_aligned_allocate(alignment, size, __FILE__, __LINE__, type)
+ #define ALLOCATE_BATCH(count, size, type, objects) \
+     safe_memory_allocate_batch(count, size, objects, __FILE__, __LINE__, type)
+ #define DEALLOCATE_BATCH(objects, count) \
+     safe_memory_free_batch(objects, count, __FILE__, __LINE__)
+ #else
+ // Release builds take the inputs the tracked build takes: a zero size
+ // gets NULL (the tracked build also warns), as REALLOCATE to zero frees
+ static inline void* memory_malloc(size_t size) {
+     return size > 0 ? malloc(size) : NULL;
+ }
+ 
+ static inline void* memory_calloc(size_t count, size_t size) {
+     return count > 0 && size > 0 ? calloc(count, size) : NULL;
+ }
+ 
+ static inline void* memory_realloc(void* memory, size_t size) {
+     if (size == 0) {
+         free(memory);
+         return NULL;
+     }
+     return realloc(memory, size);
+ }
+ 
+ // Any power-of-two alignment and any size: aligned_alloc may refuse a
+ // size that is not a multiple of the alignment, so the size is rounded up
+ static inline void* memory_aligned_malloc(size_t alignment, size_t size) {
+     if (size == 0 || alignment == 0 || (alignment & (alignment - 1)) != 0 ||
+         size > SIZE_MAX - (alignment - 1)) {
+         return NULL;
+     }
+     return aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+ }
+ 
+ // Release batches loop over the system allocator
+ static inline size_t memory_malloc_batch(size_t count, size_t size, void** objects) {
+     size_t done = 0;
+     while (done < count && (objects[done] = memory_malloc(size)) != NULL) {
+         done++;
+     }
+     for (size_t i = done; i < count; i++) {
+         objects[i] = NULL;
+     }
+     return done;
+ }
+ 
+ static inline void memory_free_batch(void* const* objects, size_t count) {
+     for (size_t i = 0; i < count; i++) {
+         free(objects[i]);
+     }
+ }
+ 
+ #define ALLOCATE(size, type) ((void)(type), memory_malloc(size))
+ #define DEALLOCATE(ptr) free(ptr)
+ #define REALLOCATE(ptr, size) memory_realloc(ptr, size)
+ #define CALLOCATE(count, size, type) ((void)(type), memory_calloc(count, size))
+ #define ALIGNED_ALLOCATE(alignment, size, type) \
+     ((void)(type), memory_aligned_malloc(alignment, size))
+ #define ALLOCATE_BATCH(count, size, type, objects) \
+     ((void)(type), memory_malloc_batch(count, size, objects))
+ #define DEALLOCATE_BATCH(objects, count) memory_free_batch(objects, count)
+ #endif
  
  #endif // MEMORY_MANAGER_H
\ No newline at end of file
@@ -0,0 +1,251 @@
+/**
+ * @file memory_persistent.c
+ * @brief Long-Lived Heap Implementation
+ */
+ 
+ #define _DEFAULT_SOURCE
+ 
+ #include <sys/mman.h>
+ #include "memory_manager.h"
+ #include "memory_persistent.h"
+ 
+ #if MEMORY_THREAD_SAFE
+ #define PERSISTENT_LOCK(mutex) pthread_mutex_lock(mutex)
+ #define PERSISTENT_UNLOCK(mutex) pthread_mutex_unlock(mutex)
+ #else
+ #define PERSISTENT_LOCK(mutex) ((void)0)
+ #define PERSISTENT_UNLOCK(mutex) ((void)0)
+ #endif
+ 
+ #define PERSISTENT_SMALL_LISTS (MEMORY_PERSISTENT_SMALL_MAX / MEMORY_PERSISTENT_ALIGNMENT)
+ #define PERSISTENT_PAGE_SIZE 4096
+ 
+ // Exact-size large lists by page count; bigger blocks share the last list
+ #define PERSISTENT_LARGE_LISTS 64
+ 
+ // Free block link, stored in the freed block itself
+ typedef struct PersistentFreeBlock {
+     struct PersistentFreeBlock* next;
+     size_t size;                // Rounded size (large lists only)
+ } PersistentFreeBlock;
+ 
+ uintptr_t g_persistent_region_begin = 0;
+ uintptr_t g_persistent_region_end = 0;
+ 
+ // Heap state; persistent traffic is rare, so one lock covers it all
+ static uintptr_t g_heap_next = 0;       // Bump pointer
+ static uintptr_t g_extent_end = 0;      // End of opened extents
+ static PersistentFreeBlock* g_small_free[PERSISTENT_SMALL_LISTS];
+ static PersistentFreeBlock* g_large_free[PERSISTENT_LARGE_LISTS + 1];
+ static size_t g_live_blocks = 0;
+ static size_t g_live_bytes = 0;
+ static size_t g_hugetlb_extents = 0;
+ #if MEMORY_THREAD_SAFE
+ static pthread_mutex_t g_heap_lock = PTHREAD_MUTEX_INITIALIZER;
+ #endif
+ 
+ // 16-byte steps up to MEMORY_PERSISTENT_SMALL_MAX, whole pages beyond
+ static size_t persistent_round(size_t size) {
+     if (size <= MEMORY_PERSISTENT_SMALL_MAX) {
+         return (size + MEMORY_PERSISTENT_ALIGNMENT - 1) &
+                ~(size_t)(MEMORY_PERSISTENT_ALIGNMENT - 1);
+     }
+     return (size + PERSISTENT_PAGE_SIZE - 1) & ~(size_t)(PERSISTENT_PAGE_SIZE - 1);
+ }
+ 
+ // Reserve a 2 MiB-aligned range so every extent can be a huge page
+ static bool region_reserve(void) {
+     size_t span = MEMORY_PERSISTENT_REGION_SIZE + MEMORY_PERSISTENT_EXTENT_SIZE;
+     void* base = mmap(
+         NULL, span, PROT_READ | PROT_WRITE,
+         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0
+     );
+     if (base == MAP_FAILED) {
+         return false;
+     }
+ 
+     uintptr_t raw = (uintptr_t)base;
+     uintptr_t begin = (raw + MEMORY_PERSISTENT_EXTENT_SIZE - 1) &
+                       ~(uintptr_t)(MEMORY_PERSISTENT_EXTENT_SIZE - 1);
+     uintptr_t end = begin + MEMORY_PERSISTENT_REGION_SIZE;
+     if (begin > raw) {
+         munmap(base, begin - raw);
+     }
+     if (raw + span > end) {
+         munmap((void*)end, raw + span - end);
+     }
+ #ifdef MADV_HUGEPAGE
+     madvise((void*)begin, MEMORY_PERSISTENT_REGION_SIZE, MADV_HUGEPAGE);
+ #endif
+ 
+     g_heap_next = begin;
+     g_extent_end = begin;
+     __atomic_store_n(&g_persistent_region_end, end, __ATOMIC_RELEASE);
+     __atomic_store_n(&g_persistent_region_begin, begin, __ATOMIC_RELEASE);
+     return true;
+ }
+ 
+ // Open extents up to an address; the heap lock must be held
+ static void extents_open(uintptr_t address) {
+     while (g_extent_end < address) {
+ #if MEMORY_PERSISTENT_HUGETLB && defined(MAP_HUGETLB)
+         void* extent = mmap(
+             (void*)g_extent_end, MEMORY_PERSISTENT_EXTENT_SIZE,
+             PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB, -1, 0
+         );
+         if (extent != MAP_FAILED) {
+             g_hugetlb_extents++;
+         } else {
+             // A failed MAP_FIXED may already have dropped the reservation
+             mmap(
+                 (void*)g_extent_end, MEMORY_PERSISTENT_EXTENT_SIZE,
+                 PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0
+             );
+ #ifdef MADV_HUGEPAGE
+             madvise((void*)g_extent_end, MEMORY_PERSISTENT_EXTENT_SIZE, MADV_HUGEPAGE);
+ #endif
+         }
+ #endif
+         g_extent_end += MEMORY_PERSISTENT_EXTENT_SIZE;
+     }
+ }
+ 
+ static unsigned large_list(size_t rounded) {
+     size_t pages = rounded / PERSISTENT_PAGE_SIZE;
+     return pages > PERSISTENT_LARGE_LISTS ? PERSISTENT_LARGE_LISTS : (unsigned)pages - 1;
+ }
+ 
+ static void large_put(PersistentFreeBlock* block, size_t rounded) {
+     PersistentFreeBlock** list = &g_large_free[large_list(rounded)];
+     block->size = rounded;
+     block->next = *list;
+     *list = block;
+ }
+ 
+ // Unlink a free block and return its page-multiple tail to the lists
+ static void* large_split(PersistentFreeBlock** link, size_t rounded) {
+     PersistentFreeBlock* block = *link;
+     *link = block->next;
+     if (block->size > rounded) {
+         large_put((PersistentFreeBlock*)((char*)block + rounded), block->size - rounded);
+     }
+     return block;
+ }
+ 
+ // Smallest non-empty exact list that fits, then first fit among the rest
+ static void* large_take(size_t rounded) {
+     for (unsigned l = large_list(rounded); l < PERSISTENT_LARGE_LISTS; l++) {
+         if (g_large_free[l]) {
+             return large_split(&g_large_free[l], rounded);
+         }
+     }
+ 
+     PersistentFreeBlock** link = &g_large_free[PERSISTENT_LARGE_LISTS];
+     for (; *link; link = &(*link)->next) {
+         if ((*link)->size >= rounded) {
+             return large_split(link, rounded);
+         }
+     }
+     return NULL;
+ }
+ 
+ void* memory_persistent_allocate(size_t size) {
+     size_t rounded = persistent_round(size);
+     void* memory = NULL;
+ 
+     PERSISTENT_LOCK(&g_heap_lock);
+     if (rounded <= MEMORY_PERSISTENT_SMALL_MAX) {
+         PersistentFreeBlock** list = &g_small_free[rounded / MEMORY_PERSISTENT_ALIGNMENT - 1];
+         if (*list) {
+             memory = *list;
+             *list = (*list)->next;
+         }
+     } else {
+         memory = large_take(rounded);
+     }
+ 
+     if (!memory && (g_heap_next != 0 || region_reserve())) {
+         // Large blocks start on a page so their split tails stay aligned
+         uintptr_t start = g_heap_next;
+         if (rounded > MEMORY_PERSISTENT_SMALL_MAX) {
+             start = (start + PERSISTENT_PAGE_SIZE - 1) &
+                     ~(uintptr_t)(PERSISTENT_PAGE_SIZE - 1);
+         }
+         if (rounded <= g_persistent_region_end - start) {
+             extents_open(start + rounded);
+             g_heap_next = start + rounded;
+             memory = (void*)start;
+         }
+     }
+ 
+     if (memory) {
+         g_live_blocks++;
+         g_live_bytes += size;
+     }
+     PERSISTENT_UNLOCK(&g_heap_lock);
+     return memory;
+ }
+ 
+ void memory_persistent_release(void* memory, size_t size) {
+     size_t rounded = persistent_round(size);
+     PersistentFreeBlock* block = memory;
+ 
+     PERSISTENT_LOCK(&g_heap_lock);
+     if (rounded <= MEMORY_PERSISTENT_SMALL_MAX) {
+         PersistentFreeBlock** list = &g_small_free[rounded / MEMORY_PERSISTENT_ALIGNMENT - 1];
+         block->next = *list;
+         *list = block;
+     } else {
+         large_put(block, rounded);
+     }
+     g_live_blocks--;
+     g_live_bytes -= size;
+     PERSISTENT_UNLOCK(&g_heap_lock);
+ }
+ 
+ // Same rounded size, or a large block that can grow or shrink in place
+ bool memory_persistent_resize(void* memory, size_t size, size_t new_size) {
+     size_t rounded = persistent_round(size);
+     size_t new_rounded = persistent_round(new_size);
+     uintptr_t start = (uintptr_t)memory;
+     bool resized = rounded == new_rounded;
+ 
+     PERSISTENT_LOCK(&g_heap_lock);
+     if (!resized && rounded > MEMORY_PERSISTENT_SMALL_MAX &&
+         new_rounded > MEMORY_PERSISTENT_SMALL_MAX) {
+         if (start + rounded == g_heap_next &&
+             new_rounded <= g_persistent_region_end - start) {
+             // The newest block ends at the bump pointer, which moves with it
+             extents_open(start + new_rounded);
+             g_heap_next = start + new_rounded;
+             resized = true;
+         } else if (new_rounded < rounded) {
+             large_put((PersistentFreeBlock*)(start + new_rounded), rounded - new_rounded);
+             resized = true;
+         }
+     }
+     if (resized) {
+         g_live_bytes += new_size - size;
+     }
+     PERSISTENT_UNLOCK(&g_heap_lock);
+     return resized;
+ }
+ 
+ void memory_persistent_get_stats(MemoryPersistentStats* stats) {
+     PERSISTENT_LOCK(&g_heap_lock);
+     stats->blocks = g_live_blocks;
+     stats->bytes = g_live_bytes;
+     stats->used_bytes = g_heap_next - g_persistent_region_begin;
+     stats->mapped_bytes = g_extent_end - g_persistent_region_begin;
+     stats->hugetlb_extents = g_hugetlb_extents;
+     PERSISTENT_UNLOCK(&g_heap_lock);
+ }
+ 
+ void memory_persistent_forget_all(void) {
+     PERSISTENT_LOCK(&g_heap_lock);
+     g_live_blocks = 0;
+     g_live_bytes = 0;
+     PERSISTENT_UNLOCK(&g_heap_lock);
+ }
@@ -0,0 +1,87 @@
+/**
+ * @file memory_persistent.h
+ * @brief Long-Lived Heap for MEMORY_TYPE_PERSISTENT Blocks
+ *
+ * Persistent blocks are packed into one 2 MiB-aligned reserved range kept
+ * apart from the short-lived heap. The range is advised for transparent
+ * huge pages, or backed by explicit hugetlb pages when
+ * MEMORY_PERSISTENT_HUGETLB is 1 and the system has them reserved.
+ */
+ 
+ #ifndef MEMORY_PERSISTENT_H
+ #define MEMORY_PERSISTENT_H
+ 
+ #include <stdbool.h>
+ #include <stddef.h>
+ #include <stdint.h>
+ 
+ // Persistent Heap Configuration
+ #define MEMORY_PERSISTENT_REGION_SIZE (16ULL << 30)
+ #define MEMORY_PERSISTENT_EXTENT_SIZE (2 * 1024 * 1024)
+ #define MEMORY_PERSISTENT_ALIGNMENT 16
+ #define MEMORY_PERSISTENT_SMALL_MAX 4096
+ 
+ // Map each 2 MiB extent with MAP_HUGETLB (falls back to THP on failure)
+ #ifndef MEMORY_PERSISTENT_HUGETLB
+ #define MEMORY_PERSISTENT_HUGETLB 0
+ #endif
+ 
+ // Persistent heap usage
+ typedef struct {
+     size_t blocks;              // Live persistent blocks
+     size_t bytes;               // Bytes requested by those blocks
+     size_t used_bytes;          // Heap footprint, including free lists
+     size_t mapped_bytes;        // Extents opened so far
+     size_t hugetlb_extents;     // Extents backed by explicit huge pages
+ } MemoryPersistentStats;
+ 
+ // Reserved persistent address range (empty until the first allocation)
+ extern uintptr_t g_persistent_region_begin;
+ extern uintptr_t g_persistent_region_end;
+ 
+ /**
+  * @brief Check whether a pointer lies inside the persistent heap
+  * @param memory Pointer to test
+  * @return true for persistent heap memory
+  */
+ static inline bool memory_persistent_owns(const void* memory) {
+     uintptr_t begin = __atomic_load_n(&g_persistent_region_begin, __ATOMIC_ACQUIRE);
+     uintptr_t end = __atomic_load_n(&g_persistent_region_end, __ATOMIC_RELAXED);
+     return (uintptr_t)memory - begin < end - begin;
+ }
+ 
+ /**
+  * @brief Allocate a block from the persistent heap
+  * @param size Requested size
+  * @return Pointer to memory, or NULL when the heap is exhausted
+  */
+ void* memory_persistent_allocate(size_t size);
+ 
+ /**
+  * @brief Return a persistent block to the heap
+  * @param memory Block from memory_persistent_allocate
+  * @param size Size passed to memory_persistent_allocate
+  */
+ void memory_persistent_release(void* memory, size_t size);
+ 
+ /**
+  * @brief Resize a persistent block without moving it
+  * @param memory Block from memory_persistent_allocate
+  * @param size Size the block currently holds
+  * @param new_size Size wanted
+  * @return true if the block now holds new_size bytes, false if it must move
+  */
+ bool memory_persistent_resize(void* memory, size_t size, size_t new_size);
+ 
+ /**
+  * @brief Get persistent heap usage
+  * @param stats Output statistics
+  */
+ void memory_persistent_get_stats(MemoryPersistentStats* stats);
+ 
+ /**
+  * @brief Drop live block accounting (used by memory_manager_init)
+  */
+ void memory_persistent_forget_all(void);
+ 
+ #endif // MEMORY_PERSISTENT_H
@@ -0,0 +1,279 @@
+/**
+ * @file memory_preload.c
+ * @brief LD_PRELOAD Interposition of the C Allocator
+ *
+ * Built as libmemory_preload.so by compile.sh. Preloading it sends
+ * malloc, calloc, realloc, reallocarray, free, posix_memalign,
+ * aligned_alloc, memalign, valloc and pvalloc of every library in the
+ * process through the tracker, so code that never uses ALLOCATE shows up
+ * in the reports. Blocks are MEMORY_TYPE_DYNAMIC, and each call site is
+ * the return address of the caller.
+ *
+ * Calls made on a thread that is already inside the tracker (glibc
+ * functions the tracker uses, such as pthread_setspecific or dladdr) go
+ * straight to glibc, as does the tracker's own storage (memory_system.h).
+ * Memory glibc handed out that way, or before the shim was loaded, is
+ * untracked; freeing it is reported and passed on to glibc.
+ *
+ *   LD_PRELOAD=./libmemory_preload.so MEMORY_PRELOAD_REPORT=20 program
+ *
+ * prints the 20 largest call sites to stderr at exit (0 for every site).
+ * MEMORY_PRELOAD_SAMPLE=524288 tracks about one allocation per that many
+ * bytes (memory_manager_set_sample_interval) and reports estimates.
+ * MEMORY_PRELOAD_TRACE=16 keeps 16 frames of each tracked allocation's
+ * stack (memory_manager_set_trace_depth), printed under its site.
+ * MEMORY_PRELOAD_GUARD=1 puts each tracked block against a guard page
+ * (memory_manager_set_guard_type), so an overrun faults where it happens;
+ * once the system runs out of mappings the rest come from the normal heap.
+ * Forking while another thread is inside the tracker is not supported.
+ */
+ 
+ #define _GNU_SOURCE
+ 
+ #include <dlfcn.h>
+ #include <errno.h>
+ #include <fcntl.h>
+ #include <malloc.h>
+ #include <unistd.h>
+ #include "memory_guard.h"
+ #include "memory_manager.h"
+ #include "memory_slab.h"
+ #include "memory_system.h"
+ 
+ #if !MEMORY_PRELOAD
+ #error "memory_preload.c must be built with -DMEMORY_PRELOAD=1"
+ #endif
+ 
+ // Untracked pointers are common here, and a header lookup would read
+ // whatever lies in front of them
+ #if MEMORY_HEADER_METADATA || !MEMORY_TRACKING_ENABLED
+ #error "the preload shim needs the tracker's block table"
+ #endif
+ 
+ // Canary mode refuses to hand untracked pointers to glibc
+ #if MEMORY_CANARIES
+ #error "the preload shim cannot be built with MEMORY_CANARIES"
+ #endif
+ 
+ #define PRELOAD_EXPORT __attribute__((visibility("default")))
+ #define PRELOAD_CALLER ((const char*)__builtin_return_address(0))
+ 
+ // Set while this thread runs tracker code
+ static __thread bool t_inside_tracker __attribute__((tls_model("initial-exec")));
+ 
+ static size_t (*g_libc_usable_size)(void*);
+ static int g_report_fd = -1;
+ static bool g_configured;
+ 
+ // Sampling is set up by the first allocation rather than a constructor,
+ // as counters are weighted by the interval a block was tracked under
+ static void preload_configure(void) {
+     const char* interval = getenv("MEMORY_PRELOAD_SAMPLE");
+     if (interval) {
+         memory_manager_set_sample_interval((size_t)strtoul(interval, NULL, 10));
+     }
+     const char* guard = getenv("MEMORY_PRELOAD_GUARD");
+     if (guard && strtoul(guard, NULL, 10) != 0) {
+         memory_manager_set_guard_type(MEMORY_TYPE_DYNAMIC, true);
+     }
+     __atomic_store_n(&g_configured, true, __ATOMIC_RELEASE);
+ }
+ 
+ // Returns false for a re-entrant call, which must go to glibc
+ static inline bool preload_enter(void) {
+     if (__builtin_expect(t_inside_tracker, 0)) {
+         return false;
+     }
+     t_inside_tracker = true;
+     if (__builtin_expect(!__atomic_load_n(&g_configured, __ATOMIC_ACQUIRE), 0)) {
+         preload_configure();
+     }
+     return true;
+ }
+ 
+ static inline void preload_leave(void) {
+     t_inside_tracker = false;
+ }
+ 
+ static bool power_of_two(size_t value) {
+     return value != 0 && (value & (value - 1)) == 0;
+ }
+ 
+ static void* preload_aligned(size_t alignment, size_t size, const char* caller) {
+     if (!power_of_two(alignment)) {
+         errno = EINVAL;
+         return NULL;
+     }
+     if (!preload_enter()) {
+         return __libc_memalign(alignment, size);
+     }
+     void* memory = safe_memory_aligned_allocate(alignment, size ? size : 1, caller,
+                                                 MEMORY_CALLER_LINE,
+                                                 MEMORY_TYPE_DYNAMIC);
+     preload_leave();
+     if (!memory) {
+         errno = ENOMEM;
+     }
+     return memory;
+ }
+ 
+ static void* preload_reallocate(void* memory, size_t size, const char* caller) {
+     if (!preload_enter()) {
+         return __libc_realloc(memory, size);
+     }
+     // realloc(NULL, 0) is malloc(0): a unique pointer
+     if (!memory && size == 0) {
+         size = 1;
+     }
+     void* resized = safe_memory_reallocate(memory, size, caller, MEMORY_CALLER_LINE);
+     preload_leave();
+     if (!resized && size != 0) {
+         errno = ENOMEM;
+     }
+     return resized;
+ }
+ 
+ PRELOAD_EXPORT void* malloc(size_t size) {
+     if (!preload_enter()) {
+         return __libc_malloc(size);
+     }
+     void* memory = safe_memory_allocate(size ? size : 1, PRELOAD_CALLER,
+                                         MEMORY_CALLER_LINE, MEMORY_TYPE_DYNAMIC);
+     preload_leave();
+     if (!memory) {
+         errno = ENOMEM;
+     }
+     return memory;
+ }
+ 
+ PRELOAD_EXPORT void free(void* memory) {
+     // free(NULL) is a valid no-op here, not a diagnostic
+     if (!memory) {
+         return;
+     }
+     if (!preload_enter()) {
+         __libc_free(memory);
+         return;
+     }
+     safe_memory_free(memory, PRELOAD_CALLER, MEMORY_CALLER_LINE);
+     preload_leave();
+ }
+ 
+ PRELOAD_EXPORT void* calloc(size_t count, size_t size) {
+     if (!preload_enter()) {
+         return __libc_calloc(count, size);
+     }
+     if (count == 0 || size == 0) {
+         count = 1;
+         size = 1;
+     }
+     void* memory = safe_memory_callocate(count, size, PRELOAD_CALLER,
+                                          MEMORY_CALLER_LINE, MEMORY_TYPE_DYNAMIC);
+     preload_leave();
+     if (!memory) {
+         errno = ENOMEM;
+     }
+     return memory;
+ }
+ 
+ PRELOAD_EXPORT void* realloc(void* memory, size_t size) {
+     return preload_reallocate(memory, size, PRELOAD_CALLER);
+ }
+ 
+ PRELOAD_EXPORT void* reallocarray(void* memory, size_t count, size_t size) {
+     size_t total;
+     if (__builtin_mul_overflow(count, size, &total)) {
+         errno = ENOMEM;
+         return NULL;
+     }
+     return preload_reallocate(memory, total, PRELOAD_CALLER);
+ }
+ 
+ PRELOAD_EXPORT int posix_memalign(void** memory, size_t alignment, size_t size) {
+     if (!power_of_two(alignment) || alignment % sizeof(void*) != 0) {
+         return EINVAL;
+     }
+     int saved = errno;
+     void* aligned = preload_aligned(alignment, size, PRELOAD_CALLER);
+     errno = saved;
+     if (!aligned) {
+         return ENOMEM;
+     }
+     *memory = aligned;
+     return 0;
+ }
+ 
+ PRELOAD_EXPORT void* aligned_alloc(size_t alignment, size_t size) {
+     return preload_aligned(alignment, size, PRELOAD_CALLER);
+ }
+ 
+ PRELOAD_EXPORT void* memalign(size_t alignment, size_t size) {
+     return preload_aligned(alignment, size, PRELOAD_CALLER);
+ }
+ 
+ PRELOAD_EXPORT void* valloc(size_t size) {
+     return preload_aligned((size_t)sysconf(_SC_PAGESIZE), size, PRELOAD_CALLER);
+ }
+ 
+ PRELOAD_EXPORT void* pvalloc(size_t size) {
+     size_t page = (size_t)sysconf(_SC_PAGESIZE);
+     return preload_aligned(page, (size + page - 1) & ~(page - 1), PRELOAD_CALLER);
+ }
+ 
+ // Slab and guarded blocks are sized by their heap; everything else came
+ // from glibc
+ PRELOAD_EXPORT size_t malloc_usable_size(void* memory) {
+     if (!memory) {
+         return 0;
+     }
+     if (memory_slab_owns(memory)) {
+         return memory_slab_usable_size(memory);
+     }
+     if (memory_guard_owns(memory)) {
+         return memory_guard_usable_size(memory);
+     }
+ 
+     size_t (*usable_size)(void*) =
+         __atomic_load_n(&g_libc_usable_size, __ATOMIC_ACQUIRE);
+     if (!usable_size) {
+         bool entered = preload_enter();
+         usable_size = (size_t (*)(void*))dlsym(RTLD_NEXT, "malloc_usable_size");
+         if (entered) {
+             preload_leave();
+         }
+         if (!usable_size) {
+             return 0;
+         }
+         __atomic_store_n(&g_libc_usable_size, usable_size, __ATOMIC_RELEASE);
+     }
+     return usable_size(memory);
+ }
+ 
+ // Programs that close stderr on exit (coreutils) still get the report.
+ // Traces start here rather than on the first allocation, as loading the
+ // unwinder is not safe while the C library is still starting up.
+ __attribute__((constructor))
+ static void preload_open_report(void) {
+     if (getenv("MEMORY_PRELOAD_REPORT")) {
+         g_report_fd = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 3);
+     }
+     const char* depth = getenv("MEMORY_PRELOAD_TRACE");
+     if (depth) {
+         bool entered = preload_enter();
+         memory_manager_set_trace_depth((unsigned)strtoul(depth, NULL, 10));
+         if (entered) {
+             preload_leave();
+         }
+     }
+ }
+ 
+ __attribute__((destructor))
+ static void preload_report(void) {
+     const char* limit = getenv("MEMORY_PRELOAD_REPORT");
+     FILE* stream = limit && g_report_fd >= 0 ? fdopen(g_report_fd, "w") : NULL;
+     if (!stream) {
+         return;
+     }
+     write_site_report(stream, (size_t)strtoul(limit, NULL, 10));
+     fclose(stream);
+ }
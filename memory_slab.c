@@ -0,0 +1,341 @@
+/**
+ * @file memory_slab.c
+ * @brief Size-Class Slab Allocator Implementation
+ */
+ 
+ #define _DEFAULT_SOURCE
+ 
+ #include <sys/mman.h>
+ #include "memory_slab.h"
+ 
+ #if MEMORY_THREAD_SAFE
+ #define SLAB_LOCK(mutex) pthread_mutex_lock(mutex)
+ #define SLAB_UNLOCK(mutex) pthread_mutex_unlock(mutex)
+ #else
+ #define SLAB_LOCK(mutex) ((void)0)
+ #define SLAB_UNLOCK(mutex) ((void)0)
+ #endif
+ 
+ #define SLAB_NO_CLASS UINT32_MAX
+ 
+ // Empty slabs kept committed before pages go back to the kernel
+ #define SLAB_EMPTY_RETAIN 64
+ 
+ // Size classes: 16-byte steps up to 64, then quarter steps per power of
+ // two up to MEMORY_SLAB_MAX_OBJECT
+ static const uint16_t g_size_classes[MEMORY_SIZE_CLASSES] = {
+     16, 32, 48, 64, 80, 96, 112, 128, 160, 192,
+     224, 256, 320, 384, 448, 512, 640, 768, 896, 1024
+ };
+ 
+ // Slab header; objects follow the entry array
+ typedef struct MemorySlab {
+     struct MemorySlab* next;    // Partial or empty list link
+     struct MemorySlab* previous;
+     uint32_t size_class;        // SLAB_NO_CLASS while in the empty pool
+     uint32_t object_size;
+     uint32_t reciprocal;        // ceil(2^32 / object_size) for indexing
+     uint32_t capacity;          // Objects per slab
+     uint32_t in_use;            // Objects handed out (live or cached)
+     uint32_t free_head;         // First free object index + 1
+     uint32_t bump;              // Objects at or above this never used
+     bool partial;               // Linked on the class partial list
+     uintptr_t objects;          // Address of object 0
+     MemorySlabEntry entries[];
+ } MemorySlab;
+ 
+ // Per-class state
+ typedef struct {
+ #if MEMORY_THREAD_SAFE
+     pthread_mutex_t lock;
+ #endif
+     MemorySlab* partial;        // Slabs with free objects
+     size_t slab_count;
+ } __attribute__((aligned(64))) MemorySlabClass;
+ 
+ uintptr_t g_slab_region_begin = 0;
+ uintptr_t g_slab_region_end = 0;
+ 
+ static MemorySlabClass g_slab_classes[MEMORY_SIZE_CLASSES] = {
+ #if MEMORY_THREAD_SAFE
+     [0 ... MEMORY_SIZE_CLASSES - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+ #endif
+ };
+ 
+ // Region state: carving pointer and pool of empty slabs
+ static uintptr_t g_region_next = 0;
+ static MemorySlab* g_empty_slabs = NULL;
+ static size_t g_empty_count = 0;
+ #if MEMORY_THREAD_SAFE
+ static pthread_mutex_t g_region_lock = PTHREAD_MUTEX_INITIALIZER;
+ #endif
+ 
+ unsigned memory_size_class(size_t size) {
+     if (size <= 64) {
+         return (unsigned)((size + 15) / 16) - 1;
+     }
+     unsigned shift = 63 - (unsigned)__builtin_clzll(size - 1);
+     unsigned quarter = (unsigned)((size - 1) >> (shift - 2)) & 3;
+     return 4 + (shift - 6) * 4 + quarter;
+ }
+ 
+ size_t memory_size_class_bytes(unsigned size_class) {
+     return g_size_classes[size_class];
+ }
+ 
+ static MemorySlab* slab_of(const void* object) {
+     return (MemorySlab*)((uintptr_t)object & ~(uintptr_t)(MEMORY_SLAB_SIZE - 1));
+ }
+ 
+ static uint32_t slab_index(const MemorySlab* slab, const void* object) {
+     uint64_t offset = (uintptr_t)object - slab->objects;
+     return (uint32_t)((offset * slab->reciprocal) >> 32);
+ }
+ 
+ // Reserve the whole region up front; pages are committed on first touch
+ static bool region_reserve(void) {
+     size_t length = MEMORY_SLAB_REGION_SIZE + MEMORY_SLAB_SIZE;
+     void* base = mmap(
+         NULL, length, PROT_READ | PROT_WRITE,
+         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0
+     );
+     if (base == MAP_FAILED) {
+         return false;
+     }
+ 
+     uintptr_t begin = ((uintptr_t)base + MEMORY_SLAB_SIZE - 1) &
+                       ~(uintptr_t)(MEMORY_SLAB_SIZE - 1);
+     g_region_next = begin;
+     __atomic_store_n(&g_slab_region_end, begin + MEMORY_SLAB_REGION_SIZE,
+                      __ATOMIC_RELEASE);
+     __atomic_store_n(&g_slab_region_begin, begin, __ATOMIC_RELEASE);
+     return true;
+ }
+ 
+ // Take an empty slab from the pool or carve a new one
+ static MemorySlab* slab_create(unsigned size_class) {
+     SLAB_LOCK(&g_region_lock);
+     MemorySlab* slab = g_empty_slabs;
+     if (slab) {
+         g_empty_slabs = slab->next;
+         g_empty_count--;
+     } else if ((g_region_next != 0 || region_reserve()) &&
+                g_region_next < g_slab_region_end) {
+         slab = (MemorySlab*)g_region_next;
+         g_region_next += MEMORY_SLAB_SIZE;
+     }
+ 
+     if (slab) {
+         uint32_t object_size = g_size_classes[size_class];
+         size_t header = sizeof(MemorySlab);
+         uint32_t capacity = (uint32_t)((MEMORY_SLAB_SIZE - header - 16) /
+                                        (object_size + sizeof(MemorySlabEntry)));
+         size_t entries = capacity * sizeof(MemorySlabEntry);
+ 
+         slab->next = NULL;
+         slab->previous = NULL;
+         slab->object_size = object_size;
+         slab->reciprocal = (uint32_t)((1ULL << 32) / object_size + 1);
+         slab->capacity = capacity;
+         slab->in_use = 0;
+         slab->free_head = 0;
+         slab->bump = 0;
+         slab->partial = false;
+         slab->objects = ((uintptr_t)slab + header + entries + 15) & ~(uintptr_t)15;
+         memset(slab->entries, 0, entries);
+         __atomic_store_n(&slab->size_class, size_class, __ATOMIC_RELEASE);
+     }
+     SLAB_UNLOCK(&g_region_lock);
+     return slab;
+ }
+ 
+ // Pool an empty slab, giving its pages back once the pool is large
+ static void slab_destroy(MemorySlab* slab) {
+     SLAB_LOCK(&g_region_lock);
+     __atomic_store_n(&slab->size_class, SLAB_NO_CLASS, __ATOMIC_RELEASE);
+     if (g_empty_count >= SLAB_EMPTY_RETAIN) {
+         uintptr_t end = (uintptr_t)slab + MEMORY_SLAB_SIZE;
+         uintptr_t first = (slab->objects + 4095) & ~(uintptr_t)4095;
+         if (first < end) {
+             madvise((void*)first, end - first, MADV_DONTNEED);
+         }
+     }
+     slab->next = g_empty_slabs;
+     g_empty_slabs = slab;
+     g_empty_count++;
+     SLAB_UNLOCK(&g_region_lock);
+ }
+ 
+ static void partial_push(MemorySlabClass* slab_class, MemorySlab* slab) {
+     slab->previous = NULL;
+     slab->next = slab_class->partial;
+     if (slab_class->partial) {
+         slab_class->partial->previous = slab;
+     }
+     slab_class->partial = slab;
+     slab->partial = true;
+ }
+ 
+ static void partial_remove(MemorySlabClass* slab_class, MemorySlab* slab) {
+     if (slab->previous) {
+         slab->previous->next = slab->next;
+     } else {
+         slab_class->partial = slab->next;
+     }
+     if (slab->next) {
+         slab->next->previous = slab->previous;
+     }
+     slab->partial = false;
+ }
+ 
+ size_t memory_slab_refill(unsigned size_class, void** objects, size_t count) {
+     MemorySlabClass* slab_class = &g_slab_classes[size_class];
+     size_t taken = 0;
+ 
+     SLAB_LOCK(&slab_class->lock);
+     while (taken < count) {
+         MemorySlab* slab = slab_class->partial;
+         if (!slab) {
+             slab = slab_create(size_class);
+             if (!slab) {
+                 break;
+             }
+             partial_push(slab_class, slab);
+             slab_class->slab_count++;
+         }
+ 
+         while (taken < count && slab->in_use < slab->capacity) {
+             uint32_t index;
+             if (slab->free_head != 0) {
+                 index = slab->free_head - 1;
+                 memcpy(&slab->free_head,
+                        (void*)(slab->objects + (uintptr_t)index * slab->object_size),
+                        sizeof(uint32_t));
+             } else {
+                 index = slab->bump++;
+             }
+             objects[taken++] = (void*)(slab->objects +
+                                        (uintptr_t)index * slab->object_size);
+             slab->in_use++;
+         }
+ 
+         if (slab->in_use == slab->capacity) {
+             partial_remove(slab_class, slab);
+         }
+     }
+     SLAB_UNLOCK(&slab_class->lock);
+     return taken;
+ }
+ 
+ void memory_slab_release(void* const* objects, size_t count) {
+     if (count == 0) {
+         return;
+     }
+ 
+     unsigned size_class = slab_of(objects[0])->size_class;
+     MemorySlabClass* slab_class = &g_slab_classes[size_class];
+ 
+     SLAB_LOCK(&slab_class->lock);
+     for (size_t i = 0; i < count; i++) {
+         MemorySlab* slab = slab_of(objects[i]);
+         uint32_t index = slab_index(slab, objects[i]);
+ 
+         memcpy(objects[i], &slab->free_head, sizeof(uint32_t));
+         slab->free_head = index + 1;
+         slab->in_use--;
+ 
+         // Keep one slab per class warm; pool the rest once empty
+         if (slab->in_use == 0 && slab_class->slab_count > 1) {
+             if (slab->partial) {
+                 partial_remove(slab_class, slab);
+             }
+             slab_class->slab_count--;
+             slab_destroy(slab);
+         } else if (!slab->partial) {
+             partial_push(slab_class, slab);
+         }
+     }
+     SLAB_UNLOCK(&slab_class->lock);
+ }
+ 
+ void memory_slab_record(
+     void* object,
+     size_t size,
+     uint32_t site_id,
+     MemoryAllocationType type,
+     uint64_t timestamp
+ ) {
+     MemorySlab* slab = slab_of(object);
+     MemorySlabEntry* entry = &slab->entries[slab_index(slab, object)];
+     entry->type = (uint8_t)type;
+     entry->status = MEMORY_STATUS_ALLOCATED;
+     entry->site_id = site_id;
+     entry->timestamp = timestamp;
+     __atomic_store_n(&entry->size, (uint16_t)size, __ATOMIC_RELEASE);
+ }
+ 
+ MemorySlabEntry memory_slab_entry(const void* object) {
+     MemorySlab* slab = slab_of(object);
+     return slab->entries[slab_index(slab, object)];
+ }
+ 
+ MemorySlabEntry memory_slab_clear(void* object) {
+     MemorySlab* slab = slab_of(object);
+     MemorySlabEntry* entry = &slab->entries[slab_index(slab, object)];
+     MemorySlabEntry previous = *entry;
+     __atomic_store_n(&entry->size, 0, __ATOMIC_RELEASE);
+     return previous;
+ }
+ 
+ bool memory_slab_flag_corrupted(void* object, const MemorySlabEntry* expected) {
+     MemorySlab* slab = slab_of(object);
+     MemorySlabEntry* entry = &slab->entries[slab_index(slab, object)];
+     if (__atomic_load_n(&entry->size, __ATOMIC_ACQUIRE) != expected->size ||
+         entry->timestamp != expected->timestamp ||
+         entry->site_id != expected->site_id) {
+         return false;
+     }
+     entry->status = MEMORY_STATUS_CORRUPTED;
+     return true;
+ }
+ 
+ size_t memory_slab_usable_size(const void* object) {
+     return slab_of(object)->object_size;
+ }
+ 
+ // Entries are written without locks by their owners, so a concurrent
+ // walk may miss blocks allocated or freed while it runs
+ void memory_slab_for_each(MemorySlabVisitor visitor, void* context) {
+     SLAB_LOCK(&g_region_lock);
+     for (uintptr_t address = g_slab_region_begin; address < g_region_next;
+          address += MEMORY_SLAB_SIZE) {
+         MemorySlab* slab = (MemorySlab*)address;
+         if (slab->size_class == SLAB_NO_CLASS) {
+             continue;
+         }
+ 
+         uint32_t used = __atomic_load_n(&slab->bump, __ATOMIC_RELAXED);
+         for (uint32_t i = 0; i < used; i++) {
+             if (__atomic_load_n(&slab->entries[i].size, __ATOMIC_ACQUIRE) != 0) {
+                 MemorySlabEntry entry = slab->entries[i];
+                 visitor((void*)(slab->objects + (uintptr_t)i * slab->object_size),
+                         &entry, context);
+             }
+         }
+     }
+     SLAB_UNLOCK(&g_region_lock);
+ }
+ 
+ void memory_slab_forget_all(void) {
+     SLAB_LOCK(&g_region_lock);
+     for (uintptr_t address = g_slab_region_begin; address < g_region_next;
+          address += MEMORY_SLAB_SIZE) {
+         MemorySlab* slab = (MemorySlab*)address;
+         if (slab->size_class != SLAB_NO_CLASS) {
+             for (uint32_t i = 0; i < slab->bump; i++) {
+                 slab->entries[i].size = 0;
+             }
+         }
+     }
+     SLAB_UNLOCK(&g_region_lock);
+ }
@@ -0,0 +1,144 @@
+/**
+ * @file memory_slab.h
+ * @brief Size-Class Slab Allocator Backend
+ *
+ * Small blocks are carved from 64 KiB slabs inside one reserved address
+ * range. Each slab header holds a tracking entry per object, so a block
+ * is identified and untracked on free by address arithmetic alone.
+ */
+ 
+ #ifndef MEMORY_SLAB_H
+ #define MEMORY_SLAB_H
+ 
+ #include <stdbool.h>
+ #include <stddef.h>
+ #include <stdint.h>
+ #include "memory_manager.h"
+ 
+ // Slab Configuration
+ #define MEMORY_SLAB_SIZE (64 * 1024)
+ #define MEMORY_SLAB_REGION_SIZE (4ULL << 30)
+ #define MEMORY_SLAB_MAX_OBJECT 1024
+ #define MEMORY_SIZE_CLASSES 20
+ 
+ // Per-object tracking entry kept in the slab header
+ typedef struct {
+     uint16_t size;              // Requested size (0 = not live)
+     uint8_t type;               // MemoryAllocationType
+     uint8_t status;             // MemoryStatus
+     uint32_t site_id;           // Interned allocation call site
+     uint64_t timestamp;         // Allocation timestamp
+ } MemorySlabEntry;
+ 
+ // Reserved slab address range (empty until the first slab is carved)
+ extern uintptr_t g_slab_region_begin;
+ extern uintptr_t g_slab_region_end;
+ 
+ /**
+  * @brief Check whether a pointer lies inside the slab region
+  * @param object Pointer to test
+  * @return true for slab objects
+  */
+ static inline bool memory_slab_owns(const void* object) {
+     uintptr_t begin = __atomic_load_n(&g_slab_region_begin, __ATOMIC_ACQUIRE);
+     uintptr_t end = __atomic_load_n(&g_slab_region_end, __ATOMIC_RELAXED);
+     return (uintptr_t)object - begin < end - begin;
+ }
+ 
+ /**
+  * @brief Map a request size to its size class
+  * @param size Requested size, 1..MEMORY_SLAB_MAX_OBJECT
+  * @return Size class index
+  */
+ unsigned memory_size_class(size_t size);
+ 
+ /**
+  * @brief Get the object size of a size class
+  * @param size_class Size class index
+  * @return Object size in bytes
+  */
+ size_t memory_size_class_bytes(unsigned size_class);
+ 
+ /**
+  * @brief Take free objects of one size class from the slabs
+  * @param size_class Size class index
+  * @param objects Output array
+  * @param count Objects wanted
+  * @return Objects written to the array (0 when out of memory)
+  */
+ size_t memory_slab_refill(unsigned size_class, void** objects, size_t count);
+ 
+ /**
+  * @brief Return untracked objects of one size class to their slabs
+  * @param objects Objects to release
+  * @param count Number of objects
+  */
+ void memory_slab_release(void* const* objects, size_t count);
+ 
+ /**
+  * @brief Record a live allocation in its slab header entry
+  * @param object Slab object handed to the caller
+  * @param size Requested size
+  * @param site_id Interned call site
+  * @param type Memory allocation type
+  * @param timestamp Allocation timestamp
+  */
+ void memory_slab_record(
+     void* object,
+     size_t size,
+     uint32_t site_id,
+     MemoryAllocationType type,
+     uint64_t timestamp
+ );
+ 
+ /**
+  * @brief Read the tracking entry of a slab object
+  * @param object Slab object
+  * @return Current entry (size 0 if the object is not live)
+  */
+ MemorySlabEntry memory_slab_entry(const void* object);
+ 
+ /**
+  * @brief Clear the tracking entry of a slab object
+  * @param object Slab object being freed
+  * @return Previous entry (size 0 if the object was not live)
+  */
+ MemorySlabEntry memory_slab_clear(void* object);
+ 
+ /**
+  * @brief Flag a live slab object as corrupted
+  * @param object Slab object
+  * @param expected Entry the object was checked against; if the entry has
+  *                 changed since, the object was freed or reused and is
+  *                 left alone
+  * @return true if the entry was flagged
+  */
+ bool memory_slab_flag_corrupted(void* object, const MemorySlabEntry* expected);
+ 
+ /**
+  * @brief Get the object size of the slab holding an object
+  * @param object Slab object
+  * @return Usable bytes
+  */
+ size_t memory_slab_usable_size(const void* object);
+ 
+ // Visitor for live slab objects
+ typedef void (*MemorySlabVisitor)(
+     void* object,
+     const MemorySlabEntry* entry,
+     void* context
+ );
+ 
+ /**
+  * @brief Visit every live slab object
+  * @param visitor Callback invoked per live object
+  * @param context Opaque pointer passed to the visitor
+  */
+ void memory_slab_for_each(MemorySlabVisitor visitor, void* context);
+ 
+ /**
+  * @brief Drop every tracking entry (used by memory_manager_init)
+  */
+ void memory_slab_forget_all(void);
+ 
+ #endif // MEMORY_SLAB_H
@@ -0,0 +1,823 @@
+/**
+ * @file memory_snapshot.c
+ * @brief Tracker Snapshot Export Implementation
+ */
+ 
+ #define _GNU_SOURCE
+ 
+ #include <dlfcn.h>
+ #include <errno.h>
+ #include <limits.h>
+ #include <link.h>
+ #include <stdarg.h>
+ #include <time.h>
+ #include <unistd.h>
+ #include "memory_manager.h"
+ #include "memory_arena.h"
+ #include "memory_persistent.h"
+ #include "memory_snapshot.h"
+ #include "memory_trace.h"
+ 
+ // Streaming output: a caller buffer, or a staging buffer drained to an fd
+ typedef struct {
+     unsigned char* buffer;
+     size_t capacity;
+     size_t length;              // Bytes held in buffer
+     size_t total;               // Bytes produced so far
+     int fd;                     // -1 when writing into a caller buffer
+     bool failed;                // A write to fd failed
+     MemorySnapshotFormat format;
+     uint64_t site_records;
+     uint64_t block_records;
+ } SnapshotWriter;
+ 
+ static void writer_drain(SnapshotWriter* writer) {
+     size_t done = 0;
+     while (done < writer->length && !writer->failed) {
+         ssize_t written = write(writer->fd, writer->buffer + done,
+                                 writer->length - done);
+         if (written < 0 && errno != EINTR) {
+             writer->failed = true;
+         } else if (written > 0) {
+             done += (size_t)written;
+         }
+     }
+     writer->length = 0;
+ }
+ 
+ static void writer_put(SnapshotWriter* writer, const void* data, size_t size) {
+     const unsigned char* bytes = data;
+     writer->total += size;
+ 
+     // Caller buffer: keep what fits, count the rest
+     if (writer->fd < 0) {
+         size_t room = writer->capacity - writer->length;
+         size_t copied = size < room ? size : room;
+         if (copied > 0) {
+             memcpy(writer->buffer + writer->length, bytes, copied);
+             writer->length += copied;
+         }
+         return;
+     }
+ 
+     while (size > 0) {
+         if (writer->length == writer->capacity) {
+             writer_drain(writer);
+         }
+         size_t room = writer->capacity - writer->length;
+         size_t copied = size < room ? size : room;
+         memcpy(writer->buffer + writer->length, bytes, copied);
+         writer->length += copied;
+         bytes += copied;
+         size -= copied;
+     }
+ }
+ 
+ static void writer_printf(SnapshotWriter* writer, const char* format, ...) {
+     char line[256];
+     va_list arguments;
+     va_start(arguments, format);
+     int length = vsnprintf(line, sizeof(line), format, arguments);
+     va_end(arguments);
+     if (length > 0) {
+         size_t size = (size_t)length;
+         writer_put(writer, line, size < sizeof(line) ? size : sizeof(line) - 1);
+     }
+ }
+ 
+ static void put_u8(SnapshotWriter* writer, uint8_t value) {
+     writer_put(writer, &value, sizeof(value));
+ }
+ 
+ static void put_u16(SnapshotWriter* writer, uint16_t value) {
+     writer_put(writer, &value, sizeof(value));
+ }
+ 
+ static void put_u32(SnapshotWriter* writer, uint32_t value) {
+     writer_put(writer, &value, sizeof(value));
+ }
+ 
+ static void put_u64(SnapshotWriter* writer, uint64_t value) {
+     writer_put(writer, &value, sizeof(value));
+ }
+ 
+ static void put_f64(SnapshotWriter* writer, double value) {
+     writer_put(writer, &value, sizeof(value));
+ }
+ 
+ // Quote a string for JSON, escaping quotes, backslashes and controls
+ static void put_json_string(SnapshotWriter* writer, const char* text) {
+     writer_put(writer, "\"", 1);
+     const char* run = text;
+     for (const char* c = text; *c; c++) {
+         unsigned char ch = (unsigned char)*c;
+         if (ch != '"' && ch != '\\' && ch >= 0x20) {
+             continue;
+         }
+         writer_put(writer, run, (size_t)(c - run));
+         if (ch == '"' || ch == '\\') {
+             writer_printf(writer, "\\%c", ch);
+         } else {
+             writer_printf(writer, "\\u%04x", ch);
+         }
+         run = c + 1;
+     }
+     writer_put(writer, run, strlen(run));
+     writer_put(writer, "\"", 1);
+ }
+ 
+ static void write_header(SnapshotWriter* writer) {
+     uint64_t timestamp = memory_manager_timestamp();
+     double ns_per_tick = memory_manager_ns_per_tick();
+ 
+     if (writer->format == MEMORY_SNAPSHOT_BINARY) {
+         writer_put(writer, "MMSNAP", 6);
+         put_u16(writer, MEMORY_SNAPSHOT_VERSION);
+         put_u32(writer, 0x01020304);
+         put_u64(writer, timestamp);
+         put_f64(writer, ns_per_tick);
+     } else {
+         writer_printf(
+             writer, "{\"version\":%d,\"timestamp\":%llu,\"ns_per_tick\":%.9g,\n",
+             MEMORY_SNAPSHOT_VERSION, (unsigned long long)timestamp, ns_per_tick
+         );
+     }
+ }
+ 
+ static void write_totals(SnapshotWriter* writer) {
+     uint64_t blocks = get_current_block_count();
+     uint64_t bytes = get_total_allocated_memory();
+     MemoryArenaStats arena;
+     memory_arena_get_stats(&arena);
+     MemoryPersistentStats persistent;
+     memory_persistent_get_stats(&persistent);
+ 
+     if (writer->format == MEMORY_SNAPSHOT_BINARY) {
+         put_u8(writer, 'T');
+         put_u64(writer, blocks);
+         put_u64(writer, bytes);
+         put_u64(writer, arena.blocks);
+         put_u64(writer, arena.bytes);
+         put_u64(writer, persistent.blocks);
+         put_u64(writer, persistent.bytes);
+     } else {
+         writer_printf(
+             writer,
+             "\"totals\":{\"blocks\":%llu,\"bytes\":%llu,\"arena_blocks\":%zu,"
+             "\"arena_bytes\":%zu,\"persistent_blocks\":%zu,\"persistent_bytes\":%zu},\n",
+             (unsigned long long)blocks, (unsigned long long)bytes,
+             arena.blocks, arena.bytes, persistent.blocks, persistent.bytes
+         );
+     }
+ }
+ 
+ static void write_site(SnapshotWriter* writer, const MemorySiteProfile* profile) {
+     const char* filename = profile->site.filename ? profile->site.filename : "";
+ 
+     // Caller sites are named by their formatted return address
+     char caller[256];
+     if (profile->site.line_number == MEMORY_CALLER_LINE) {
+         memory_manager_format_site(&profile->site, caller, sizeof(caller));
+         filename = caller;
+     }
+ 
+     if (writer->format == MEMORY_SNAPSHOT_BINARY) {
+         size_t length = strlen(filename);
+         if (length > UINT16_MAX) {
+             length = UINT16_MAX;
+         }
+         put_u8(writer, 'S');
+         put_u32(writer, profile->site_id);
+         put_u8(writer, (uint8_t)profile->site.type);
+         put_u32(writer, (uint32_t)profile->site.line_number);
+         put_u16(writer, (uint16_t)length);
+         writer_put(writer, filename, length);
+         put_u64(writer, profile->live_blocks);
+         put_u64(writer, profile->live_bytes);
+         put_u64(writer, profile->peak_bytes);
+         put_u64(writer, profile->allocations);
+         put_u64(writer, profile->allocated_bytes);
+         put_f64(writer, profile->allocations_per_second);
+     } else {
+         writer_printf(writer, "%s{\"id\":%u,\"file\":",
+                       writer->site_records ? ",\n" : "", profile->site_id);
+         put_json_string(writer, filename);
+         writer_printf(
+             writer,
+             ",\"line\":%d,\"type\":%d,\"live_blocks\":%llu,\"live_bytes\":%llu,"
+             "\"peak_bytes\":%llu,\"allocations\":%llu,\"allocated_bytes\":%llu,"
+             "\"allocations_per_second\":%.1f}",
+             profile->site.line_number, profile->site.type,
+             (unsigned long long)profile->live_blocks,
+             (unsigned long long)profile->live_bytes,
+             (unsigned long long)profile->peak_bytes,
+             (unsigned long long)profile->allocations,
+             (unsigned long long)profile->allocated_bytes,
+             profile->allocations_per_second
+         );
+     }
+     writer->site_records++;
+ }
+ 
+ static void write_sites(SnapshotWriter* writer) {
+     if (writer->format == MEMORY_SNAPSHOT_JSON) {
+         writer_printf(writer, "\"sites\":[\n");
+     }
+ 
+     size_t count = memory_manager_get_site_count();
+     MemorySiteProfile* profiles =
+         count ? malloc(count * sizeof(MemorySiteProfile)) : NULL;
+     if (profiles) {
+         count = memory_manager_get_site_profiles(profiles, count);
+         for (size_t i = 0; i < count; i++) {
+             write_site(writer, &profiles[i]);
+         }
+         free(profiles);
+     }
+ 
+     if (writer->format == MEMORY_SNAPSHOT_JSON) {
+         writer_printf(writer, "],\n\"blocks\":[\n");
+     }
+ }
+ 
+ static void write_block(const MemoryBlock* block, void* context) {
+     SnapshotWriter* writer = context;
+ 
+     if (writer->format == MEMORY_SNAPSHOT_BINARY) {
+         // Block records dominate, so each is packed and copied once
+         unsigned char record[31];
+         uint64_t pointer = (uint64_t)(uintptr_t)block->pointer;
+         uint64_t size = block->size;
+         record[0] = 'B';
+         memcpy(record + 1, &pointer, 8);
+         memcpy(record + 9, &size, 8);
+         memcpy(record + 17, &block->timestamp, 8);
+         memcpy(record + 25, &block->site_id, 4);
+         record[29] = (uint8_t)block->type;
+         record[30] = (uint8_t)block->status;
+         writer_put(writer, record, sizeof(record));
+     } else {
+         writer_printf(
+             writer,
+             "%s{\"pointer\":\"%p\",\"size\":%zu,\"timestamp\":%llu,"
+             "\"site\":%u,\"type\":%d,\"status\":%d}",
+             writer->block_records ? ",\n" : "", block->pointer, block->size,
+             (unsigned long long)block->timestamp, block->site_id,
+             block->type, block->status
+         );
+     }
+     writer->block_records++;
+ }
+ 
+ static void write_end(SnapshotWriter* writer) {
+     if (writer->format == MEMORY_SNAPSHOT_BINARY) {
+         put_u8(writer, 'E');
+         put_u64(writer, writer->site_records);
+         put_u64(writer, writer->block_records);
+     } else {
+         writer_printf(writer, "]}\n");
+     }
+ }
+ 
+ static const char* const g_type_names[MEMORY_TYPE_COUNT] = {
+     "static", "dynamic", "temporary", "persistent"
+ };
+ 
+ // Frames of a site's stack, innermost first; a caller site without a
+ // trace is its own single frame
+ static size_t site_frames(const MemoryCallSite* site, const void** frames) {
+     size_t depth = memory_trace_frames(site->trace_id, frames, MEMORY_TRACE_MAX_DEPTH);
+     if (depth == 0 && site->line_number == MEMORY_CALLER_LINE && site->caller) {
+         frames[depth++] = site->caller;
+     }
+     return depth;
+ }
+ 
+ // Copy the profiles of every site that allocated or holds memory
+ static size_t collect_profiles(MemorySiteProfile** profiles) {
+     size_t count = memory_manager_get_site_count();
+     *profiles = count ? malloc(count * sizeof(MemorySiteProfile)) : NULL;
+     if (!*profiles) {
+         return 0;
+     }
+     return memory_manager_get_site_profiles(*profiles, count);
+ }
+ 
+ // ============================================================================
+ // FOLDED STACKS
+ // ============================================================================
+ 
+ // Name a return address by its symbol, else by its object and offset.
+ // The address is stepped back into the call instruction first.
+ static void put_frame_name(SnapshotWriter* writer, const void* address) {
+     const void* call = (const char*)address - 1;
+     Dl_info info;
+     if (!dladdr(call, &info) || !info.dli_fname) {
+         writer_printf(writer, "%p", address);
+     } else if (info.dli_sname) {
+         writer_put(writer, info.dli_sname, strlen(info.dli_sname));
+     } else {
+         const char* object = strrchr(info.dli_fname, '/');
+         object = object ? object + 1 : info.dli_fname;
+         writer_put(writer, object, strlen(object));
+         writer_printf(writer, "+0x%zx",
+                       (size_t)((uintptr_t)address - (uintptr_t)info.dli_fbase));
+     }
+ }
+ 
+ // One line per site: frames outermost first, the source line last, then
+ // the site's live or cumulative bytes
+ static void write_folded(SnapshotWriter* writer) {
+     MemorySiteProfile* profiles;
+     size_t count = collect_profiles(&profiles);
+ 
+     for (size_t i = 0; i < count; i++) {
+         const MemorySiteProfile* profile = &profiles[i];
+         uint64_t bytes = writer->format == MEMORY_SNAPSHOT_FOLDED_LIVE ?
+             profile->live_bytes : profile->allocated_bytes;
+         if (bytes == 0) {
+             continue;
+         }
+ 
+         const void* frames[MEMORY_TRACE_MAX_DEPTH];
+         size_t depth = site_frames(&profile->site, frames);
+         for (size_t frame = depth; frame > 0; frame--) {
+             put_frame_name(writer, frames[frame - 1]);
+             if (frame > 1 || profile->site.line_number != MEMORY_CALLER_LINE) {
+                 writer_put(writer, ";", 1);
+             }
+         }
+         if (profile->site.line_number != MEMORY_CALLER_LINE) {
+             writer_put(writer, profile->site.filename, strlen(profile->site.filename));
+             writer_printf(writer, ":%d", profile->site.line_number);
+         } else if (depth == 0) {
+             writer_put(writer, "[unknown]", 9);
+         }
+         writer_printf(writer, " %llu\n", (unsigned long long)bytes);
+         writer->site_records++;
+     }
+     free(profiles);
+ }
+ 
+ // ============================================================================
+ // PPROF PROFILE
+ // ============================================================================
+ 
+ // Field numbers of perftools.profiles.Profile (profile.proto)
+ #define PPROF_SAMPLE_TYPE 1
+ #define PPROF_SAMPLE 2
+ #define PPROF_MAPPING 3
+ #define PPROF_LOCATION 4
+ #define PPROF_FUNCTION 5
+ #define PPROF_STRING_TABLE 6
+ #define PPROF_TIME_NANOS 9
+ #define PPROF_PERIOD_TYPE 11
+ #define PPROF_PERIOD 12
+ #define PPROF_COMMENT 13
+ #define PPROF_DEFAULT_SAMPLE_TYPE 14
+ 
+ #define PROTO_VARINT 0
+ #define PROTO_LENGTH 2
+ 
+ // Room for the largest nested message: a sample with a full trace
+ #define PROTO_MESSAGE_SIZE 1024
+ 
+ #define PPROF_INDEX_MIN_CAPACITY 256
+ 
+ // Protobuf message assembled in place before it is written out
+ typedef struct {
+     unsigned char bytes[PROTO_MESSAGE_SIZE];
+     size_t length;
+ } ProtoMessage;
+ 
+ static size_t encode_varint(unsigned char* out, uint64_t value) {
+     size_t length = 0;
+     while (value >= 0x80) {
+         out[length++] = (unsigned char)(value | 0x80);
+         value >>= 7;
+     }
+     out[length++] = (unsigned char)value;
+     return length;
+ }
+ 
+ static void proto_varint(ProtoMessage* message, uint64_t value) {
+     message->length += encode_varint(message->bytes + message->length, value);
+ }
+ 
+ static void proto_uint(ProtoMessage* message, unsigned field, uint64_t value) {
+     proto_varint(message, (uint64_t)field << 3 | PROTO_VARINT);
+     proto_varint(message, value);
+ }
+ 
+ static void proto_nested(ProtoMessage* message, unsigned field, const ProtoMessage* inner) {
+     proto_varint(message, (uint64_t)field << 3 | PROTO_LENGTH);
+     proto_varint(message, inner->length);
+     memcpy(message->bytes + message->length, inner->bytes, inner->length);
+     message->length += inner->length;
+ }
+ 
+ // Top-level Profile field; repeated fields may interleave, so every
+ // entry is written as soon as it is known
+ static void put_proto_field(
+     SnapshotWriter* writer,
+     unsigned field,
+     const void* data,
+     size_t size
+ ) {
+     unsigned char prefix[20];
+     size_t length = encode_varint(prefix, (uint64_t)field << 3 | PROTO_LENGTH);
+     length += encode_varint(prefix + length, size);
+     writer_put(writer, prefix, length);
+     writer_put(writer, data, size);
+ }
+ 
+ static void put_proto_uint(SnapshotWriter* writer, unsigned field, uint64_t value) {
+     unsigned char bytes[20];
+     size_t length = encode_varint(bytes, (uint64_t)field << 3 | PROTO_VARINT);
+     length += encode_varint(bytes + length, value);
+     writer_put(writer, bytes, length);
+ }
+ 
+ // Pointer-keyed id table: interned strings, symbols, frame addresses
+ // and source lines are emitted once
+ typedef struct {
+     uintptr_t key;
+     uint64_t extra;
+     uint64_t id;                // 0 = empty
+ } PprofIndexEntry;
+ 
+ typedef struct {
+     PprofIndexEntry* entries;
+     size_t count;
+     size_t capacity;            // Power of two
+ } PprofIndex;
+ 
+ static size_t index_position(uintptr_t key, uint64_t extra, size_t capacity) {
+     uint64_t hash = ((uint64_t)key ^ extra * 0xff51afd7ed558ccdULL) * 0x9e3779b97f4a7c15ULL;
+     return (size_t)(hash >> 32) & (capacity - 1);
+ }
+ 
+ static uint64_t index_find(const PprofIndex* index, uintptr_t key, uint64_t extra) {
+     if (index->count == 0) {
+         return 0;
+     }
+     size_t mask = index->capacity - 1;
+     for (size_t i = index_position(key, extra, index->capacity);
+          index->entries[i].id != 0; i = (i + 1) & mask) {
+         if (index->entries[i].key == key && index->entries[i].extra == extra) {
+             return index->entries[i].id;
+         }
+     }
+     return 0;
+ }
+ 
+ // Failure only costs deduplication: the entry is emitted again next time
+ static void index_insert(PprofIndex* index, uintptr_t key, uint64_t extra, uint64_t id) {
+     if (index->count + 1 > index->capacity / 2) {
+         size_t capacity = index->capacity ?
+             index->capacity * 2 : PPROF_INDEX_MIN_CAPACITY;
+         PprofIndexEntry* entries = calloc(capacity, sizeof(PprofIndexEntry));
+         if (!entries) {
+             return;
+         }
+         for (size_t i = 0; i < index->capacity; i++) {
+             const PprofIndexEntry* entry = &index->entries[i];
+             if (entry->id != 0) {
+                 size_t position = index_position(entry->key, entry->extra, capacity);
+                 while (entries[position].id != 0) {
+                     position = (position + 1) & (capacity - 1);
+                 }
+                 entries[position] = *entry;
+             }
+         }
+         free(index->entries);
+         index->entries = entries;
+         index->capacity = capacity;
+     }
+ 
+     size_t mask = index->capacity - 1;
+     size_t position = index_position(key, extra, index->capacity);
+     while (index->entries[position].id != 0) {
+         position = (position + 1) & mask;
+     }
+     index->entries[position] = (PprofIndexEntry){ key, extra, id };
+     index->count++;
+ }
+ 
+ // Executable segment of a loaded object
+ typedef struct {
+     uintptr_t start;
+     uintptr_t limit;
+     uint64_t offset;
+     uint64_t filename;          // String table index
+ } PprofMapping;
+ 
+ typedef struct {
+     SnapshotWriter* writer;
+     uint64_t strings;           // String table entries written
+     uint64_t locations;         // Last location id handed out
+     uint64_t functions;         // Last function id handed out
+     PprofIndex string_index;    // Interned text -> string index
+     PprofIndex location_index;  // Frame address or source line -> location
+     PprofIndex function_index;  // Symbol name -> function id
+     PprofMapping* mappings;
+     size_t mapping_count;
+     size_t mapping_capacity;
+     char executable[PATH_MAX];
+ } PprofExport;
+ 
+ static uint64_t pprof_new_string(PprofExport* pprof, const char* text) {
+     put_proto_field(pprof->writer, PPROF_STRING_TABLE, text, strlen(text));
+     return pprof->strings++;
+ }
+ 
+ // Strings reached through long-lived pointers (file names, symbols) are
+ // written once
+ static uint64_t pprof_string(PprofExport* pprof, const char* text) {
+     uint64_t id = index_find(&pprof->string_index, (uintptr_t)text, 0);
+     if (id == 0) {
+         id = pprof_new_string(pprof, text);
+         index_insert(&pprof->string_index, (uintptr_t)text, 0, id);
+     }
+     return id;
+ }
+ 
+ static int collect_mapping(struct dl_phdr_info* info, size_t size, void* context) {
+     (void)size;
+     PprofExport* pprof = context;
+     const char* name = info->dlpi_name;
+     if (!name || !*name) {
+         name = pprof->executable;
+     }
+ 
+     for (ElfW(Half) i = 0; i < info->dlpi_phnum; i++) {
+         const ElfW(Phdr)* segment = &info->dlpi_phdr[i];
+         if (segment->p_type != PT_LOAD || !(segment->p_flags & PF_X)) {
+             continue;
+         }
+         if (pprof->mapping_count == pprof->mapping_capacity) {
+             size_t capacity = pprof->mapping_capacity ? pprof->mapping_capacity * 2 : 16;
+             PprofMapping* mappings =
+                 realloc(pprof->mappings, capacity * sizeof(PprofMapping));
+             if (!mappings) {
+                 return 1;
+             }
+             pprof->mappings = mappings;
+             pprof->mapping_capacity = capacity;
+         }
+         PprofMapping* mapping = &pprof->mappings[pprof->mapping_count++];
+         mapping->start = info->dlpi_addr + segment->p_vaddr;
+         mapping->limit = mapping->start + segment->p_memsz;
+         mapping->offset = segment->p_offset;
+         mapping->filename = pprof_new_string(pprof, name);
+     }
+     return 0;
+ }
+ 
+ // Mappings let pprof symbolize addresses against the binaries offline
+ static void write_pprof_mappings(PprofExport* pprof) {
+     ssize_t length = readlink("/proc/self/exe", pprof->executable,
+                               sizeof(pprof->executable) - 1);
+     pprof->executable[length > 0 ? length : 0] = '\0';
+     dl_iterate_phdr(collect_mapping, pprof);
+ 
+     for (size_t i = 0; i < pprof->mapping_count; i++) {
+         const PprofMapping* mapping = &pprof->mappings[i];
+         ProtoMessage message = { .length = 0 };
+         proto_uint(&message, 1, i + 1);
+         proto_uint(&message, 2, mapping->start);
+         proto_uint(&message, 3, mapping->limit);
+         proto_uint(&message, 4, mapping->offset);
+         proto_uint(&message, 5, mapping->filename);
+         put_proto_field(pprof->writer, PPROF_MAPPING, message.bytes, message.length);
+     }
+ }
+ 
+ static uint64_t pprof_function(
+     PprofExport* pprof,
+     uint64_t name,
+     uint64_t filename,
+     int64_t start_line
+ ) {
+     uint64_t id = ++pprof->functions;
+     ProtoMessage message = { .length = 0 };
+     proto_uint(&message, 1, id);
+     proto_uint(&message, 2, name);
+     proto_uint(&message, 3, name);
+     proto_uint(&message, 4, filename);
+     proto_uint(&message, 5, (uint64_t)start_line);
+     put_proto_field(pprof->writer, PPROF_FUNCTION, message.bytes, message.length);
+     return id;
+ }
+ 
+ static void pprof_location(
+     PprofExport* pprof,
+     uint64_t id,
+     uint64_t mapping,
+     uint64_t address,
+     uint64_t function,
+     int64_t line
+ ) {
+     ProtoMessage message = { .length = 0 };
+     proto_uint(&message, 1, id);
+     if (mapping) {
+         proto_uint(&message, 2, mapping);
+         proto_uint(&message, 3, address);
+     }
+     if (function) {
+         ProtoMessage entry = { .length = 0 };
+         proto_uint(&entry, 1, function);
+         if (line) {
+             proto_uint(&entry, 2, (uint64_t)line);
+         }
+         proto_nested(&message, 4, &entry);
+     }
+     put_proto_field(pprof->writer, PPROF_LOCATION, message.bytes, message.length);
+ }
+ 
+ // Location of a return address, named by its dynamic symbol when it has
+ // one; the rest are left to pprof's own symbolization
+ static uint64_t pprof_frame_location(PprofExport* pprof, const void* address) {
+     uintptr_t call = (uintptr_t)address - 1;
+     uint64_t id = index_find(&pprof->location_index, call, 0);
+     if (id != 0) {
+         return id;
+     }
+ 
+     uint64_t mapping = 0;
+     for (size_t i = 0; i < pprof->mapping_count; i++) {
+         if (call >= pprof->mappings[i].start && call < pprof->mappings[i].limit) {
+             mapping = i + 1;
+             break;
+         }
+     }
+     uint64_t function = 0;
+     Dl_info info;
+     if (dladdr((const void*)call, &info) && info.dli_sname) {
+         function = index_find(&pprof->function_index, (uintptr_t)info.dli_sname, 0);
+         if (function == 0) {
+             function = pprof_function(pprof, pprof_string(pprof, info.dli_sname), 0, 0);
+             index_insert(&pprof->function_index, (uintptr_t)info.dli_sname, 0, function);
+         }
+     }
+ 
+     id = ++pprof->locations;
+     pprof_location(pprof, id, mapping, call, function, 0);
+     index_insert(&pprof->location_index, call, 0, id);
+     return id;
+ }
+ 
+ // Location of an ALLOCATE source line, shown as a function "file:line"
+ static uint64_t pprof_source_location(PprofExport* pprof, const MemoryCallSite* site) {
+     // Lines are offset by one so no source key matches a frame's
+     uint64_t line = (uint64_t)site->line_number + 1;
+     uint64_t id = index_find(&pprof->location_index, (uintptr_t)site->filename, line);
+     if (id != 0) {
+         return id;
+     }
+ 
+     char name[256];
+     snprintf(name, sizeof(name), "%s:%d", site->filename, site->line_number);
+     uint64_t function = pprof_function(pprof, pprof_new_string(pprof, name),
+                                        pprof_string(pprof, site->filename),
+                                        site->line_number);
+     id = ++pprof->locations;
+     pprof_location(pprof, id, 0, 0, function, site->line_number);
+     index_insert(&pprof->location_index, (uintptr_t)site->filename, line, id);
+     return id;
+ }
+ 
+ static void write_pprof_sample(
+     PprofExport* pprof,
+     const MemorySiteProfile* profile,
+     uint64_t type_key
+ ) {
+     ProtoMessage locations = { .length = 0 };
+     if (profile->site.line_number != MEMORY_CALLER_LINE) {
+         proto_varint(&locations, pprof_source_location(pprof, &profile->site));
+     }
+     const void* frames[MEMORY_TRACE_MAX_DEPTH];
+     size_t depth = site_frames(&profile->site, frames);
+     for (size_t i = 0; i < depth; i++) {
+         proto_varint(&locations, pprof_frame_location(pprof, frames[i]));
+     }
+ 
+     // Same order as the sample types written by write_pprof
+     ProtoMessage values = { .length = 0 };
+     proto_varint(&values, profile->allocations);
+     proto_varint(&values, profile->allocated_bytes);
+     proto_varint(&values, profile->live_blocks);
+     proto_varint(&values, profile->live_bytes);
+ 
+     ProtoMessage label = { .length = 0 };
+     proto_uint(&label, 1, type_key);
+     proto_uint(&label, 2, pprof_string(pprof, g_type_names[profile->site.type]));
+ 
+     ProtoMessage sample = { .length = 0 };
+     proto_nested(&sample, 1, &locations);
+     proto_nested(&sample, 2, &values);
+     proto_nested(&sample, 3, &label);
+     put_proto_field(pprof->writer, PPROF_SAMPLE, sample.bytes, sample.length);
+     pprof->writer->site_records++;
+ }
+ 
+ static void write_pprof_value_type(
+     PprofExport* pprof,
+     unsigned field,
+     const char* type,
+     const char* unit
+ ) {
+     ProtoMessage message = { .length = 0 };
+     proto_uint(&message, 1, pprof_string(pprof, type));
+     proto_uint(&message, 2, pprof_string(pprof, unit));
+     put_proto_field(pprof->writer, field, message.bytes, message.length);
+ }
+ 
+ // Uncompressed perftools.profiles.Profile with one sample per call site,
+ // valued as the heap profiles pprof knows (alloc_*, inuse_*)
+ static void write_pprof(SnapshotWriter* writer) {
+     PprofExport pprof = { .writer = writer };
+     pprof_new_string(&pprof, "");
+ 
+     write_pprof_value_type(&pprof, PPROF_SAMPLE_TYPE, "alloc_objects", "count");
+     write_pprof_value_type(&pprof, PPROF_SAMPLE_TYPE, "alloc_space", "bytes");
+     write_pprof_value_type(&pprof, PPROF_SAMPLE_TYPE, "inuse_objects", "count");
+     write_pprof_value_type(&pprof, PPROF_SAMPLE_TYPE, "inuse_space", "bytes");
+     put_proto_uint(writer, PPROF_DEFAULT_SAMPLE_TYPE, pprof_string(&pprof, "inuse_space"));
+     write_pprof_value_type(&pprof, PPROF_PERIOD_TYPE, "space", "bytes");
+ 
+     size_t interval = memory_manager_get_sample_interval();
+     put_proto_uint(writer, PPROF_PERIOD, interval);
+     if (interval) {
+         char comment[128];
+         snprintf(comment, sizeof(comment),
+                  "one sample per %zu bytes allocated; values are estimates", interval);
+         put_proto_uint(writer, PPROF_COMMENT, pprof_new_string(&pprof, comment));
+     }
+     struct timespec now;
+     clock_gettime(CLOCK_REALTIME, &now);
+     put_proto_uint(writer, PPROF_TIME_NANOS,
+                    (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec);
+ 
+     write_pprof_mappings(&pprof);
+ 
+     MemorySiteProfile* profiles;
+     size_t count = collect_profiles(&profiles);
+     uint64_t type_key = pprof_string(&pprof, "type");
+     for (size_t i = 0; i < count; i++) {
+         if (profiles[i].allocations != 0 || profiles[i].live_blocks != 0) {
+             write_pprof_sample(&pprof, &profiles[i], type_key);
+         }
+     }
+ 
+     free(profiles);
+     free(pprof.mappings);
+     free(pprof.string_index.entries);
+     free(pprof.location_index.entries);
+     free(pprof.function_index.entries);
+ }
+ 
+ static void write_snapshot(SnapshotWriter* writer) {
+     if (writer->format == MEMORY_SNAPSHOT_PPROF) {
+         write_pprof(writer);
+         return;
+     }
+     if (writer->format == MEMORY_SNAPSHOT_FOLDED_LIVE ||
+         writer->format == MEMORY_SNAPSHOT_FOLDED_ALLOCATED) {
+         write_folded(writer);
+         return;
+     }
+     write_header(writer);
+     write_totals(writer);
+     write_sites(writer);
+     memory_manager_for_each_block(write_block, writer);
+     write_end(writer);
+ }
+ 
+ size_t memory_snapshot_write(
+     MemorySnapshotFormat format,
+     void* buffer,
+     size_t capacity
+ ) {
+     SnapshotWriter writer = {
+         .buffer = buffer,
+         .capacity = buffer ? capacity : 0,
+         .fd = -1,
+         .format = format
+     };
+     write_snapshot(&writer);
+     return writer.total;
+ }
+ 
+ ssize_t memory_snapshot_write_fd(MemorySnapshotFormat format, int fd) {
+     unsigned char staging[MEMORY_SNAPSHOT_STAGING_SIZE];
+     SnapshotWriter writer = {
+         .buffer = staging,
+         .capacity = sizeof(staging),
+         .fd = fd,
+         .format = format
+     };
+     write_snapshot(&writer);
+     writer_drain(&writer);
+     return writer.failed ? -1 : (ssize_t)writer.total;
+ }
@@ -0,0 +1,76 @@
+/**
+ * @file memory_snapshot.h
+ * @brief Machine-Readable Snapshots of the Memory Tracker
+ *
+ * A snapshot holds the tracker totals, every call site with its
+ * aggregated counters and every live tracked block. It is streamed into
+ * a caller buffer or a file descriptor as compact binary records or as
+ * JSON. Scratch memory comes from malloc, never from the tracker, and
+ * shards are locked one at a time (see memory_manager_for_each_block).
+ *
+ * Binary layout (host byte order, fields packed without padding):
+ *   header  "MMSNAP" u16 version, u32 byte-order mark 0x01020304,
+ *           u64 timestamp, f64 ns per tick
+ *   totals  'T' u64 blocks, bytes, arena blocks, arena bytes,
+ *           persistent blocks, persistent bytes
+ *   site    'S' u32 id, u8 type, i32 line, u16 name length, name bytes,
+ *           u64 live blocks, live bytes, peak bytes, allocations,
+ *           allocated bytes, f64 allocations per second
+ *   block   'B' u64 pointer, u64 size, u64 timestamp, u32 site id,
+ *           u8 type, u8 status
+ *   end     'E' u64 site records, u64 block records
+ *
+ * The same calls also export the per-site counters as heap profiles for
+ * existing tools. MEMORY_SNAPSHOT_PPROF is an uncompressed pprof Profile
+ * protobuf (`pprof -sample_index=alloc_space program heap.pb`) with one
+ * sample per site: alloc_objects, alloc_space, inuse_objects and
+ * inuse_space, labelled with the allocation type. The folded formats
+ * write one "frame;frame;file:line bytes" line per site for flamegraph.pl
+ * and similar tools. Stacks come from trace capture
+ * (memory_manager_set_trace_depth); without it each site is a single
+ * frame. Neither includes arena-served MEMORY_TYPE_TEMPORARY blocks.
+ */
+ 
+ #ifndef MEMORY_SNAPSHOT_H
+ #define MEMORY_SNAPSHOT_H
+ 
+ #include <stddef.h>
+ #include <sys/types.h>
+ 
+ #define MEMORY_SNAPSHOT_VERSION 1
+ 
+ // Staging buffer used when streaming to a file descriptor
+ #define MEMORY_SNAPSHOT_STAGING_SIZE 8192
+ 
+ // Snapshot encodings
+ typedef enum {
+     MEMORY_SNAPSHOT_BINARY,
+     MEMORY_SNAPSHOT_JSON,
+     MEMORY_SNAPSHOT_PPROF,              // pprof heap profile (protobuf)
+     MEMORY_SNAPSHOT_FOLDED_LIVE,        // Folded stacks, live bytes
+     MEMORY_SNAPSHOT_FOLDED_ALLOCATED    // Folded stacks, cumulative bytes
+ } MemorySnapshotFormat;
+ 
+ /**
+  * @brief Write a snapshot into a caller buffer
+  * @param format Snapshot encoding
+  * @param buffer Destination (may be NULL when capacity is 0)
+  * @param capacity Bytes available in buffer
+  * @return Bytes the full snapshot needs; output is truncated when this
+  *         exceeds capacity (text formats are not NUL-terminated)
+  */
+ size_t memory_snapshot_write(
+     MemorySnapshotFormat format,
+     void* buffer,
+     size_t capacity
+ );
+ 
+ /**
+  * @brief Stream a snapshot to a file descriptor
+  * @param format Snapshot encoding
+  * @param fd Open file descriptor
+  * @return Bytes written, or -1 if a write failed
+  */
+ ssize_t memory_snapshot_write_fd(MemorySnapshotFormat format, int fd);
+ 
+ #endif // MEMORY_SNAPSHOT_H
@@ -0,0 +1,75 @@
+/**
+ * @file memory_system.h
+ * @brief C Library Allocator Behind the Tracker's Own Storage
+ *
+ * Tracking tables and tracked heap blocks are carved from the C library
+ * allocator. When the tracker is built into the LD_PRELOAD shim
+ * (MEMORY_PRELOAD=1) malloc and friends are the shim itself, so these
+ * wrappers call glibc's implementation directly instead.
+ */
+ 
+ #ifndef MEMORY_SYSTEM_H
+ #define MEMORY_SYSTEM_H
+ 
+ #include <errno.h>
+ #include <stdlib.h>
+ 
+ #ifndef MEMORY_PRELOAD
+ #define MEMORY_PRELOAD 0
+ #endif
+ 
+ #if MEMORY_PRELOAD
+ // glibc's allocator under its interposable names
+ void* __libc_malloc(size_t size);
+ void* __libc_calloc(size_t count, size_t size);
+ void* __libc_realloc(void* memory, size_t size);
+ void* __libc_memalign(size_t alignment, size_t size);
+ void __libc_free(void* memory);
+ #endif
+ 
+ static inline void* memory_system_malloc(size_t size) {
+ #if MEMORY_PRELOAD
+     return __libc_malloc(size);
+ #else
+     return malloc(size);
+ #endif
+ }
+ 
+ static inline void* memory_system_calloc(size_t count, size_t size) {
+ #if MEMORY_PRELOAD
+     return __libc_calloc(count, size);
+ #else
+     return calloc(count, size);
+ #endif
+ }
+ 
+ static inline void* memory_system_realloc(void* memory, size_t size) {
+ #if MEMORY_PRELOAD
+     return __libc_realloc(memory, size);
+ #else
+     return realloc(memory, size);
+ #endif
+ }
+ 
+ static inline int memory_system_memalign(
+     void** memory,
+     size_t alignment,
+     size_t size
+ ) {
+ #if MEMORY_PRELOAD
+     *memory = __libc_memalign(alignment, size);
+     return *memory ? 0 : ENOMEM;
+ #else
+     return posix_memalign(memory, alignment, size);
+ #endif
+ }
+ 
+ static inline void memory_system_free(void* memory) {
+ #if MEMORY_PRELOAD
+     __libc_free(memory);
+ #else
+     free(memory);
+ #endif
+ }
+ 
+ #endif // MEMORY_SYSTEM_H
@@ -0,0 +1,289 @@
+/**
+ * @file memory_trace.c
+ * @brief Stack Trace Table Implementation
+ */
+ 
+ #define _GNU_SOURCE
+ 
+ #include <execinfo.h>
+ #include <pthread.h>
+ #include "memory_manager.h"
+ #include "memory_system.h"
+ #include "memory_trace.h"
+ 
+ #if MEMORY_THREAD_SAFE
+ #define TRACE_LOCK(mutex) pthread_mutex_lock(mutex)
+ #define TRACE_UNLOCK(mutex) pthread_mutex_unlock(mutex)
+ #else
+ #define TRACE_LOCK(mutex) ((void)0)
+ #define TRACE_UNLOCK(mutex) ((void)0)
+ #endif
+ 
+ #define TRACE_MIN_CAPACITY 256
+ #define TRACE_CACHE_SIZE 64
+ 
+ // Frames searched for the entry point: the tracker's own calls, plus the
+ // interposed function when called through the LD_PRELOAD shim
+ #define TRACE_ENTRY_SEARCH 8
+ 
+ // Farthest a caller's frame may lie above its callee's in a frame-pointer
+ // walk; anything else ends the walk
+ #define TRACE_FRAME_SPAN (1024 * 1024)
+ 
+ // Interned stack; never changes once published
+ typedef struct {
+     uint64_t hash;
+     uint32_t depth;
+     const void* frames[MEMORY_TRACE_MAX_DEPTH];
+ } MemoryTraceRecord;
+ 
+ // Trace interning table: frames -> trace id. Records live in fixed
+ // chunks so lock-free readers never see them move.
+ static struct {
+ #if MEMORY_THREAD_SAFE
+     pthread_mutex_t lock;       // Guards index and insertion
+ #endif
+     MemoryTraceRecord* chunks[MEMORY_MAX_TRACE_CHUNKS];
+     uint32_t* index;            // Hash of traces (trace id, 0 = empty)
+     size_t count;
+     size_t capacity;            // Index buckets (power of two)
+ } g_trace_table = {
+ #if MEMORY_THREAD_SAFE
+     .lock = PTHREAD_MUTEX_INITIALIZER
+ #endif
+ };
+ 
+ // Per-thread direct-mapped cache in front of the shared table, so a hot
+ // stack is found without the lock
+ typedef struct {
+     uint64_t hash;
+     uint32_t trace_id;
+ } MemoryTraceCacheEntry;
+ 
+ static __thread MemoryTraceCacheEntry t_trace_cache[TRACE_CACHE_SIZE];
+ static uint64_t g_trace_generation = 1;
+ static __thread uint64_t t_trace_generation;
+ 
+ #if MEMORY_TRACE_FRAME_POINTERS
+ // Top of the calling thread's stack, bounding the frame-pointer walk
+ static __thread uintptr_t t_stack_top;
+ 
+ static uintptr_t stack_top(void) {
+     if (t_stack_top == 0) {
+         pthread_attr_t attributes;
+         void* base;
+         size_t size;
+         if (pthread_getattr_np(pthread_self(), &attributes) != 0) {
+             return 0;
+         }
+         if (pthread_attr_getstack(&attributes, &base, &size) == 0) {
+             t_stack_top = (uintptr_t)base + size;
+         }
+         pthread_attr_destroy(&attributes);
+     }
+     return t_stack_top;
+ }
+ 
+ // Follow the saved frame-pointer chain. Each frame must lie above the
+ // last one, near it and below the stack top, so a function built without
+ // frame pointers ends the walk instead of sending it astray.
+ __attribute__((noinline))
+ static int walk_frames(void** stack, int capacity) {
+     uintptr_t top = stack_top();
+     void** frame = __builtin_frame_address(0);
+     int taken = 0;
+     while (taken < capacity && (uintptr_t)(frame + 2) <= top) {
+         if (!frame[1]) {
+             break;
+         }
+         stack[taken++] = frame[1];
+         void** next = frame[0];
+         if (next <= frame || ((uintptr_t)next & (sizeof(void*) - 1)) != 0 ||
+             (uintptr_t)next - (uintptr_t)frame > TRACE_FRAME_SPAN) {
+             break;
+         }
+         frame = next;
+     }
+     return taken;
+ }
+ #else
+ static int walk_frames(void** stack, int capacity) {
+     return backtrace(stack, capacity);
+ }
+ #endif
+ 
+ static uint64_t hash_frames(const void* const* frames, size_t depth) {
+     uint64_t hash = depth;
+     for (size_t i = 0; i < depth; i++) {
+         hash = (hash ^ (uint64_t)(uintptr_t)frames[i]) * 0x9e3779b97f4a7c15ULL;
+         hash ^= hash >> 29;
+     }
+     return hash;
+ }
+ 
+ static MemoryTraceRecord* trace_record(uint32_t trace_id) {
+     return &g_trace_table.chunks[(trace_id - 1) / MEMORY_TRACE_CHUNK]
+                                 [(trace_id - 1) % MEMORY_TRACE_CHUNK];
+ }
+ 
+ static bool trace_matches(
+     const MemoryTraceRecord* record,
+     uint64_t hash,
+     const void* const* frames,
+     size_t depth
+ ) {
+     return record->hash == hash && record->depth == depth &&
+            memcmp(record->frames, frames, depth * sizeof(void*)) == 0;
+ }
+ 
+ static bool trace_index_grow(void) {
+     size_t capacity = g_trace_table.capacity ?
+         g_trace_table.capacity * 2 : TRACE_MIN_CAPACITY;
+     uint32_t* index = memory_system_calloc(capacity, sizeof(uint32_t));
+     if (!index) {
+         return false;
+     }
+ 
+     for (uint32_t id = 1; id <= g_trace_table.count; id++) {
+         size_t position = trace_record(id)->hash & (capacity - 1);
+         while (index[position] != 0) {
+             position = (position + 1) & (capacity - 1);
+         }
+         index[position] = id;
+     }
+     memory_system_free(g_trace_table.index);
+     g_trace_table.index = index;
+     g_trace_table.capacity = capacity;
+     return true;
+ }
+ 
+ // Slow path: look up or insert the trace under the table lock
+ static uint32_t intern_trace_locked(
+     uint64_t hash,
+     const void* const* frames,
+     size_t depth
+ ) {
+     uint32_t id = MEMORY_NO_TRACE;
+     TRACE_LOCK(&g_trace_table.lock);
+ 
+     if (g_trace_table.count + 1 > g_trace_table.capacity / 2 &&
+         !trace_index_grow()) {
+         goto done;
+     }
+ 
+     size_t mask = g_trace_table.capacity - 1;
+     size_t position = hash & mask;
+     uint32_t entry;
+     while ((entry = g_trace_table.index[position]) != 0) {
+         if (trace_matches(trace_record(entry), hash, frames, depth)) {
+             id = entry;
+             goto done;
+         }
+         position = (position + 1) & mask;
+     }
+ 
+     size_t chunk = g_trace_table.count / MEMORY_TRACE_CHUNK;
+     if (chunk >= MEMORY_MAX_TRACE_CHUNKS) {
+         goto done;
+     }
+     if (!g_trace_table.chunks[chunk]) {
+         MemoryTraceRecord* traces =
+             memory_system_calloc(MEMORY_TRACE_CHUNK, sizeof(MemoryTraceRecord));
+         if (!traces) {
+             goto done;
+         }
+         g_trace_table.chunks[chunk] = traces;
+     }
+ 
+     id = (uint32_t)g_trace_table.count + 1;
+     MemoryTraceRecord* record = trace_record(id);
+     record->hash = hash;
+     record->depth = (uint32_t)depth;
+     memcpy(record->frames, frames, depth * sizeof(void*));
+     g_trace_table.index[position] = id;
+     __atomic_store_n(&g_trace_table.count, g_trace_table.count + 1, __ATOMIC_RELEASE);
+ 
+ done:
+     TRACE_UNLOCK(&g_trace_table.lock);
+     return id;
+ }
+ 
+ uint32_t memory_trace_capture(const void* entry, unsigned depth) {
+     if (depth > MEMORY_TRACE_MAX_DEPTH) {
+         depth = MEMORY_TRACE_MAX_DEPTH;
+     }
+     void* stack[TRACE_ENTRY_SEARCH + MEMORY_TRACE_MAX_DEPTH];
+     int taken = walk_frames(stack, (int)(TRACE_ENTRY_SEARCH + depth));
+ 
+     // Frames below the entry point are the tracker's own; without it in
+     // sight only this function's frame is dropped
+     int first = 1;
+     for (int i = 1; i < taken && i <= TRACE_ENTRY_SEARCH; i++) {
+         if (stack[i] == entry) {
+             first = i;
+             break;
+         }
+     }
+     if (first >= taken) {
+         return MEMORY_NO_TRACE;
+     }
+     size_t kept = (size_t)(taken - first) < depth ? (size_t)(taken - first) : depth;
+     const void* const* frames = (const void* const*)(stack + first);
+     uint64_t hash = hash_frames(frames, kept);
+ 
+     // memory_trace_forget_all bumps the generation to invalidate every cache
+     uint64_t generation = __atomic_load_n(&g_trace_generation, __ATOMIC_ACQUIRE);
+     if (t_trace_generation != generation) {
+         memset(t_trace_cache, 0, sizeof(t_trace_cache));
+         t_trace_generation = generation;
+     }
+ 
+     MemoryTraceCacheEntry* cached = &t_trace_cache[hash % TRACE_CACHE_SIZE];
+     if (cached->trace_id != MEMORY_NO_TRACE && cached->hash == hash &&
+         trace_matches(trace_record(cached->trace_id), hash, frames, kept)) {
+         return cached->trace_id;
+     }
+ 
+     uint32_t id = intern_trace_locked(hash, frames, kept);
+     if (id != MEMORY_NO_TRACE) {
+         cached->hash = hash;
+         cached->trace_id = id;
+     }
+     return id;
+ }
+ 
+ size_t memory_trace_frames(uint32_t trace_id, const void** frames, size_t capacity) {
+     if (trace_id == MEMORY_NO_TRACE ||
+         trace_id > __atomic_load_n(&g_trace_table.count, __ATOMIC_ACQUIRE)) {
+         return 0;
+     }
+     const MemoryTraceRecord* record = trace_record(trace_id);
+     size_t depth = record->depth < capacity ? record->depth : capacity;
+     memcpy(frames, record->frames, depth * sizeof(void*));
+     return depth;
+ }
+ 
+ size_t memory_trace_count(void) {
+     return __atomic_load_n(&g_trace_table.count, __ATOMIC_ACQUIRE);
+ }
+ 
+ void memory_trace_prepare(void) {
+ #if !MEMORY_TRACE_FRAME_POINTERS
+     void* frame;
+     backtrace(&frame, 1);
+ #endif
+ }
+ 
+ void memory_trace_forget_all(void) {
+     TRACE_LOCK(&g_trace_table.lock);
+     for (size_t i = 0; i < MEMORY_MAX_TRACE_CHUNKS; i++) {
+         memory_system_free(g_trace_table.chunks[i]);
+         g_trace_table.chunks[i] = NULL;
+     }
+     memory_system_free(g_trace_table.index);
+     g_trace_table.index = NULL;
+     g_trace_table.count = 0;
+     g_trace_table.capacity = 0;
+     __atomic_add_fetch(&g_trace_generation, 1, __ATOMIC_RELEASE);
+     TRACE_UNLOCK(&g_trace_table.lock);
+ }
@@ -0,0 +1,69 @@
+/**
+ * @file memory_trace.h
+ * @brief Deduplicated Stack Traces of Tracked Allocations
+ *
+ * With trace capture on (memory_manager_set_trace_depth) every tracked
+ * allocation takes the call stack above the tracker's entry point. Equal
+ * stacks share one entry of a hashed trace table, and call sites are
+ * interned per (site, trace), so a block reaches its stack through
+ * MemoryBlock::site_id and MemoryCallSite::trace_id.
+ */
+ 
+ #ifndef MEMORY_TRACE_H
+ #define MEMORY_TRACE_H
+ 
+ #include <stddef.h>
+ #include <stdint.h>
+ 
+ // Stack walker: the C library unwinder, which reads unwind tables and
+ // works on any code, or the saved frame-pointer chain when set to 1 (far
+ // cheaper, but every caller must be built with -fno-omit-frame-pointer)
+ #ifndef MEMORY_TRACE_FRAME_POINTERS
+ #define MEMORY_TRACE_FRAME_POINTERS 0
+ #endif
+ 
+ // Trace Table Configuration
+ #define MEMORY_TRACE_MAX_DEPTH 32
+ #define MEMORY_TRACE_CHUNK 256
+ #define MEMORY_MAX_TRACE_CHUNKS 256
+ 
+ // Trace id of a site without a stack trace; real ids start at 1
+ #define MEMORY_NO_TRACE 0
+ 
+ /**
+  * @brief Capture the calling thread's stack and intern it
+  * @param entry Return address into the code that called the tracker; the
+  *              trace starts at this frame
+  * @param depth Frames to keep, at most MEMORY_TRACE_MAX_DEPTH
+  * @return Trace id, or MEMORY_NO_TRACE when the stack cannot be taken or
+  *         the table is full
+  */
+ uint32_t memory_trace_capture(const void* entry, unsigned depth);
+ 
+ /**
+  * @brief Copy the frames of a trace, innermost first
+  * @param trace_id Trace id from MemoryCallSite::trace_id
+  * @param frames Output return addresses
+  * @param capacity Entries available in frames
+  * @return Frames written (0 for MEMORY_NO_TRACE or an unknown id)
+  */
+ size_t memory_trace_frames(uint32_t trace_id, const void** frames, size_t capacity);
+ 
+ /**
+  * @brief Get the number of distinct traces interned so far
+  * @return Trace count
+  */
+ size_t memory_trace_count(void);
+ 
+ /**
+  * @brief Load the unwinder ahead of the first capture, which would
+  *        otherwise open it from inside an allocation
+  */
+ void memory_trace_prepare(void);
+ 
+ /**
+  * @brief Drop every trace (used by memory_manager_init)
+  */
+ void memory_trace_forget_all(void);
+ 
+ #endif // MEMORY_TRACE_H